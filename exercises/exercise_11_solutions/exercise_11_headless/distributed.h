@@ -0,0 +1,597 @@
+//
+// Distributed rendering of stills: a coordinator splits the frame in jobs (rectangles of pixels) and hands them to
+// worker processes over TCP, on this machine or on others. POSIX only, see CMakeLists.txt.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_DISTRIBUTED_H
+#define ITU_GRAPHICS_PROGRAMMING_DISTRIBUTED_H
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "rt_renderer.h"
+#include "frame_buffer.h"
+#include "scenes.h"
+
+// the protocol: every message is a MessageHeader followed by size bytes of payload. The structs are sent as they are
+// in memory, so the coordinator and its workers must agree on byte order and float format (any x86 or ARM machine).
+//   worker -> coordinator  Hello  Hello, once connected
+//   coordinator -> worker  Setup  FrameSpec, the scene and camera of the next jobs. The worker loads the scene (from
+//                                 its own files) unless it is the one it already has
+//   worker -> coordinator  Ready  Ready, the scene is loaded
+//   coordinator -> worker  Job    Job, a rectangle of pixels to trace
+//   worker -> coordinator  Result Result followed by the linear colors (rt::Colors::color) of the rectangle, row by row
+//   coordinator -> worker  Quit   no payload
+// a worker handles its messages in order, so the coordinator can queue several jobs before their results come back.
+// A payload larger than its type allows (see maxPayload) ends the connection
+namespace distributed {
+
+    const uint32_t protocolVersion = 2;
+
+    enum MessageType : uint32_t { Hello = 1, Setup, Ready, Job, Result, Quit };
+
+    struct MessageHeader {
+        uint32_t type;
+        uint32_t size;
+    };
+
+    struct HelloMessage {
+        uint32_t version;
+        uint32_t threads;
+    };
+
+    // what the jobs of a frame trace, the worker builds the view matrix the way the single process renderer does
+    struct FrameSpec {
+        char scene[256]; // name understood by makeScene, null terminated
+        uint32_t flatten;
+        uint32_t width, height, depth;
+        float fov;
+        uint32_t shadows, shading; // rt::TraceSettings, shading is an rt::ShadingModel
+        uint32_t customCamera, customTarget; // otherwise the default camera of the scene
+        float camera[3], target[3];
+        uint32_t frame; // ties the jobs and the results to the frame
+    };
+
+    struct ReadyMessage {
+        uint32_t ok;   // 0 if the worker can't load the scene
+        float loadMs;  // 0 if the scene was already loaded
+    };
+
+    struct JobMessage {
+        uint32_t frame, id;
+        uint32_t x0, y0, x1, y1;
+    };
+
+    struct ResultMessage {
+        uint32_t frame, id;
+        float ms; // time spent tracing the job
+    };
+
+    // jobs are at most this many pixels on a side, which bounds the size of a Result
+    const uint32_t maxJobSize = 1024;
+
+    // the largest payload a message of type can have, a message with a larger one is an error
+    inline uint32_t maxPayload(uint32_t type){
+        switch (type){
+            case Hello: return sizeof(HelloMessage);
+            case Setup: return sizeof(FrameSpec);
+            case Ready: return sizeof(ReadyMessage);
+            case Job: return sizeof(JobMessage);
+            case Result: return sizeof(ResultMessage) + maxJobSize * maxJobSize * sizeof(rt::Colors::color);
+            default: return 0;
+        }
+    }
+
+    bool sendAll(int fd, const void *data, size_t size){
+        const char *bytes = (const char *) data;
+        while (size > 0){
+            ssize_t sent = send(fd, bytes, size, 0);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            bytes += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    bool receiveAll(int fd, void *data, size_t size){
+        char *bytes = (char *) data;
+        while (size > 0){
+            ssize_t received = recv(fd, bytes, size, 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) return false;
+            bytes += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    // a message whose payload is part followed by the extraSize bytes at extra
+    bool sendMessage(int fd, MessageType type, const void *part = nullptr, uint32_t partSize = 0,
+                     const void *extra = nullptr, uint32_t extraSize = 0){
+        MessageHeader header{type, partSize + extraSize};
+        return sendAll(fd, &header, sizeof(header)) && (partSize == 0 || sendAll(fd, part, partSize)) &&
+               (extraSize == 0 || sendAll(fd, extra, extraSize));
+    }
+
+    // blocks until a whole message arrived, returns false if the connection was closed or the payload is larger than
+    // its type allows
+    bool receiveMessage(int fd, MessageHeader &header, std::vector<char> &payload){
+        if (!receiveAll(fd, &header, sizeof(header)) || header.size > maxPayload(header.type)) return false;
+        payload.resize(header.size);
+        return header.size == 0 || receiveAll(fd, payload.data(), header.size);
+    }
+
+    // the payload as a T, false if it is too short
+    template <typename T>
+    bool readPayload(const std::vector<char> &payload, T &value){
+        if (payload.size() < sizeof(T)) return false;
+        memcpy(&value, payload.data(), sizeof(T));
+        return true;
+    }
+
+    // small jobs stream well, but each one costs a round trip and a parallelFor on the worker
+    void disableNagle(int fd){
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    // receiving on fd fails after ms milliseconds without data, 0 waits forever
+    void setReceiveTimeout(int fd, int ms){
+        timeval timeout{};
+        timeout.tv_sec = ms / 1000;
+        timeout.tv_usec = (ms % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    // splits "host:port", the host defaults to localhost
+    bool parseAddress(const std::string &address, std::string &host, std::string &port){
+        size_t colon = address.rfind(':');
+        host = colon == std::string::npos || colon == 0 ? "127.0.0.1" : address.substr(0, colon);
+        port = colon == std::string::npos ? address : address.substr(colon + 1);
+        return !port.empty();
+    }
+
+    // the worker process: connects to the coordinator at address, and traces the jobs it gets until it is told to quit
+    // or the coordinator goes away. Returns the exit code of the process
+    int runWorker(const std::string &address, rt::Renderer &renderer){
+        std::string host, port;
+        addrinfo hints{}, *addresses = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (!parseAddress(address, host, port) || getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+            std::cerr << "worker: bad coordinator address " << address << std::endl;
+            return 1;
+        }
+        int fd = -1;
+        for (addrinfo *a = addresses; a && fd < 0; a = a->ai_next){
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) { close(fd); fd = -1; }
+        }
+        freeaddrinfo(addresses);
+        if (fd < 0) {
+            std::cerr << "worker: can't connect to " << address << std::endl;
+            return 1;
+        }
+        disableNagle(fd);
+
+        HelloMessage hello{protocolVersion, renderer.threadCount()};
+        sendMessage(fd, Hello, &hello, sizeof(hello));
+
+        Scene scene;
+        FrameSpec frame{};
+        std::string loadedScene;
+        uint32_t loadedFlatten = 0;
+        glm::mat4 view(1);
+        MessageHeader header;
+        std::vector<char> payload;
+        std::vector<rt::Colors::color> colors;
+        while (receiveMessage(fd, header, payload)){
+            if (header.type == Quit) break;
+            if (header.type == Setup && readPayload(payload, frame)) {
+                frame.scene[sizeof(frame.scene) - 1] = 0;
+                ReadyMessage ready{1, 0};
+                if (loadedScene != frame.scene || loadedFlatten != frame.flatten) {
+                    auto start = std::chrono::high_resolution_clock::now();
+                    renderer.setInstances(nullptr);
+                    renderer.setMappedMesh(nullptr);
+                    scene = Scene();
+                    loadedScene.clear();
+                    if (makeScene(frame.scene, scene)) {
+                        if (frame.flatten) flattenScene(scene);
+                        renderer.setInstances(scene.instances.get());
+                        renderer.setMappedMesh(scene.mapped.get());
+                        if (!scene.instances && !scene.mapped) renderer.buildAccelerationStructure(scene.vts);
+                        loadedScene = frame.scene;
+                        loadedFlatten = frame.flatten;
+                    }
+                    else ready.ok = 0;
+                    std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+                    ready.loadMs = elapsed.count();
+                }
+                glm::vec3 cameraPos = frame.customCamera ? glm::vec3(frame.camera[0], frame.camera[1], frame.camera[2])
+                                                         : scene.cameraPos;
+                glm::vec3 cameraTarget = frame.customTarget ? glm::vec3(frame.target[0], frame.target[1], frame.target[2])
+                                                            : scene.cameraTarget;
+                view = glm::lookAt(cameraPos, cameraTarget, glm::vec3(0, 1, 0));
+                rt::TraceSettings trace = renderer.traceSettings();
+                trace.shadows = frame.shadows != 0;
+                trace.shading = rt::ShadingModel(std::min<uint32_t>(frame.shading, uint32_t(rt::ShadingModel::Flat)));
+                renderer.setTraceSettings(trace);
+                if (!sendMessage(fd, Ready, &ready, sizeof(ready))) break;
+            }
+            else if (header.type == Job) {
+                JobMessage job;
+                if (!readPayload(payload, job) || loadedScene.empty() || job.frame != frame.frame ||
+                    job.x1 > frame.width || job.y1 > frame.height || job.x0 >= job.x1 || job.y0 >= job.y1 ||
+                    job.x1 - job.x0 > maxJobSize || job.y1 - job.y0 > maxJobSize) continue;
+                renderer.renderRegion(scene.vts, glm::mat4(1), view, frame.fov, frame.depth, frame.width, frame.height,
+                                      job.x0, job.y0, job.x1, job.y1, colors);
+                ResultMessage result{job.frame, job.id, renderer.lastTraceTime()};
+                if (!sendMessage(fd, Result, &result, sizeof(result), colors.data(),
+                                 uint32_t(colors.size() * sizeof(rt::Colors::color)))) break;
+            }
+        }
+        renderer.setInstances(nullptr);
+        renderer.setMappedMesh(nullptr);
+        close(fd);
+        return 0;
+    }
+
+    // what happened while rendering one frame
+    struct FrameStats {
+        float ms = 0;                   // from the first job sent to the last result received
+        unsigned int jobs = 0;
+        unsigned int duplicates = 0;    // straggler jobs sent to a second worker
+        unsigned int wasted = 0;        // results that arrived after another worker finished the same job
+        unsigned int requeued = 0;      // jobs lost with a worker that disconnected
+        std::vector<unsigned int> jobsPerWorker;
+    };
+
+    // hands the jobs of a frame to the workers that connected to it. Jobs are handed out on demand, a few at a time
+    // per worker, so faster workers get more of them. Once no job is left to hand out, an idle worker gets a copy of
+    // the oldest unfinished job that has been running for much longer than a typical job (a straggler: a slow, busy
+    // or hung worker), and the first result to arrive is used. Jobs of workers that disconnect are handed out again
+    class Coordinator {
+    public:
+        // jobs running for longer than this many times the median job are duplicated
+        float stragglerFactor = 3.0f;
+        // jobs sent to a worker before its results come back, so that it never waits for the next one
+        unsigned int jobsInFlight = 2;
+        // time the workers get to load a scene
+        int setupTimeoutMs = 120000;
+        // time a worker gets to say hello once connected
+        int helloTimeoutMs = 5000;
+
+        Coordinator() { signal(SIGPIPE, SIG_IGN); } // writing to a worker that died must fail, not kill us
+
+        ~Coordinator(){
+            for (Worker &worker : workers){
+                if (worker.alive) sendMessage(worker.fd, Quit);
+                close(worker.fd);
+            }
+            if (listenFd >= 0) close(listenFd);
+            for (pid_t child : children) waitpid(child, nullptr, 0);
+        }
+
+        Coordinator(Coordinator const&) = delete;
+        void operator=(Coordinator const&) = delete;
+
+        // listens on all interfaces, port 0 picks a free port
+        bool listen(uint16_t port){
+            listenFd = socket(AF_INET, SOCK_STREAM, 0);
+            if (listenFd < 0) return false;
+            int one = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_ANY);
+            address.sin_port = htons(port);
+            socklen_t length = sizeof(address);
+            if (bind(listenFd, (sockaddr *) &address, sizeof(address)) != 0 || ::listen(listenFd, 64) != 0 ||
+                getsockname(listenFd, (sockaddr *) &address, &length) != 0) return false;
+            listenPort = ntohs(address.sin_port);
+            return true;
+        }
+
+        uint16_t port() const { return listenPort; }
+
+        // starts count worker processes on this machine, running executable with extra arguments
+        bool spawn(unsigned int count, const std::string &executable, const std::vector<std::string> &arguments){
+            std::string address = "127.0.0.1:" + std::to_string(listenPort);
+            for (unsigned int i = 0; i < count; i++){
+                pid_t pid = fork();
+                if (pid < 0) return false;
+                if (pid == 0) {
+                    std::vector<std::string> args{executable, "--worker", address};
+                    args.insert(args.end(), arguments.begin(), arguments.end());
+                    std::vector<char *> argv;
+                    for (std::string &arg : args) argv.push_back(&arg[0]);
+                    argv.push_back(nullptr);
+                    execv(executable.c_str(), argv.data());
+                    _exit(127);
+                }
+                children.push_back(pid);
+            }
+            return true;
+        }
+
+        // waits until count workers connected and said hello, or timeoutMs passed. A peer that connects and doesn't
+        // say hello within helloTimeoutMs is dropped
+        bool acceptWorkers(unsigned int count, int timeoutMs){
+            auto start = std::chrono::steady_clock::now();
+            while (workers.size() < count){
+                int elapsed = (int) std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                pollfd listening{listenFd, POLLIN, 0};
+                if (elapsed >= timeoutMs || poll(&listening, 1, timeoutMs - elapsed) <= 0) return false;
+                int fd = accept(listenFd, nullptr, nullptr);
+                if (fd < 0) continue;
+                disableNagle(fd);
+                setReceiveTimeout(fd, std::max(1, std::min(helloTimeoutMs, timeoutMs - elapsed)));
+                MessageHeader header;
+                std::vector<char> payload;
+                HelloMessage hello;
+                if (!receiveMessage(fd, header, payload) || header.type != Hello || !readPayload(payload, hello) ||
+                    hello.version != protocolVersion) {
+                    close(fd);
+                    continue;
+                }
+                // the results of the jobs are waited for with poll, then read whole
+                setReceiveTimeout(fd, 0);
+                workers.push_back(Worker{fd, hello.threads, true, {}});
+            }
+            return true;
+        }
+
+        unsigned int workerCount() const { return (unsigned int) workers.size(); }
+        unsigned int aliveCount() const {
+            return (unsigned int) std::count_if(workers.begin(), workers.end(), [](const Worker &w){ return w.alive; });
+        }
+        unsigned int workerThreads(unsigned int i) const { return workers[i].threads; }
+
+        // sends the scene and camera of the next frame to all the workers and waits until they loaded it. Workers that
+        // can't load it, or don't answer within setupTimeoutMs, are dropped. setupMs gets the longest loading time
+        bool setup(FrameSpec frame, float &setupMs){
+            frame.frame = currentFrame = ++frameCounter;
+            spec = frame;
+            setupMs = 0;
+            for (Worker &worker : workers)
+                if (worker.alive && !sendMessage(worker.fd, Setup, &frame, sizeof(frame))) dropWorker(worker);
+
+            std::vector<bool> ready(workers.size(), false);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<pollfd> fds;
+            std::vector<unsigned int> fdWorker;
+            MessageHeader header;
+            std::vector<char> payload;
+            while (true){
+                fds.clear();
+                fdWorker.clear();
+                for (unsigned int i = 0; i < workers.size(); i++){
+                    if (!workers[i].alive || ready[i]) continue;
+                    fds.push_back(pollfd{workers[i].fd, POLLIN, 0});
+                    fdWorker.push_back(i);
+                }
+                if (fds.empty()) break;
+                int elapsed = (int) std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                if (elapsed >= setupTimeoutMs || poll(fds.data(), fds.size(), setupTimeoutMs - elapsed) == 0) {
+                    for (unsigned int i : fdWorker) dropWorker(workers[i]);
+                    break;
+                }
+                for (unsigned int f = 0; f < fds.size(); f++){
+                    if (!(fds[f].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                    Worker &worker = workers[fdWorker[f]];
+                    ReadyMessage message;
+                    if (!receiveMessage(worker.fd, header, payload)) dropWorker(worker);
+                    // results of jobs of the previous frames may come first, they are dropped
+                    else if (header.type == Result) forgetResult(worker, payload);
+                    else if (header.type != Ready || !readPayload(payload, message) || !message.ok) dropWorker(worker);
+                    else {
+                        ready[fdWorker[f]] = true;
+                        setupMs = std::max(setupMs, message.loadMs);
+                    }
+                }
+            }
+            return aliveCount() > 0;
+        }
+
+        // renders the frame of the last setup with the first workerLimit workers, in jobs of jobSize x jobSize pixels,
+        // into hdr (width x height of the frame). Returns false if every worker was lost
+        bool render(unsigned int jobSize, unsigned int workerLimit, FrameBuffer<rt::Colors::color> &hdr,
+                    FrameStats &stats){
+            stats = FrameStats();
+            unsigned int used = std::min(workerLimit, workerCount());
+            jobSize = std::min(jobSize, maxJobSize);
+            stats.jobsPerWorker.assign(used, 0);
+            auto start = std::chrono::steady_clock::now();
+
+            // the jobs, row by row
+            jobs.clear();
+            for (uint32_t y = 0; y < spec.height; y += jobSize)
+                for (uint32_t x = 0; x < spec.width; x += jobSize)
+                    jobs.push_back(JobState{JobMessage{currentFrame, (uint32_t) jobs.size(), x, y,
+                                                       std::min(x + jobSize, spec.width), std::min(y + jobSize, spec.height)},
+                                            false, 0, std::chrono::steady_clock::time_point()});
+            stats.jobs = (unsigned int) jobs.size();
+            pending.clear();
+            for (uint32_t i = 0; i < jobs.size(); i++) pending.push_back(i);
+            jobMs.clear();
+            unsigned int finished = 0;
+
+            for (unsigned int i = 0; i < used; i++) handOut(workers[i], stats);
+            std::vector<pollfd> fds;
+            std::vector<unsigned int> fdWorker;
+            MessageHeader header;
+            std::vector<char> payload;
+            while (finished < jobs.size()){
+                fds.clear();
+                fdWorker.clear();
+                for (unsigned int i = 0; i < used; i++){
+                    if (!workers[i].alive) continue;
+                    fds.push_back(pollfd{workers[i].fd, POLLIN, 0});
+                    fdWorker.push_back(i);
+                }
+                if (fds.empty()) return false;
+                // wakes up now and then to look for stragglers even if no result arrives
+                if (poll(fds.data(), fds.size(), 50) < 0 && errno != EINTR) return false;
+
+                for (unsigned int f = 0; f < fds.size(); f++){
+                    Worker &worker = workers[fdWorker[f]];
+                    if (!(fds[f].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                    if (!receiveMessage(worker.fd, header, payload) || header.type != Result) {
+                        stats.requeued += dropWorker(worker);
+                        continue;
+                    }
+                    ResultMessage result;
+                    if (!readPayload(payload, result)) {
+                        stats.requeued += dropWorker(worker);
+                        continue;
+                    }
+                    bool current = result.frame == currentFrame && result.id < jobs.size();
+                    unsigned int w = 0, h = 0;
+                    if (current) {
+                        const JobMessage &sent = jobs[result.id].job;
+                        w = sent.x1 - sent.x0;
+                        h = sent.y1 - sent.y0;
+                    }
+                    // checked while the job is still running on worker, so that dropWorker hands it out again
+                    if (current && payload.size() != sizeof(ResultMessage) + w * h * sizeof(rt::Colors::color)) {
+                        stats.requeued += dropWorker(worker);
+                        continue;
+                    }
+                    forgetResult(worker, payload);
+                    if (!current) continue;
+                    JobState &job = jobs[result.id];
+                    if (job.done) { stats.wasted++; continue; }
+                    const rt::Colors::color *colors = (const rt::Colors::color *) (payload.data() + sizeof(ResultMessage));
+                    for (unsigned int r = 0; r < h; r++)
+                        std::copy(colors + r * w, colors + (r + 1) * w, hdr.buffer + job.job.x0 + (job.job.y0 + r) * hdr.W);
+                    job.done = true;
+                    finished++;
+                    jobMs.push_back(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                                             job.sentAt).count());
+                    stats.jobsPerWorker[fdWorker[f]]++;
+                }
+                for (unsigned int i = 0; i < used; i++) if (workers[i].alive) handOut(workers[i], stats);
+            }
+            stats.ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return true;
+        }
+
+    private:
+        struct Worker {
+            int fd;
+            unsigned int threads;
+            bool alive = true;
+            // jobs sent and not answered yet, which may belong to earlier frames
+            std::vector<std::pair<uint32_t, uint32_t>> running; // frame, job id
+        };
+        struct JobState {
+            JobMessage job;
+            bool done = false;
+            unsigned int copies = 0; // workers it was sent to
+            std::chrono::steady_clock::time_point sentAt;
+        };
+
+        int listenFd = -1;
+        uint16_t listenPort = 0;
+        std::vector<Worker> workers;
+        std::vector<pid_t> children;
+        uint32_t frameCounter = 0, currentFrame = 0;
+        FrameSpec spec{};
+        std::vector<JobState> jobs;
+        std::deque<uint32_t> pending; // jobs no worker has
+        std::vector<float> jobMs;     // round trip of the finished jobs, for the straggler limit
+
+        // removes the job of a result from the running jobs of worker
+        bool forgetResult(Worker &worker, const std::vector<char> &payload){
+            ResultMessage message;
+            if (!readPayload(payload, message)) return false;
+            auto running = std::find(worker.running.begin(), worker.running.end(), std::make_pair(message.frame, message.id));
+            if (running != worker.running.end()) worker.running.erase(running);
+            return true;
+        }
+
+        // closes the connection, and hands out again the unfinished jobs of the current frame nobody else has.
+        // returns the number of those jobs
+        unsigned int dropWorker(Worker &worker){
+            worker.alive = false;
+            unsigned int lost = 0;
+            for (const std::pair<uint32_t, uint32_t> &running : worker.running){
+                if (running.first != currentFrame || running.second >= jobs.size()) continue;
+                JobState &job = jobs[running.second];
+                if (!job.done && --job.copies == 0) {
+                    pending.push_front(running.second);
+                    lost++;
+                }
+            }
+            worker.running.clear();
+            return lost;
+        }
+
+        // the oldest unfinished job running for longer than the straggler limit that worker doesn't have, or -1
+        int straggler(const Worker &worker) const {
+            if (jobMs.empty()) return -1;
+            std::vector<float> sorted(jobMs);
+            std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+            float limit = sorted[sorted.size() / 2] * stragglerFactor;
+            auto now = std::chrono::steady_clock::now();
+            int oldest = -1;
+            for (unsigned int i = 0; i < jobs.size(); i++){
+                const JobState &job = jobs[i];
+                if (job.done || job.copies != 1 ||
+                    std::chrono::duration<float, std::milli>(now - job.sentAt).count() < limit) continue;
+                if (std::find(worker.running.begin(), worker.running.end(), std::make_pair(currentFrame, i)) !=
+                    worker.running.end()) continue;
+                if (oldest < 0 || job.sentAt < jobs[oldest].sentAt) oldest = (int) i;
+            }
+            return oldest;
+        }
+
+        // sends jobs to worker until it has jobsInFlight of them: pending jobs first, then stragglers
+        void handOut(Worker &worker, FrameStats &stats){
+            while (worker.alive && worker.running.size() < jobsInFlight){
+                int next;
+                bool duplicate = pending.empty();
+                if (!duplicate) {
+                    next = (int) pending.front();
+                    pending.pop_front();
+                }
+                else if ((next = straggler(worker)) < 0) return;
+
+                JobState &job = jobs[next];
+                if (!sendMessage(worker.fd, Job, &job.job, sizeof(job.job))) {
+                    if (!duplicate) pending.push_front((uint32_t) next);
+                    stats.requeued += dropWorker(worker);
+                    return;
+                }
+                // a duplicate keeps the time of the first copy, it stays the oldest
+                if (job.copies++ == 0) job.sentAt = std::chrono::steady_clock::now();
+                else stats.duplicates++;
+                worker.running.push_back(std::make_pair(currentFrame, (uint32_t) next));
+            }
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_DISTRIBUTED_H
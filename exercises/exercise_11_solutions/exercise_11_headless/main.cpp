@@ -0,0 +1,1389 @@
+// offline (headless) renderer for the exercise_11 ray tracer: renders a scene to an image file without a window or an
+// OpenGL context, and reports where the time goes. With --bench it renders a fixed set of scenes so that performance
+// regressions show up as numbers.
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "rt_renderer.h"
+#include "scenes.h"
+#include "objloader_legacy.h"
+#ifdef RT_DISTRIBUTED
+#include <thread>
+#include "distributed.h"
+#endif
+
+struct Options {
+    std::string scene = "cube";
+    std::string output;
+    unsigned int width = 512, height = 512;
+    unsigned int depth = 2;
+    float fov = 70.0f;
+    unsigned int frames = 1;
+    unsigned int samples = 0;
+    unsigned int threads = 0;
+    unsigned int tileSize = 16;
+    rt::IntersectionKernel kernel = rt::IntersectionKernel::Auto;
+    rt::BVHFormat bvhFormat = rt::BVHFormat::Binary;
+    bool bvhCompare = false;
+    rt::TraceSettings trace;
+    bool traceCompare = false;
+    bool kernelCompare = false;
+    bool flattenCompare = false;
+    bool sortRays = false;
+    bool sortCompare = false;
+    bool bench = false;
+    bool wavefront = false;
+    bool incremental = false;
+    bool flatten = false;
+    bool animate = false;
+    bool deform = false;
+    float rebuildThreshold = 1.5f;
+    std::string stats;   // counters of every frame and tile, .csv or .json
+    std::string heatmap; // cost of each pixel of the last frame, .ppm
+    rt::ResolveSettings resolve; // 8 bit output (and the window), the .pfm output is always linear
+    rt::DenoiseSettings denoise;
+    unsigned int referenceSamples = 0; // samples per pixel of the reference the frames are compared to, 0 = none
+    // distributed rendering: this process is a worker of the coordinator at worker, or it coordinates spawn local
+    // workers and waits for workers others to connect on port
+    std::string worker;
+    unsigned int spawn = 0, workers = 0;
+    unsigned int port = 0;
+    unsigned int jobSize = 64;
+    bool scaling = false;
+    // out of core scenes: --convert writes --scene to a file in clusters of clusterKB, rendered with --scene mapped:FILE
+    std::string convert;
+    unsigned int clusterKB = 64;
+    unsigned int budgetMB = 0;
+    std::string objBench; // OBJ file loaded with the legacy and the current loadOBJ
+    bool customCamera = false, customTarget = false;
+    glm::vec3 cameraPos, cameraTarget;
+    glm::vec3 move = glm::vec3(0); // camera (and target) motion per frame
+};
+
+// time spent in each phase of one run, in milliseconds
+struct PhaseTimes {
+    float load = 0;
+    float build = 0;
+    float traceTotal = 0, traceMin = 0, traceMax = 0;
+    float write = 0;
+    float resolveTotal = 0; // included in the trace times
+    float denoiseTotal = 0; // same
+    // root mean square error of the last frame against the --reference frame, as traced and after denoising
+    double rmseTraced = -1, rmseDenoised = -1;
+    unsigned int passes = 0, converged = 0; // progressive rendering, last frame
+    unsigned int skipped = 0, reprojected = 0, full = 0; // incremental rendering, frames of each kind
+    unsigned long long tracedPixels = 0;
+    float topLevelTotal = 0; // instanced scenes with --animate, top level rebuilds
+    float refitTotal = 0, maxSahGrowth = 1; // --deform
+    unsigned int rebuilds = 0;
+    // time and counters of each frame, for --stats
+    std::vector<float> frameMs;
+    std::vector<rt::RayCounters> frameRays;
+    // memory mapped scenes: paging of the clusters after the last frame, and the page faults and disk reads of the
+    // frames (the peak resident set is the one of the whole run)
+    rt::MappedMeshStats paging;
+    rt::ProcessMemoryStats memory;
+};
+
+// everything --stats writes about one scene
+struct SceneStats {
+    std::string name;
+    size_t triangles;
+    PhaseTimes times;
+    std::vector<rt::TileStats> tiles; // of the last frame, empty for breadth first or reprojected frames
+};
+
+float millisecondsSince(std::chrono::high_resolution_clock::time_point start){
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    return elapsed.count();
+}
+
+void printUsage(){
+    std::cout << "usage: exercise_11_headless [options]" << std::endl
+              << "  --scene NAME       'cube' (the scene of exercise_11_sol) or the path of an OBJ file, default cube." << std::endl
+              << "                     'grid:NAME' places 800 instances of the cube or OBJ file NAME in the room" << std::endl
+              << "                     'mapped:FILE' renders a scene written with --convert from its memory mapped file" << std::endl
+              << "  --convert FILE     write --scene (flattened) to FILE for out of core rendering, and exit" << std::endl
+              << "  --obj-bench FILE   load FILE with the fscanf loadOBJ and with the memory mapped one on 1, 2, 4... up" << std::endl
+              << "                     to --threads threads, the fastest of --frames loads (at least 3) of each, compare" << std::endl
+              << "                     their speed and output, the same streamed and with its binary cache, and exit"
+              << std::endl
+              << "  --mesh-cache       keep a binary cache next to the OBJ files of the scenes, read instead of the file" << std::endl
+              << "                     on later runs (see meshcache.h)" << std::endl
+              << "  --cluster-kb N     with --convert, cut the bvh and its triangles in clusters of about N KB, default 64" << std::endl
+              << "  --budget-mb N      with a mapped scene, release the clusters reached the longest time ago between" << std::endl
+              << "                     frames to keep at most N MB of them loaded, default 0 (no limit)" << std::endl
+              << "  --flatten          bake the instances of a grid scene into one vertex list (same image up to floating" << std::endl
+              << "                     point rounding)" << std::endl
+              << "  --compare-flatten  renders --scene (or the instanced benchmark scenes with --bench) instanced and" << std::endl
+              << "                     flattened, at the depths 1 to --depth, and checks that the images only differ" << std::endl
+              << "                     by rounding: a few pixels may differ by more than 1e-3 where an edge is hit" << std::endl
+              << "  --animate          turn the instances of a grid scene every frame, rebuilding the top level bvh" << std::endl
+              << "  --deform           twist the object every frame, refitting the bvh instead of rebuilding it" << std::endl
+              << "  --rebuild-threshold G  with --deform, rebuild the bvh in the background once the SAH cost of the" << std::endl
+              << "                     refit tree grew by a factor G, 0 never rebuilds, default 1.5" << std::endl
+              << "  --bench            render the benchmark scenes instead of --scene (no image is written)" << std::endl
+              << "  --width W          image width, default 512" << std::endl
+              << "  --height H         image height, default 512" << std::endl
+              << "  --depth D          1 = no reflections, up to 5, default 2" << std::endl
+              << "  --fov DEGREES      vertical field of view, default 70" << std::endl
+              << "  --camera X,Y,Z     camera position, default 0.9,0,1.5" << std::endl
+              << "  --target X,Y,Z     point the camera looks at, default 0.9,0,0.5" << std::endl
+              << "  --frames N         number of timed frames, default 1" << std::endl
+              << "  --samples N        progressive rendering, up to N jittered samples per pixel (fewer where the" << std::endl
+              << "                     pixel converges), default 0 renders one sample through each pixel corner" << std::endl
+              << "  --threads N        0 = one per core (default)" << std::endl
+              << "  --tile N           tile size in pixels, default 16" << std::endl
+              << "  --wavefront        trace breadth first (renderWavefront), same image as the default recursive path" << std::endl
+              << "  --sort-rays        with --wavefront, sort the reflection rays of each bounce by direction octant and" << std::endl
+              << "                     origin Morton code before tracing them (same image)" << std::endl
+              << "  --compare-sort     renders --scene (or the benchmark scenes with --bench) with --wavefront, without" << std::endl
+              << "                     and with --sort-rays, and compares the coherence of the secondary rays and the speed" << std::endl
+              << "  --incremental      renderIncremental: skip unchanged frames, reproject the previous one on motion" << std::endl
+              << "  --move X,Y,Z       move the camera and its target by X,Y,Z every frame, default 0,0,0" << std::endl
+              << "  --kernel K         scalar, sse, avx2 or auto (default)" << std::endl
+              << "  --compare-kernels  renders --scene (or the benchmark scenes with --bench) with the scalar kernel and" << std::endl
+              << "                     each SIMD kernel the cpu supports, at the depths 1 to --depth, and compares the" << std::endl
+              << "                     images pixel for pixel and their speed" << std::endl
+              << "  --bvh F            binary (default) or wide (4 children per node, quantized bounds). 'compare'" << std::endl
+              << "                     renders --scene (or the benchmark scenes with --bench, flattened) with both, and" << std::endl
+              << "                     compares their node memory and speed" << std::endl
+              << "  --shading S        phong (default), diffuse (no highlights) or flat (surface color, no light)" << std::endl
+              << "  --shadows on|off   trace shadow rays, default on" << std::endl
+              << "  --generic          trace with the generic traceRay instead of the kernel specialized for --depth," << std::endl
+              << "                     --shadows and --shading (same image)" << std::endl
+              << "  --compare-trace    renders --scene (or the benchmark scenes with --bench) with the generic and the" << std::endl
+              << "                     specialized kernels of the depths 1 to --depth and a few settings, and compares" << std::endl
+              << "                     their speed" << std::endl
+              << "  --spawn N          render --scene with N worker processes started on this machine" << std::endl
+              << "  --workers N        render --scene with N workers started elsewhere with --worker HOST:PORT" << std::endl
+              << "  --port P           port the workers connect to, default 0 (any free port, fine with --spawn only)" << std::endl
+              << "  --worker HOST:PORT run as a worker of the coordinator at HOST:PORT (--threads, --tile and --kernel apply)" << std::endl
+              << "  --job-size N       the workers trace jobs of N x N pixels, default 64, at most 1024" << std::endl
+              << "  --scaling          render with 1, 2, ... up to all the workers, and report the scaling efficiency" << std::endl
+              << "  --output FILE      write the last frame to FILE, .ppm (8 bits) or .pfm (linear float colors)" << std::endl
+              << "  --exposure X       scale the colors by X before tone mapping, default 1" << std::endl
+              << "  --tonemap T        clamp (default), reinhard or aces, tone mapping of the 8 bit colors" << std::endl
+              << "  --srgb             encode the 8 bit colors with the sRGB curve" << std::endl
+              << "  --denoise N        denoise the frames with N passes of the a-trous filter (3 is a good start), default 0 (off)" << std::endl
+              << "  --reference N      render the last frame again with N samples per pixel (without denoising), and" << std::endl
+              << "                     report the error of the traced and the denoised frame against it" << std::endl
+              << "  --stats FILE       write the time and counters (rays, hits, bvh nodes, triangle tests) of every" << std::endl
+              << "                     frame, and of the tiles of the last frame, to FILE, .csv or .json" << std::endl
+              << "  --heatmap FILE     write the cost (bvh nodes + triangle tests) of each pixel of the last frame to" << std::endl
+              << "                     FILE (.ppm), on a log scale from black (cheapest) to white (most expensive)" << std::endl;
+}
+
+bool parseVec3(const char *text, glm::vec3 &v){
+    return sscanf(text, "%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+}
+
+bool parseOptions(int argc, char **argv, Options &options){
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bench") options.bench = true;
+        else if (arg == "--wavefront") options.wavefront = true;
+        else if (arg == "--incremental") options.incremental = true;
+        else if (arg == "--flatten") options.flatten = true;
+        else if (arg == "--animate") options.animate = true;
+        else if (arg == "--deform") options.deform = true;
+        else if (arg == "--scaling") options.scaling = true;
+        else if (arg == "--srgb") options.resolve.srgb = true;
+        else if (arg == "--mesh-cache") meshcache::enabled() = true;
+        else if (arg == "--generic") options.trace.specialized = false;
+        else if (arg == "--compare-trace") options.traceCompare = true;
+        else if (arg == "--compare-kernels") options.kernelCompare = true;
+        else if (arg == "--compare-flatten") options.flattenCompare = true;
+        else if (arg == "--sort-rays") options.sortRays = true;
+        else if (arg == "--compare-sort") options.sortCompare = true;
+        else if (arg == "--help" || arg == "-h") return false;
+        else if (!hasValue) { std::cerr << "missing value for " << arg << std::endl; return false; }
+        else if (arg == "--scene") options.scene = argv[++i];
+        else if (arg == "--output") options.output = argv[++i];
+        else if (arg == "--stats") options.stats = argv[++i];
+        else if (arg == "--heatmap") options.heatmap = argv[++i];
+        else if (arg == "--width") options.width = std::max(1, atoi(argv[++i]));
+        else if (arg == "--height") options.height = std::max(1, atoi(argv[++i]));
+        else if (arg == "--depth") options.depth = std::max(1, atoi(argv[++i]));
+        else if (arg == "--fov") options.fov = (float) atof(argv[++i]);
+        else if (arg == "--frames") options.frames = std::max(1, atoi(argv[++i]));
+        else if (arg == "--samples") options.samples = std::max(0, atoi(argv[++i]));
+        else if (arg == "--threads") options.threads = std::max(0, atoi(argv[++i]));
+        else if (arg == "--denoise") {
+            options.denoise.iterations = std::max(0, atoi(argv[++i]));
+            options.denoise.enabled = options.denoise.iterations > 0;
+        }
+        else if (arg == "--convert") options.convert = argv[++i];
+        else if (arg == "--obj-bench") options.objBench = argv[++i];
+        else if (arg == "--cluster-kb") options.clusterKB = std::max(1, atoi(argv[++i]));
+        else if (arg == "--budget-mb") options.budgetMB = std::max(0, atoi(argv[++i]));
+        else if (arg == "--worker") options.worker = argv[++i];
+        else if (arg == "--spawn") options.spawn = std::max(0, atoi(argv[++i]));
+        else if (arg == "--workers") options.workers = std::max(0, atoi(argv[++i]));
+        else if (arg == "--port") options.port = std::min(65535, std::max(0, atoi(argv[++i])));
+        else if (arg == "--job-size") options.jobSize = std::max(1, atoi(argv[++i]));
+        else if (arg == "--reference") options.referenceSamples = std::max(0, atoi(argv[++i]));
+        else if (arg == "--exposure") options.resolve.exposure = std::max(0.0f, (float) atof(argv[++i]));
+        else if (arg == "--tonemap") {
+            std::string t = argv[++i];
+            if (t == "clamp") options.resolve.tone_mapping = rt::ToneMapping::Clamp;
+            else if (t == "reinhard") options.resolve.tone_mapping = rt::ToneMapping::Reinhard;
+            else if (t == "aces") options.resolve.tone_mapping = rt::ToneMapping::ACES;
+            else { std::cerr << "unknown tone mapping " << t << std::endl; return false; }
+        }
+        else if (arg == "--rebuild-threshold") options.rebuildThreshold = std::max(0.0f, (float) atof(argv[++i]));
+        else if (arg == "--tile") options.tileSize = std::max(1, atoi(argv[++i]));
+        else if (arg == "--camera") { if (!parseVec3(argv[++i], options.cameraPos)) return false; options.customCamera = true; }
+        else if (arg == "--target") { if (!parseVec3(argv[++i], options.cameraTarget)) return false; options.customTarget = true; }
+        else if (arg == "--move") { if (!parseVec3(argv[++i], options.move)) return false; }
+        else if (arg == "--bvh") {
+            std::string f = argv[++i];
+            if (f == "binary") options.bvhFormat = rt::BVHFormat::Binary;
+            else if (f == "wide") options.bvhFormat = rt::BVHFormat::Wide;
+            else if (f == "compare") options.bvhCompare = true;
+            else { std::cerr << "unknown bvh format " << f << std::endl; return false; }
+        }
+        else if (arg == "--shading") {
+            std::string m = argv[++i];
+            if (m == "phong") options.trace.shading = rt::ShadingModel::Phong;
+            else if (m == "diffuse") options.trace.shading = rt::ShadingModel::Diffuse;
+            else if (m == "flat") options.trace.shading = rt::ShadingModel::Flat;
+            else { std::cerr << "unknown shading model " << m << std::endl; return false; }
+        }
+        else if (arg == "--shadows") options.trace.shadows = std::string(argv[++i]) != "off";
+        else if (arg == "--kernel") {
+            std::string k = argv[++i];
+            if (k == "scalar") options.kernel = rt::IntersectionKernel::Scalar;
+            else if (k == "sse") options.kernel = rt::IntersectionKernel::SSE;
+            else if (k == "avx2") options.kernel = rt::IntersectionKernel::AVX2;
+            else if (k == "auto") options.kernel = rt::IntersectionKernel::Auto;
+            else { std::cerr << "unknown kernel " << k << std::endl; return false; }
+        }
+        else { std::cerr << "unknown option " << arg << std::endl; return false; }
+    }
+    return true;
+}
+
+bool endsWith(const std::string &text, const std::string &suffix){
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// binary PPM, 8 bits per channel, top row first
+bool writePPM(const std::string &path, FrameBuffer<uint32_t> &fb){
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    file << "P6\n" << fb.W << " " << fb.H << "\n255\n";
+    std::vector<unsigned char> row(fb.W * 3);
+    for (int y = fb.H - 1; y >= 0; y--){
+        for (unsigned int x = 0; x < fb.W; x++){
+            uint32_t c = fb.valueAt(x, y);
+            row[x * 3] = c & 0xff;
+            row[x * 3 + 1] = (c >> 8) & 0xff;
+            row[x * 3 + 2] = (c >> 16) & 0xff;
+        }
+        file.write((const char *) row.data(), row.size());
+    }
+    return (bool) file;
+}
+
+// PFM, 32 bits float per channel, bottom row first (as our frame buffer), little endian.
+// the linear colors of the tracer, before exposure and tone mapping, so values can be above 1
+bool writePFM(const std::string &path, const FrameBuffer<rt::Colors::color> &hdr){
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    file << "PF\n" << hdr.W << " " << hdr.H << "\n-1.0\n";
+    std::vector<float> row(hdr.W * 3);
+    for (unsigned int y = 0; y < hdr.H; y++){
+        for (unsigned int x = 0; x < hdr.W; x++){
+            const rt::Colors::color &c = hdr.buffer[x + y * hdr.W];
+            row[x * 3] = c.r;
+            row[x * 3 + 1] = c.g;
+            row[x * 3 + 2] = c.b;
+        }
+        file.write((const char *) row.data(), row.size() * sizeof(float));
+    }
+    return (bool) file;
+}
+
+// binary PPM of the cost of each pixel, on a log scale from the cheapest pixel (black) through blue, red and yellow to
+// the most expensive one (white). Pixels that were not traced are black too
+bool writeHeatmap(const std::string &path, const std::vector<uint32_t> &cost, unsigned int W, unsigned int H){
+    std::ofstream file(path, std::ios::binary);
+    if (!file || cost.size() != W * H) return false;
+    uint32_t minCost = UINT32_MAX, maxCost = 1;
+    for (uint32_t c : cost){
+        if (c > 0) minCost = std::min(minCost, c);
+        maxCost = std::max(maxCost, c);
+    }
+    float range = std::log(float(maxCost) / std::min(minCost, maxCost)) + 1e-6f;
+    const glm::vec3 ramp[] = {glm::vec3(0), glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(1, 1, 0), glm::vec3(1)};
+    file << "P6\n" << W << " " << H << "\n255\n";
+    std::vector<unsigned char> row(W * 3);
+    for (int y = H - 1; y >= 0; y--){
+        for (unsigned int x = 0; x < W; x++){
+            uint32_t c0 = cost[x + y * W];
+            float t = c0 > 0 ? std::log(float(c0) / minCost) / range * 4.0f : 0.0f;
+            unsigned int i = std::min(3u, (unsigned int) t);
+            glm::vec3 c = glm::mix(ramp[i], ramp[i + 1], std::min(t - i, 1.0f));
+            for (int k = 0; k < 3; k++) row[x * 3 + k] = (unsigned char) (255 * glm::clamp(c[k], 0.0f, 1.0f));
+        }
+        file.write((const char *) row.data(), row.size());
+    }
+    return (bool) file;
+}
+
+std::string jsonString(const std::string &text){
+    std::string quoted = "\"";
+    for (char c : text){
+        if (c == '"' || c == '\\') quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+void writeCountersJSON(std::ostream &out, const rt::RayCounters &rays){
+    out << "\"primary\": " << rays.primary << ", \"shadow\": " << rays.shadow << ", \"secondary\": " << rays.secondary
+        << ", \"hits\": " << rays.hits << ", \"occluded\": " << rays.occluded
+        << ", \"nodes_visited\": " << rays.nodes_visited << ", \"triangle_tests\": " << rays.triangle_tests
+        << ", \"hit_rate\": " << rays.hitRate();
+}
+
+void writeCountersCSV(std::ostream &out, const rt::RayCounters &rays){
+    out << rays.primary << "," << rays.shadow << "," << rays.secondary << "," << rays.hits << "," << rays.occluded
+        << "," << rays.nodes_visited << "," << rays.triangle_tests << "," << rays.hitRate();
+}
+
+// the phases, frames and tiles of each scene. JSON has one object per scene; CSV has one row per phase, frame and
+// tile, with the kind of row in the second column and empty cells where a column doesn't apply
+bool writeStats(const std::string &path, const Options &options, const std::vector<SceneStats> &scenes){
+    std::ofstream file(path);
+    if (!file) return false;
+    if (endsWith(path, ".json")) {
+        file << "{\"width\": " << options.width << ", \"height\": " << options.height << ", \"depth\": " << options.depth
+             << ", \"scenes\": [";
+        for (size_t s = 0; s < scenes.size(); s++){
+            const SceneStats &scene = scenes[s];
+            const PhaseTimes &times = scene.times;
+            file << (s ? "," : "") << "\n  {\"name\": " << jsonString(scene.name) << ", \"triangles\": " << scene.triangles
+                 << ",\n   \"phases\": {\"load\": " << times.load << ", \"build\": " << times.build
+                 << ", \"trace\": " << times.traceTotal << ", \"write\": " << times.write << "},\n   \"frames\": [";
+            for (size_t f = 0; f < times.frameMs.size(); f++){
+                file << (f ? "," : "") << "\n    {\"ms\": " << times.frameMs[f] << ", ";
+                writeCountersJSON(file, times.frameRays[f]);
+                file << "}";
+            }
+            file << "],\n   \"tiles\": [";
+            for (size_t t = 0; t < scene.tiles.size(); t++){
+                const rt::TileStats &tile = scene.tiles[t];
+                file << (t ? "," : "") << "\n    {\"x\": " << tile.x << ", \"y\": " << tile.y << ", \"w\": " << tile.w
+                     << ", \"h\": " << tile.h << ", \"worker\": " << tile.worker << ", \"ms\": " << tile.ms << ", ";
+                writeCountersJSON(file, tile.rays);
+                file << "}";
+            }
+            file << "]}";
+        }
+        file << "\n]}\n";
+        return (bool) file;
+    }
+
+    file << "scene,kind,index,x,y,w,h,worker,ms,primary,shadow,secondary,hits,occluded,nodes_visited,triangle_tests,"
+            "hit_rate\n";
+    for (const SceneStats &scene : scenes){
+        const PhaseTimes &times = scene.times;
+        std::string name = "\"" + scene.name + "\"";
+        const char *phases[] = {"load", "build", "trace", "write"};
+        float phaseMs[] = {times.load, times.build, times.traceTotal, times.write};
+        for (int p = 0; p < 4; p++)
+            file << name << ",phase," << phases[p] << ",,,,,," << phaseMs[p] << ",,,,,,,,\n";
+        for (size_t f = 0; f < times.frameMs.size(); f++){
+            file << name << ",frame," << f << ",,,,,," << times.frameMs[f] << ",";
+            writeCountersCSV(file, times.frameRays[f]);
+            file << "\n";
+        }
+        for (size_t t = 0; t < scene.tiles.size(); t++){
+            const rt::TileStats &tile = scene.tiles[t];
+            file << name << ",tile," << t << "," << tile.x << "," << tile.y << "," << tile.w << "," << tile.h << ","
+                 << tile.worker << "," << tile.ms << ",";
+            writeCountersCSV(file, tile.rays);
+            file << "\n";
+        }
+    }
+    return (bool) file;
+}
+
+// root mean square error of the rgb colors of frame against the averages of reference
+double rootMeanSquareError(const FrameBuffer<rt::Colors::color> &frame, const rt::AccumulationBuffer &reference){
+    double sum = 0;
+    for (unsigned int y = 0; y < frame.H; y++){
+        for (unsigned int x = 0; x < frame.W; x++){
+            glm::vec3 d = glm::vec3(frame.buffer[x + y * frame.W]) - glm::vec3(reference.average(x, y));
+            sum += glm::dot(d, d);
+        }
+    }
+    return std::sqrt(sum / (3.0 * frame.W * frame.H));
+}
+
+// renders the last frame (seen from view) again with --reference samples per pixel and no denoising, and measures the
+// error of the traced and of the denoised last frame against it
+void measureQuality(const Options &options, const Scene &scene, rt::Renderer &renderer, const glm::mat4 &view,
+                    PhaseTimes &times){
+    const FrameBuffer<rt::Colors::color> &traced = *renderer.tracedFrame(), &last = *renderer.hdrFrame();
+    FrameBuffer<rt::Colors::color> tracedCopy(traced.W, traced.H), lastCopy(last.W, last.H);
+    std::copy(traced.buffer, traced.buffer + traced.W * traced.H, tracedCopy.buffer);
+    std::copy(last.buffer, last.buffer + last.W * last.H, lastCopy.buffer);
+    bool denoised = &traced != &last;
+
+    // every pixel gets all the samples, the reference has no adaptive sampling
+    rt::AccumulationBuffer reference(traced.W, traced.H);
+    reference.min_samples = reference.max_samples = options.referenceSamples;
+    FrameBuffer<uint32_t> fb(traced.W, traced.H);
+    renderer.setDenoiseSettings(rt::DenoiseSettings());
+    renderer.setInstances(scene.instances.get());
+    renderer.setMappedMesh(scene.mapped.get());
+    while (!reference.allConverged())
+        renderer.renderProgressive(scene.vts, glm::mat4(1), view, options.fov, options.depth, reference, fb);
+    renderer.setInstances(nullptr);
+    renderer.setMappedMesh(nullptr);
+    renderer.setDenoiseSettings(options.denoise);
+
+    times.rmseTraced = rootMeanSquareError(tracedCopy, reference);
+    if (denoised) times.rmseDenoised = rootMeanSquareError(lastCopy, reference);
+}
+
+// loads and renders one scene, returns false if the scene can't be loaded or the image can't be written
+bool run(const Options &options, const std::string &sceneName, rt::Renderer &renderer,
+         PhaseTimes &times, rt::RayCounters &rays, Scene &scene){
+    auto start = std::chrono::high_resolution_clock::now();
+    // the bottom level bvhs of instanced scenes are built with the meshes, and counted in the load time
+    if (!makeScene(sceneName, scene)) {
+        std::cerr << "can't load scene " << sceneName << std::endl;
+        return false;
+    }
+    if (options.flatten) flattenScene(scene);
+    times.load = millisecondsSince(start);
+
+    renderer.setInstances(scene.instances.get());
+    renderer.setMappedMesh(scene.mapped.get());
+    if (scene.instances) times.build = scene.instances->topLevel().buildReport().build_ms;
+    else if (scene.mapped) scene.mapped->setResidentBudget(uint64_t(options.budgetMB) * 1024 * 1024);
+    else {
+        renderer.setBVHFormat(options.bvhFormat);
+        renderer.buildAccelerationStructure(scene.vts);
+        times.build = renderer.accelerationStructureReport().build_ms;
+    }
+
+    renderer.setTraceSettings(options.trace);
+    renderer.setSecondaryRaySorting(options.sortRays);
+    renderer.setRayCoherenceMeasurement(options.sortRays || options.sortCompare);
+    renderer.setRebuildThreshold(options.rebuildThreshold);
+    renderer.setPixelCostRecording(!options.heatmap.empty());
+    renderer.setResolveSettings(options.resolve);
+    renderer.setDenoiseSettings(options.denoise);
+    const std::vector<rt::vertex> rest = options.deform ? scene.vts : std::vector<rt::vertex>();
+
+    glm::vec3 cameraPos = options.customCamera ? options.cameraPos : scene.cameraPos;
+    glm::vec3 cameraTarget = options.customTarget ? options.cameraTarget : scene.cameraTarget;
+
+    FrameBuffer<uint32_t> fb(options.width, options.height);
+    rt::AccumulationBuffer accumulation(options.width, options.height);
+    accumulation.max_samples = std::max(options.samples, 1u);
+    rays = rt::RayCounters();
+    fb.clearBuffer(rt::Colors::toRGBA32(rt::Colors::black));
+    glm::mat4 view;
+    rt::ProcessMemoryStats memoryBefore = rt::MappedMesh::processStats();
+    for (unsigned int frame = 0; frame < options.frames; frame++){
+        if (scene.mapped && frame > 0) scene.mapped->nextFrame();
+        glm::vec3 offset = options.move * float(frame);
+        view = glm::lookAt(cameraPos + offset, cameraTarget + offset, glm::vec3(0, 1, 0));
+        if (options.animate && scene.instances && frame > 0) {
+            // moving instances only changes the top level, the meshes and their bvhs stay as they are
+            for (unsigned int i = 1; i < scene.instances->size(); i++)
+                scene.instances->setTransform(i, scene.instances->instance(i).transform *
+                                                 glm::rotate(glm::radians(5.0f), glm::vec3(0, 1, 0)));
+            scene.instances->build();
+            times.topLevelTotal += scene.instances->topLevel().buildReport().build_ms;
+        }
+        if (options.deform && !scene.instances && frame > 0) {
+            deformScene(scene, rest, frame * .1f);
+            renderer.refitAccelerationStructure(scene.vts);
+            const rt::RefitStats &refit = renderer.refitStats();
+            times.refitTotal += refit.refit_ms;
+            times.maxSahGrowth = std::max(times.maxSahGrowth, refit.sah_growth);
+            times.rebuilds = refit.rebuilds;
+        }
+        float ms = 0;
+        rt::RayCounters frameRays;
+        if (options.incremental) {
+            // the frame buffer must keep the previous frame
+            rt::FrameUpdate update = renderer.renderIncremental(scene.vts, glm::mat4(1), view, options.fov, options.depth, fb);
+            ms = renderer.lastTraceTime();
+            times.skipped += update == rt::FrameUpdate::Skipped;
+            times.reprojected += update == rt::FrameUpdate::Reprojected;
+            times.full += update == rt::FrameUpdate::Full;
+            times.tracedPixels += renderer.incrementalStats().traced;
+            frameRays = renderer.frameRays();
+        }
+        else if (options.samples == 0) {
+            fb.clearBuffer(rt::Colors::toRGBA32(rt::Colors::black));
+            if (options.wavefront) renderer.renderWavefront(scene.vts, glm::mat4(1), view, options.fov, options.depth, fb);
+            else renderer.render(scene.vts, glm::mat4(1), view, options.fov, options.depth, fb);
+            ms = renderer.lastTraceTime();
+            frameRays = renderer.frameRays();
+        }
+        else {
+            // a frame is a whole progressive accumulation, from the first pass until every pixel converged
+            accumulation.reset();
+            while (!accumulation.allConverged()){
+                renderer.renderProgressive(scene.vts, glm::mat4(1), view, options.fov, options.depth, accumulation, fb);
+                ms += renderer.lastTraceTime();
+                times.resolveTotal += renderer.lastResolveTime();
+                times.denoiseTotal += renderer.lastDenoiseTime();
+                frameRays += renderer.frameRays();
+            }
+            times.passes = accumulation.passes();
+            times.converged = accumulation.convergedCount();
+        }
+        times.traceTotal += ms;
+        if (options.incremental || options.samples == 0) {
+            times.resolveTotal += renderer.lastResolveTime();
+            times.denoiseTotal += renderer.lastDenoiseTime();
+        }
+        times.traceMin = frame == 0 ? ms : std::min(times.traceMin, ms);
+        times.traceMax = std::max(times.traceMax, ms);
+        times.frameMs.push_back(ms);
+        times.frameRays.push_back(frameRays);
+        rays += frameRays;
+    }
+    if (scene.mapped) {
+        times.paging = scene.mapped->stats();
+        times.memory = rt::MappedMesh::processStats();
+        times.memory.minor_faults -= memoryBefore.minor_faults;
+        times.memory.major_faults -= memoryBefore.major_faults;
+        times.memory.read_bytes -= memoryBefore.read_bytes;
+    }
+
+    renderer.setInstances(nullptr);
+    renderer.setMappedMesh(nullptr);
+    if (!options.output.empty()){
+        start = std::chrono::high_resolution_clock::now();
+        bool written = endsWith(options.output, ".pfm") ? renderer.hdrFrame() && writePFM(options.output, *renderer.hdrFrame())
+                                                        : writePPM(options.output, fb);
+        times.write = millisecondsSince(start);
+        if (!written) {
+            std::cerr << "can't write " << options.output << std::endl;
+            return false;
+        }
+    }
+    // the cost of the last pass, for progressive rendering
+    if (!options.heatmap.empty() && !writeHeatmap(options.heatmap, renderer.pixelCost(), fb.W, fb.H)) {
+        std::cerr << "can't write " << options.heatmap << std::endl;
+        return false;
+    }
+    if (options.referenceSamples > 0) measureQuality(options, scene, renderer, view, times);
+    return true;
+}
+
+// triangles in the scene, counting every instance
+size_t triangleCount(const Scene &scene){
+    if (scene.mapped) return scene.mapped->triangleCount();
+    return scene.instances ? scene.instances->triangleCount() : scene.vts.size() / 3;
+}
+
+// memory used by the geometry and the acceleration structures of the scene
+size_t sceneBytes(const Scene &scene, const rt::Renderer &renderer){
+    if (scene.instances) return scene.instances->bytes();
+    if (scene.mapped) return scene.mapped->fileBytes();
+    return scene.vts.size() * sizeof(rt::vertex) + renderer.accelerationStructureBytes() + renderer.triangleStoreBytes();
+}
+
+void printReport(const Options &options, const Scene &scene, const rt::Renderer &renderer,
+                 const PhaseTimes &times, const rt::RayCounters &rays){
+    // the top level of instanced scenes
+    const rt::BVHBuildReport &bvh = scene.instances ? scene.instances->topLevel().buildReport()
+                                                    : renderer.accelerationStructureReport();
+    float traceAverage = times.traceTotal / options.frames;
+    double raysPerSecond = rays.total() / (times.traceTotal / 1000.0);
+
+    std::cout << "scene:          " << scene.name << " (" << triangleCount(scene) << " triangles)" << std::endl
+              << "image:          " << options.width << "x" << options.height << ", depth " << options.depth
+              << ", " << options.frames << " frame(s)" << std::endl
+              << "load:           " << times.load << " ms" << std::endl;
+    const double MB = 1024.0 * 1024.0;
+    if (scene.mapped) {
+        const rt::MappedMeshStats &paging = times.paging;
+        std::cout << "mapped file:    " << scene.mapped->fileBytes() / MB << " MB, " << scene.mapped->clusterCount()
+                  << " clusters of " << scene.mapped->clusterBytes() / 1024 << " KB" << std::endl
+                  << "clusters:       " << paging.clusters_touched << " reached in the last frame, " << paging.clusters_loaded
+                  << " loaded (" << paging.loaded_bytes / MB << " MB with their vertices), " << paging.prefetches
+                  << " prefetches, " << paging.releases << " releases" << std::endl
+                  << "paging:         " << times.memory.minor_faults << " minor and " << times.memory.major_faults
+                  << " major page faults, " << times.memory.read_bytes / MB << " MB read from disk while tracing"
+                  << std::endl
+                  << "resident:       peak " << times.memory.peak_resident_bytes / MB << " MB (process), "
+                  << paging.cached_bytes / MB << " MB of the file in the page cache" << std::endl;
+    }
+    else {
+        std::cout << "bvh build:      " << times.build << " ms (" << bvh.nodes << " nodes, depth " << bvh.max_depth
+                  << ", SAH cost " << bvh.sah_cost << ")" << (scene.instances ? " top level" : "") << std::endl;
+        if (!scene.instances)
+            std::cout << "bvh nodes:      " << renderer.bvhNodeCount() << " "
+                      << (renderer.bvhFormat() == rt::BVHFormat::Wide ? "wide" : "binary") << " nodes, "
+                      << renderer.bvhNodeBytes() / 1024.0 << " KB" << std::endl;
+        std::cout << "memory:         " << sceneBytes(scene, renderer) / MB
+                  << " MB (vertices and acceleration structures)" << std::endl;
+    }
+    if (scene.instances) {
+        std::cout << "instances:      " << scene.instances->size();
+        if (options.animate && options.frames > 1)
+            std::cout << ", top level rebuild " << times.topLevelTotal / (options.frames - 1) << " ms per frame";
+        std::cout << std::endl;
+    }
+    std::cout
+              << "trace:          " << traceAverage << " ms per frame (min " << times.traceMin << ", max "
+              << times.traceMax << ")" << std::endl
+              << "resolve:        " << times.resolveTotal / options.frames << " ms per frame (included in trace)" << std::endl;
+    if (options.denoise.enabled)
+        std::cout << "denoise:        " << times.denoiseTotal / options.frames << " ms per frame (included in trace, "
+                  << options.denoise.iterations << " passes)" << std::endl;
+    if (times.rmseTraced >= 0) {
+        std::cout << "quality:        RMSE against " << options.referenceSamples << " samples per pixel "
+                  << times.rmseTraced << " traced";
+        if (times.rmseDenoised >= 0) std::cout << ", " << times.rmseDenoised << " denoised";
+        std::cout << std::endl;
+    }
+    if (options.deform && !scene.instances && options.frames > 1)
+        std::cout << "refit:          " << times.refitTotal / (options.frames - 1) << " ms per frame, SAH cost up to "
+                  << times.maxSahGrowth << "x the built tree, " << times.rebuilds << " background rebuild(s)"
+                  << std::endl;
+    if (options.wavefront && options.samples == 0){
+        const rt::WavefrontTimes &stages = renderer.wavefrontTimes();
+        std::cout << "wavefront:      generate " << stages.generate << ", extend " << stages.extend << ", shade "
+                  << stages.shade << ", shadow " << stages.shadow << ", resolve " << stages.resolve
+                  << " ms (last frame)" << std::endl;
+        const rt::SecondaryRayStats &secondary = renderer.secondaryRayStats();
+        if (secondary.traced.pairs > 0)
+            std::cout << "secondary rays: extend " << stages.extend_secondary << " ms, sort " << stages.sort << " ms, "
+                      << 100 * secondary.traced.sameOctant() << "% same octant, cosine "
+                      << secondary.traced.meanCosine() << ", origin distance " << secondary.traced.meanDistance()
+                      << " between consecutive rays" << (options.sortRays ? " (sorted)" : "") << std::endl;
+    }
+    if (options.incremental)
+        std::cout << "incremental:    " << times.full << " full, " << times.reprojected << " reprojected, "
+                  << times.skipped << " skipped frame(s), "
+                  << 100.0 * times.tracedPixels / (double(options.width) * options.height * options.frames)
+                  << "% of the pixels traced" << std::endl;
+    else if (options.samples > 0)
+        std::cout << "progressive:    " << times.passes << " passes, "
+                  << float(rays.primary) / options.frames / (options.width * options.height)
+                  << " samples per pixel on average (max " << options.samples << ")" << std::endl;
+    if (!options.output.empty())
+        std::cout << "write:          " << times.write << " ms (" << options.output << ")" << std::endl;
+    std::cout << "rays per frame: " << rays.total() / options.frames << " (primary " << rays.primary / options.frames
+              << ", shadow " << rays.shadow / options.frames << ", secondary " << rays.secondary / options.frames
+              << ")" << std::endl
+              << "rays/second:    " << raysPerSecond / 1e6 << " M" << std::endl
+              << "work per ray:   " << double(rays.nodes_visited) / std::max<uint64_t>(rays.total(), 1) << " bvh nodes, "
+              << double(rays.triangle_tests) / std::max<uint64_t>(rays.total(), 1) << " triangle tests, hit rate "
+              << 100.0 * rays.hitRate() << "%, " << 100.0 * rays.occluded / std::max<uint64_t>(rays.shadow, 1)
+              << "% of the shadow rays occluded" << std::endl;
+}
+
+// loads --obj-bench with the legacy loadOBJ, and with the current one on 1, 2, 4... threads up to --threads (one per
+// core by default), and compares their throughput and output, then with the indexed loadOBJ, and compares the memory,
+// streams it in batches, and last loads it from the binary cache, which it writes and removes. The file is in the page
+// cache after the first load, so this measures the parsing and not the disk
+int benchmarkOBJ(const Options &options){
+    FILE *file = fopen(options.objBench.c_str(), "rb");
+    if (file == NULL) {
+        std::cerr << "can't open " << options.objBench << std::endl;
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    double megabytes = ftell(file) / (1024.0 * 1024.0);
+    fclose(file);
+
+    unsigned int maxThreads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    // 0 threads is the legacy loader
+    std::vector<unsigned int> threadCounts{0};
+    for (unsigned int t = 1; t < maxThreads * 2; t *= 2) threadCounts.push_back(std::min(t, maxThreads));
+
+    // the parser is measured without the binary cache, which has its own lines below
+    meshcache::enabled() = false;
+    std::vector<glm::vec3> legacyPoints, legacyNormals;
+    std::vector<glm::vec2> legacyUvs;
+    float legacyMs = 0;
+    bool allSame = true;
+    std::cout << std::fixed << std::setprecision(2) << "obj file:       " << options.objBench << ", " << megabytes
+              << " MB" << std::endl;
+    for (unsigned int threads : threadCounts){
+        std::vector<glm::vec3> points, normals;
+        std::vector<glm::vec2> uvs;
+        float fastest = 0;
+        for (unsigned int run = 0; run < std::max(options.frames, 3u); run++){
+            points.clear();
+            uvs.clear();
+            normals.clear();
+            auto start = std::chrono::high_resolution_clock::now();
+            bool loaded = threads == 0 ? loadOBJLegacy(options.objBench.c_str(), points, uvs, normals)
+                                       : loadOBJ(options.objBench.c_str(), points, uvs, normals, threads);
+            if (!loaded) {
+                std::cerr << "can't load " << options.objBench << (threads == 0 ? " with the legacy loader" : "")
+                          << std::endl;
+                return 1;
+            }
+            float ms = millisecondsSince(start);
+            fastest = run == 0 ? ms : std::min(fastest, ms);
+        }
+        if (threads == 0) {
+            std::cout << "triangles:      " << points.size() / 3 << std::endl
+                      << "fscanf:         " << fastest << " ms, " << megabytes / (fastest / 1000.0) << " MB/s" << std::endl;
+            legacyMs = fastest;
+            legacyPoints.swap(points);
+            legacyUvs.swap(uvs);
+            legacyNormals.swap(normals);
+            continue;
+        }
+        bool same = points == legacyPoints && uvs == legacyUvs && normals == legacyNormals;
+        allSame = allSame && same;
+        std::cout << "mapped " << std::left << std::setw(8) << (std::to_string(threads) + "T:") << std::right << fastest
+                  << " ms, " << megabytes / (fastest / 1000.0) << " MB/s, " << legacyMs / fastest << "x, output "
+                  << (same ? "identical" : "DIFFERENT") << std::endl;
+    }
+
+    // the indexed overload, the same triangles from fewer vertices
+    std::vector<glm::vec3> points, normals;
+    std::vector<glm::vec2> uvs;
+    std::vector<unsigned int> indices;
+    auto start = std::chrono::high_resolution_clock::now();
+    if (!loadOBJ(options.objBench.c_str(), points, uvs, normals, indices, maxThreads)) return 1;
+    float ms = millisecondsSince(start);
+    bool same = indices.size() == legacyPoints.size();
+    for (size_t i = 0; i < indices.size() && same; i++)
+        same = points[indices[i]] == legacyPoints[i] && uvs[indices[i]] == legacyUvs[i] &&
+               normals[indices[i]] == legacyNormals[i];
+    allSame = allSame && same;
+    const size_t vertexBytes = sizeof(glm::vec3) * 2 + sizeof(glm::vec2);
+    double expandedMB = legacyPoints.size() * vertexBytes / (1024.0 * 1024.0);
+    double indexedMB = (points.size() * vertexBytes + indices.size() * sizeof(unsigned int)) / (1024.0 * 1024.0);
+    std::cout << "indexed:        " << ms << " ms, " << points.size() << " vertices for " << indices.size()
+              << " corners (" << double(indices.size()) / std::max<size_t>(points.size(), 1) << " per vertex), "
+              << expandedMB << " -> " << indexedMB << " MB with the indices, output "
+              << (same ? "identical" : "DIFFERENT") << std::endl;
+
+    // the streaming parser, in batches of corners as a vertex buffer would be filled. It holds the positions, uvs and
+    // normals of the file and a batch, where loadOBJ also holds the corner indices and then the expanded corners
+    const size_t batchSize = 3 << 14;
+    std::string error;
+    size_t streamed = 0;
+    same = true;
+    start = std::chrono::high_resolution_clock::now();
+    bool parsed = objloader::streamOBJBatches(options.objBench.c_str(), batchSize,
+            [&](const glm::vec3 *batchPoints, const glm::vec2 *batchUvs, const glm::vec3 *batchNormals, size_t count,
+                size_t first){
+        same = same && first == streamed && first + count <= legacyPoints.size() &&
+               std::equal(batchPoints, batchPoints + count, legacyPoints.begin() + first) &&
+               std::equal(batchUvs, batchUvs + count, legacyUvs.begin() + first) &&
+               std::equal(batchNormals, batchNormals + count, legacyNormals.begin() + first);
+        streamed += count;
+    }, error);
+    ms = millisecondsSince(start);
+    if (!parsed) {
+        std::cerr << "can't stream " << options.objBench << ": " << error << std::endl;
+        return 1;
+    }
+    same = same && streamed == legacyPoints.size();
+    allSame = allSame && same;
+    double poolsMB;
+    {
+        objloader::MappedFile mapped;
+        mapped.open(options.objBench.c_str());
+        objloader::ObjCounts counts = objloader::countOBJ(mapped.begin(), mapped.end());
+        poolsMB = (counts.positions * sizeof(glm::vec3) + counts.uvs * sizeof(glm::vec2) +
+                   counts.normals * sizeof(glm::vec3)) / (1024.0 * 1024.0);
+    }
+    double batchMB = std::min(batchSize, legacyPoints.size()) * vertexBytes / (1024.0 * 1024.0);
+    double cornerIndicesMB = legacyPoints.size() * 3 * sizeof(int) / (1024.0 * 1024.0);
+    std::cout << "streamed:       " << ms << " ms, " << legacyMs / ms << "x, holds " << poolsMB + batchMB
+              << " MB (batches of " << batchSize << " corners) instead of " << poolsMB + cornerIndicesMB + expandedMB
+              << " MB, output " << (same ? "identical" : "DIFFERENT") << std::endl;
+
+    // the binary cache: the first load parses the file and writes it, the next ones map it instead
+    std::string cachePath = meshcache::cachePath(options.objBench, "objloader");
+    remove(cachePath.c_str());
+    meshcache::enabled() = true;
+    std::vector<glm::vec3> cachedPoints, cachedNormals;
+    std::vector<glm::vec2> cachedUvs;
+    start = std::chrono::high_resolution_clock::now();
+    if (!loadOBJ(options.objBench.c_str(), cachedPoints, cachedUvs, cachedNormals, maxThreads)) return 1;
+    float writeMs = millisecondsSince(start);
+    FILE *cacheFile = fopen(cachePath.c_str(), "rb");
+    if (cacheFile == NULL) {
+        std::cerr << "no cache written at " << cachePath << std::endl;
+        return 1;
+    }
+    fseek(cacheFile, 0, SEEK_END);
+    double cacheMB = ftell(cacheFile) / (1024.0 * 1024.0);
+    fclose(cacheFile);
+    std::cout << "cache write:    " << writeMs << " ms, " << cacheMB << " MB at " << cachePath << std::endl;
+
+    float fastest = 0, fastestIndexed = 0;
+    std::vector<unsigned int> cachedIndices;
+    for (unsigned int run = 0; run < std::max(options.frames, 3u); run++){
+        cachedPoints.clear();
+        cachedUvs.clear();
+        cachedNormals.clear();
+        start = std::chrono::high_resolution_clock::now();
+        if (!loadOBJ(options.objBench.c_str(), cachedPoints, cachedUvs, cachedNormals, maxThreads)) return 1;
+        ms = millisecondsSince(start);
+        fastest = run == 0 ? ms : std::min(fastest, ms);
+    }
+    same = cachedPoints == legacyPoints && cachedUvs == legacyUvs && cachedNormals == legacyNormals;
+    allSame = allSame && same;
+    std::cout << "cached:         " << fastest << " ms, " << legacyMs / fastest << "x, output "
+              << (same ? "identical" : "DIFFERENT") << std::endl;
+    for (unsigned int run = 0; run < std::max(options.frames, 3u); run++){
+        cachedPoints.clear();
+        cachedUvs.clear();
+        cachedNormals.clear();
+        cachedIndices.clear();
+        start = std::chrono::high_resolution_clock::now();
+        if (!loadOBJ(options.objBench.c_str(), cachedPoints, cachedUvs, cachedNormals, cachedIndices, maxThreads))
+            return 1;
+        ms = millisecondsSince(start);
+        fastestIndexed = run == 0 ? ms : std::min(fastestIndexed, ms);
+    }
+    same = cachedPoints == points && cachedUvs == uvs && cachedNormals == normals && cachedIndices == indices;
+    allSame = allSame && same;
+    std::cout << "cached indexed: " << fastestIndexed << " ms, " << legacyMs / fastestIndexed << "x, output "
+              << (same ? "identical" : "DIFFERENT") << std::endl;
+    remove(cachePath.c_str());
+    return allSame ? 0 : 1;
+}
+
+// writes --scene to --convert for out of core rendering, instanced scenes are flattened first
+int convertScene(const Options &options){
+    Scene scene;
+    if (!makeScene(options.scene, scene)) {
+        std::cerr << "can't load scene " << options.scene << std::endl;
+        return 1;
+    }
+    flattenScene(scene);
+    rt::MappedMeshWriteReport report;
+    if (scene.mapped || !rt::MappedMesh::write(options.convert, scene.vts, options.clusterKB * 1024, &report)) {
+        std::cerr << "can't write " << options.convert << std::endl;
+        return 1;
+    }
+    std::cout << "converted:      " << options.scene << " (" << report.triangles << " triangles) to " << options.convert
+              << ", " << report.file_bytes / (1024.0 * 1024.0) << " MB" << std::endl
+              << "clusters:       " << report.clusters << " of up to " << options.clusterKB << " KB, "
+              << report.top_nodes << " top level nodes" << std::endl
+              << "time:           bvh build " << report.build_ms << " ms, write " << report.write_ms << " ms" << std::endl;
+    return 0;
+}
+
+// renders --scene (or the benchmark scenes with --bench) with the binary and with the wide bvh, and compares the memory
+// of their nodes, the speed of the fastest of --frames frames and the nodes visited per ray. Instanced scenes are
+// flattened, so that the whole scene is in the one bvh that changes format
+int compareBVHFormats(Options options, rt::Renderer &renderer){
+    std::vector<std::string> names = options.bench ? benchmarkScenes : std::vector<std::string>{options.scene};
+    options.flatten = true;
+    options.output.clear();
+    options.heatmap.clear();
+    options.referenceSamples = 0;
+
+    std::cout << std::left << std::setw(26) << "scene" << std::right << std::setw(10) << "triangles"
+              << std::setw(12) << "binary KB" << std::setw(10) << "wide KB" << std::setw(14) << "binary Mray/s"
+              << std::setw(12) << "wide Mray/s" << std::setw(9) << "speedup" << std::setw(14) << "binary nodes"
+              << std::setw(12) << "wide nodes" << std::endl << std::fixed << std::setprecision(2);
+    bool allLoaded = true;
+    for (const std::string &name : names){
+        double kb[2], mraysPerSecond[2], nodesPerRay[2];
+        size_t triangles = 0;
+        bool loaded = true;
+        for (int f = 0; f < 2 && loaded; f++){
+            options.bvhFormat = f == 0 ? rt::BVHFormat::Binary : rt::BVHFormat::Wide;
+            Scene scene;
+            PhaseTimes times;
+            rt::RayCounters rays;
+            loaded = run(options, name, renderer, times, rays, scene);
+            if (!loaded) break;
+            triangles = triangleCount(scene);
+            kb[f] = renderer.bvhNodeBytes() / 1024.0;
+            mraysPerSecond[f] = double(rays.total()) / options.frames / (times.traceMin / 1000.0) / 1e6;
+            nodesPerRay[f] = double(rays.nodes_visited) / std::max<uint64_t>(rays.total(), 1);
+        }
+        if (!loaded) {
+            allLoaded = false;
+            continue;
+        }
+        std::cout << std::left << std::setw(26) << name << std::right << std::setw(10) << triangles
+                  << std::setw(12) << kb[0] << std::setw(10) << kb[1] << std::setw(14) << mraysPerSecond[0]
+                  << std::setw(12) << mraysPerSecond[1] << std::setw(8) << mraysPerSecond[1] / mraysPerSecond[0] << "x"
+                  << std::setw(14) << nodesPerRay[0] << std::setw(12) << nodesPerRay[1] << std::endl;
+    }
+    return allLoaded ? 0 : 1;
+}
+
+const char *shadingName(rt::ShadingModel model){
+    switch (model){
+        case rt::ShadingModel::Diffuse: return "diffuse";
+        case rt::ShadingModel::Flat: return "flat";
+        default: return "phong";
+    }
+}
+
+// renders --scene (or the benchmark scenes with --bench) with the generic traceRay and with the specialized kernel,
+// for each depth up to --depth and a few shading settings, and compares the fastest of --frames frames. The images
+// must be the same, a difference is reported
+int compareTraceKernels(Options options, rt::Renderer &renderer){
+    std::vector<std::string> names = options.bench ? benchmarkScenes : std::vector<std::string>{options.scene};
+    options.output.clear();
+    options.heatmap.clear();
+    options.referenceSamples = 0;
+    std::vector<rt::TraceSettings> settings(4);
+    settings[1].shadows = false;
+    settings[2].shading = rt::ShadingModel::Diffuse;
+    settings[3].shading = rt::ShadingModel::Flat;
+
+    std::cout << std::left << std::setw(26) << "scene" << std::setw(8) << "depth" << std::setw(10) << "shading"
+              << std::setw(9) << "shadows" << std::right << std::setw(12) << "generic ms" << std::setw(16)
+              << "specialized ms" << std::setw(12) << "Mrays/s" << std::setw(9) << "speedup" << std::setw(7) << "same"
+              << std::endl << std::fixed << std::setprecision(2);
+    bool allLoaded = true, allSame = true;
+    unsigned int maxDepth = std::max(1u, std::min(options.depth, 5u));
+    for (const std::string &name : names){
+        bool loaded = true;
+        for (unsigned int depth = 1; depth <= maxDepth && loaded; depth++)
+            for (const rt::TraceSettings &setting : settings){
+                float ms[2];
+                double mraysPerSecond = 0;
+                std::vector<rt::Colors::color> image[2];
+                for (int k = 0; k < 2 && loaded; k++){
+                    options.depth = depth;
+                    options.trace = setting;
+                    options.trace.specialized = k == 1;
+                    Scene scene;
+                    PhaseTimes times;
+                    rt::RayCounters rays;
+                    loaded = run(options, name, renderer, times, rays, scene);
+                    if (!loaded) break;
+                    ms[k] = times.traceMin;
+                    mraysPerSecond = double(rays.total()) / options.frames / (times.traceMin / 1000.0) / 1e6;
+                    if (const FrameBuffer<rt::Colors::color> *hdr = renderer.hdrFrame())
+                        image[k].assign(hdr->buffer, hdr->buffer + hdr->W * hdr->H);
+                }
+                if (!loaded) {
+                    allLoaded = false;
+                    break;
+                }
+                bool same = image[0] == image[1];
+                allSame = allSame && same;
+                std::cout << std::left << std::setw(26) << name << std::setw(8) << depth << std::setw(10)
+                          << shadingName(setting.shading) << std::setw(9) << (setting.shadows ? "on" : "off")
+                          << std::right << std::setw(12) << ms[0] << std::setw(16) << ms[1] << std::setw(12)
+                          << mraysPerSecond << std::setw(8) << ms[0] / ms[1] << "x" << std::setw(7)
+                          << (same ? "yes" : "NO") << std::endl;
+            }
+    }
+    return allLoaded && allSame ? 0 : 1;
+}
+
+// how image differs from reference
+struct ImageDifference {
+    unsigned int differ = 0; // pixels that are not exactly the same
+    unsigned int beyond = 0; // pixels with a color channel off by more than the tolerance
+    float maxDiff = 0;       // largest difference of a color channel
+    long first = -1;         // first pixel that differs
+};
+
+ImageDifference compareImages(const std::vector<rt::Colors::color> &image,
+                              const std::vector<rt::Colors::color> &reference, float tolerance = 0){
+    ImageDifference difference;
+    for (size_t i = 0; i < image.size() && i < reference.size(); i++){
+        if (image[i] == reference[i]) continue;
+        if (difference.first < 0) difference.first = (long) i;
+        difference.differ++;
+        float pixelDiff = 0;
+        for (int c = 0; c < 4; c++)
+            pixelDiff = std::max(pixelDiff, std::abs(image[i][c] - reference[i][c]));
+        if (pixelDiff > tolerance) difference.beyond++;
+        difference.maxDiff = std::max(difference.maxDiff, pixelDiff);
+    }
+    return difference;
+}
+
+// renders --scene (or the benchmark scenes with --bench) with the scalar intersection kernel and each SIMD kernel the
+// cpu supports, for each depth up to --depth, and compares the fastest of --frames frames. All the kernels trace the
+// same bvh and break ties the same way, so the images must be the same pixel for pixel: the number of pixels that differ
+// from the scalar image, the largest difference of a color channel and the first of these pixels are reported
+int compareIntersectionKernels(Options options, rt::Renderer &renderer){
+    std::vector<std::string> names = options.bench ? benchmarkScenes : std::vector<std::string>{options.scene};
+    options.output.clear();
+    options.heatmap.clear();
+    options.referenceSamples = 0;
+    std::vector<rt::IntersectionKernel> kernels{rt::IntersectionKernel::Scalar};
+    for (rt::IntersectionKernel kernel : {rt::IntersectionKernel::SSE, rt::IntersectionKernel::AVX2})
+        if (rt::simd::resolve(kernel) == kernel) kernels.push_back(kernel);
+
+    std::cout << std::left << std::setw(26) << "scene" << std::setw(8) << "depth" << std::setw(16) << "kernel"
+              << std::right << std::setw(10) << "ms" << std::setw(9) << "speedup" << std::setw(10) << "differ"
+              << std::setw(12) << "max diff" << std::setw(12) << "first" << std::endl << std::fixed << std::setprecision(2);
+    bool allLoaded = true, allSame = true;
+    unsigned int maxDepth = std::max(1u, std::min(options.depth, 5u));
+    for (const std::string &name : names){
+        bool loaded = true;
+        for (unsigned int depth = 1; depth <= maxDepth && loaded; depth++){
+            options.depth = depth;
+            std::vector<rt::Colors::color> scalarImage;
+            float scalarMs = 0;
+            for (rt::IntersectionKernel kernel : kernels){
+                renderer.setIntersectionKernel(kernel);
+                Scene scene;
+                PhaseTimes times;
+                rt::RayCounters rays;
+                loaded = run(options, name, renderer, times, rays, scene);
+                if (!loaded) break;
+                std::vector<rt::Colors::color> image;
+                if (const FrameBuffer<rt::Colors::color> *hdr = renderer.hdrFrame())
+                    image.assign(hdr->buffer, hdr->buffer + hdr->W * hdr->H);
+                if (kernel == rt::IntersectionKernel::Scalar) {
+                    scalarImage = image;
+                    scalarMs = times.traceMin;
+                }
+
+                ImageDifference difference = compareImages(image, scalarImage);
+                allSame = allSame && difference.differ == 0 && image.size() == scalarImage.size();
+                std::cout << std::left << std::setw(26) << name << std::setw(8) << depth << std::setw(16)
+                          << rt::simd::name(kernel) << std::right << std::setw(10) << times.traceMin << std::setw(8)
+                          << scalarMs / times.traceMin << "x" << std::setw(10) << difference.differ << std::setw(12)
+                          << difference.maxDiff << std::setw(12);
+                if (difference.first < 0) std::cout << "-" << std::endl;
+                else std::cout << difference.first << std::endl;
+            }
+        }
+        allLoaded = allLoaded && loaded;
+    }
+    renderer.setIntersectionKernel(options.kernel);
+    return allLoaded && allSame ? 0 : 1;
+}
+
+// renders --scene (or the benchmark scenes with --bench, those that are instanced) with its instances, and flattened,
+// for each depth up to --depth. Moving the vertices to world space changes the rounding of the intersections, so most
+// pixels differ a little and a ray grazing an edge may hit the other triangle. The images match if at most
+// flattenOutliers of the pixels differ by more than flattenTolerance; a wrong transform changes far more of them
+const float flattenTolerance = 1e-3f;
+const float flattenOutliers = 0.01f;
+
+int compareFlattening(Options options, rt::Renderer &renderer){
+    std::vector<std::string> names = options.bench ? benchmarkScenes : std::vector<std::string>{options.scene};
+    options.output.clear();
+    options.heatmap.clear();
+    options.referenceSamples = 0;
+
+    std::cout << std::left << std::setw(26) << "scene" << std::setw(8) << "depth" << std::right << std::setw(14)
+              << "instanced ms" << std::setw(10) << "flat ms" << std::setw(10) << "differ" << std::setw(14)
+              << "beyond 1e-3" << std::setw(12) << "max diff" << std::setw(7) << "match" << std::endl
+              << std::fixed << std::setprecision(2);
+    bool allLoaded = true, allMatch = true;
+    unsigned int maxDepth = std::max(1u, std::min(options.depth, 5u));
+    for (const std::string &name : names){
+        bool loaded = true, instanced = true;
+        for (unsigned int depth = 1; depth <= maxDepth && loaded && instanced; depth++){
+            options.depth = depth;
+            float ms[2];
+            std::vector<rt::Colors::color> image[2];
+            for (int f = 0; f < 2 && loaded && instanced; f++){
+                options.flatten = f == 1;
+                Scene scene;
+                PhaseTimes times;
+                rt::RayCounters rays;
+                loaded = run(options, name, renderer, times, rays, scene);
+                if (!loaded) break;
+                instanced = f == 1 || scene.instances != nullptr;
+                ms[f] = times.traceMin;
+                if (const FrameBuffer<rt::Colors::color> *hdr = renderer.hdrFrame())
+                    image[f].assign(hdr->buffer, hdr->buffer + hdr->W * hdr->H);
+            }
+            if (!loaded || !instanced) break;
+            ImageDifference difference = compareImages(image[1], image[0], flattenTolerance);
+            bool match = image[0].size() == image[1].size() &&
+                         difference.beyond <= flattenOutliers * image[0].size();
+            allMatch = allMatch && match;
+            std::cout << std::left << std::setw(26) << name << std::setw(8) << depth << std::right << std::setw(14)
+                      << ms[0] << std::setw(10) << ms[1] << std::setw(10) << difference.differ << std::setw(14)
+                      << difference.beyond << std::setw(12) << std::setprecision(4) << difference.maxDiff
+                      << std::setprecision(2) << std::setw(7) << (match ? "yes" : "NO") << std::endl;
+        }
+        if (!instanced && !options.bench) std::cout << name << " is not instanced, nothing to compare" << std::endl;
+        allLoaded = allLoaded && loaded;
+    }
+    return allLoaded && allMatch ? 0 : 1;
+}
+
+// renders --scene (or the benchmark scenes with --bench) with renderWavefront, without and with sorting the secondary
+// rays, and compares their coherence (consecutive rays in the same octant, cosine of their directions and distance of
+// their origins) and the time and speed of the extend stage of the secondary bounces in the last of --frames frames
+int compareRaySorting(Options options, rt::Renderer &renderer){
+    std::vector<std::string> names = options.bench ? benchmarkScenes : std::vector<std::string>{options.scene};
+    options.wavefront = true;
+    options.samples = 0;
+    options.incremental = false;
+    options.output.clear();
+    options.heatmap.clear();
+    options.referenceSamples = 0;
+
+    std::cout << std::left << std::setw(26) << "scene" << std::setw(10) << "order" << std::right << std::setw(10)
+              << "octant %" << std::setw(9) << "cosine" << std::setw(10) << "distance" << std::setw(10) << "sort ms"
+              << std::setw(14) << "secondary ms" << std::setw(12) << "Mrays/s" << std::setw(12) << "frame ms"
+              << std::setw(9) << "speedup" << std::endl << std::fixed << std::setprecision(3);
+    bool allLoaded = true;
+    for (const std::string &name : names){
+        float secondaryMs[2] = {0, 0};
+        for (int k = 0; k < 2; k++){
+            options.sortRays = k == 1;
+            Scene scene;
+            PhaseTimes times;
+            rt::RayCounters rays;
+            if (!run(options, name, renderer, times, rays, scene)) {
+                allLoaded = false;
+                break;
+            }
+            // the stage times and the coherence are those of the last frame
+            const rt::WavefrontTimes &stages = renderer.wavefrontTimes();
+            const rt::RayCoherence &coherence = renderer.secondaryRayStats().traced;
+            secondaryMs[k] = stages.extend_secondary;
+            uint64_t secondary = times.frameRays.back().secondary;
+            std::cout << std::left << std::setw(26) << name << std::setw(10) << (k ? "sorted" : "spawned") << std::right
+                      << std::setw(10) << 100 * coherence.sameOctant() << std::setw(9) << coherence.meanCosine()
+                      << std::setw(10) << coherence.meanDistance() << std::setw(10) << stages.sort << std::setw(14)
+                      << stages.extend_secondary << std::setw(12) << secondary / (stages.extend_secondary / 1000.0) / 1e6
+                      << std::setw(12) << times.traceMin << std::setw(8)
+                      << (k ? secondaryMs[0] / secondaryMs[1] : 1.0f) << "x" << std::endl;
+        }
+    }
+    return allLoaded ? 0 : 1;
+}
+
+#ifdef RT_DISTRIBUTED
+// the path of this executable, to start the workers
+std::string executablePath(const char *argv0){
+    char path[4096];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0) return argv0;
+    path[length] = 0;
+    return path;
+}
+
+const char *kernelOption(rt::IntersectionKernel kernel){
+    switch (kernel){
+        case rt::IntersectionKernel::Scalar: return "scalar";
+        case rt::IntersectionKernel::SSE: return "sse";
+        case rt::IntersectionKernel::AVX2: return "avx2";
+        default: return "auto";
+    }
+}
+
+// renders --scene with worker processes, started here (--spawn) or on other machines (--workers), and writes the
+// frame like run does. Each frame is rendered --frames times, and the fastest one is reported. With --scaling the frame
+// is rendered with 1, 2, ... workers, to see how well the work spreads: the efficiency with n workers is the time with
+// one worker divided by n times the time with n
+int runDistributed(const Options &options, const char *argv0){
+    distributed::Coordinator coordinator;
+    if (!coordinator.listen((uint16_t) options.port)) {
+        std::cerr << "can't listen on port " << options.port << std::endl;
+        return 1;
+    }
+    unsigned int total = options.spawn + options.workers;
+    if (options.spawn > 0) {
+        // the local workers share the cores
+        unsigned int threads = options.threads > 0 ? options.threads
+                                                   : std::max(1u, std::thread::hardware_concurrency() / options.spawn);
+        std::vector<std::string> arguments{"--threads", std::to_string(threads), "--tile", std::to_string(options.tileSize),
+                                           "--kernel", kernelOption(options.kernel)};
+        if (!coordinator.spawn(options.spawn, executablePath(argv0), arguments)) {
+            std::cerr << "can't start the workers" << std::endl;
+            return 1;
+        }
+    }
+    if (options.workers > 0)
+        std::cout << "waiting for " << total << " workers on port " << coordinator.port() << std::endl;
+    if (!coordinator.acceptWorkers(total, options.workers > 0 ? 600000 : 30000)) {
+        std::cerr << "only " << coordinator.workerCount() << " of " << total << " workers connected" << std::endl;
+        return 1;
+    }
+
+    distributed::FrameSpec frame{};
+    strncpy(frame.scene, options.scene.c_str(), sizeof(frame.scene) - 1);
+    frame.flatten = options.flatten;
+    frame.width = options.width;
+    frame.height = options.height;
+    frame.depth = options.depth;
+    frame.fov = options.fov;
+    frame.shadows = options.trace.shadows;
+    frame.shading = uint32_t(options.trace.shading);
+    frame.customCamera = options.customCamera;
+    frame.customTarget = options.customTarget;
+    for (int k = 0; k < 3; k++){
+        frame.camera[k] = options.cameraPos[k];
+        frame.target[k] = options.cameraTarget[k];
+    }
+    float setupMs;
+    if (!coordinator.setup(frame, setupMs)) {
+        std::cerr << "the workers can't load scene " << options.scene << std::endl;
+        return 1;
+    }
+    std::cout << "scene:          " << options.scene << ", loaded by " << coordinator.aliveCount() << " workers in "
+              << setupMs << " ms (slowest worker)" << std::endl
+              << "image:          " << options.width << "x" << options.height << ", depth " << options.depth
+              << ", jobs of " << options.jobSize << "x" << options.jobSize << " pixels" << std::endl;
+
+    std::vector<unsigned int> workerCounts;
+    for (unsigned int n = options.scaling ? 1 : total; n <= total; n++) workerCounts.push_back(n);
+    FrameBuffer<rt::Colors::color> hdr(options.width, options.height);
+    distributed::FrameStats stats;
+    float oneWorkerMs = 0;
+    if (options.scaling)
+        std::cout << std::setw(8) << "workers" << std::setw(12) << "frame ms" << std::setw(10) << "speedup"
+                  << std::setw(12) << "efficiency" << std::setw(12) << "duplicates" << std::setw(10) << "requeued"
+                  << std::endl << std::fixed << std::setprecision(2);
+    for (unsigned int n : workerCounts){
+        float bestMs = 0;
+        for (unsigned int f = 0; f < options.frames; f++){
+            // the scene is loaded already, only the frame number changes
+            float ms;
+            if (!coordinator.setup(frame, ms) || !coordinator.render(options.jobSize, n, hdr, stats)) {
+                std::cerr << "all the workers were lost" << std::endl;
+                return 1;
+            }
+            bestMs = f == 0 ? stats.ms : std::min(bestMs, stats.ms);
+        }
+        if (n == 1) oneWorkerMs = bestMs;
+        if (options.scaling)
+            std::cout << std::setw(8) << n << std::setw(12) << bestMs << std::setw(10) << oneWorkerMs / bestMs
+                      << std::setw(11) << 100.0f * oneWorkerMs / (n * bestMs) << "%" << std::setw(12) << stats.duplicates
+                      << std::setw(10) << stats.requeued << std::endl;
+        else {
+            std::cout << "frame:          " << bestMs << " ms (fastest of " << options.frames << "), " << stats.jobs
+                      << " jobs, " << stats.duplicates << " straggler copies (" << stats.wasted << " wasted), "
+                      << stats.requeued << " requeued" << std::endl << "jobs per worker:";
+            for (unsigned int jobs : stats.jobsPerWorker) std::cout << " " << jobs;
+            std::cout << std::endl;
+        }
+    }
+
+    if (!options.output.empty()) {
+        FrameBuffer<uint32_t> fb(options.width, options.height);
+        for (unsigned int y = 0; y < fb.H; y++)
+            rt::resolve::resolveRow(hdr.buffer + y * fb.W, fb.buffer + y * fb.W, fb.W, options.resolve);
+        bool written = endsWith(options.output, ".pfm") ? writePFM(options.output, hdr) : writePPM(options.output, fb);
+        if (!written) {
+            std::cerr << "can't write " << options.output << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)){
+        printUsage();
+        return 1;
+    }
+
+    rt::Renderer renderer;
+    renderer.setThreadCount(options.threads);
+    renderer.setTileSize(options.tileSize);
+    renderer.setIntersectionKernel(options.kernel);
+    if (!options.worker.empty() || options.spawn > 0 || options.workers > 0) {
+#ifdef RT_DISTRIBUTED
+        if (!options.worker.empty()) return distributed::runWorker(options.worker, renderer);
+        return runDistributed(options, argv[0]);
+#else
+        std::cerr << "distributed rendering needs POSIX sockets, it is not built on this platform" << std::endl;
+        return 1;
+#endif
+    }
+    std::cout << "threads: " << renderer.threadCount() << ", kernel: " << rt::simd::name(renderer.intersectionKernel())
+              << std::endl;
+    if (!options.convert.empty()) return convertScene(options);
+    if (!options.objBench.empty()) return benchmarkOBJ(options);
+    if (options.bvhCompare) return compareBVHFormats(options, renderer);
+    if (options.traceCompare) return compareTraceKernels(options, renderer);
+    if (options.kernelCompare) return compareIntersectionKernels(options, renderer);
+    if (options.flattenCompare) return compareFlattening(options, renderer);
+    if (options.sortCompare) return compareRaySorting(options, renderer);
+
+    if (!options.bench){
+        Scene scene;
+        PhaseTimes times;
+        rt::RayCounters rays;
+        if (!run(options, options.scene, renderer, times, rays, scene)) return 1;
+        printReport(options, scene, renderer, times, rays);
+        std::vector<SceneStats> stats{SceneStats{scene.name, triangleCount(scene), times, renderer.tileStats()}};
+        if (!options.stats.empty() && !writeStats(options.stats, options, stats)) {
+            std::cerr << "can't write " << options.stats << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // one line per scene, scenes that can't be loaded are reported and skipped
+    options.output.clear();
+    options.heatmap.clear();
+    std::vector<SceneStats> stats;
+    std::cout << std::left << std::setw(26) << "scene" << std::right << std::setw(10) << "triangles"
+              << std::setw(12) << "load ms" << std::setw(12) << "build ms" << std::setw(12) << "frame ms"
+              << std::setw(12) << "Mrays/s" << std::setw(12) << "memory MB";
+    // the quality columns, only when denoising or comparing to a reference
+    bool quality = options.denoise.enabled || options.referenceSamples > 0;
+    if (quality)
+        std::cout << std::setw(12) << "denoise ms" << std::setw(12) << "RMSE" << std::setw(12) << "RMSE dn";
+    std::cout << std::endl << std::fixed << std::setprecision(2);
+    bool allLoaded = true;
+    for (const std::string &name : benchmarkScenes){
+        Scene scene;
+        PhaseTimes times;
+        rt::RayCounters rays;
+        if (!run(options, name, renderer, times, rays, scene)) {
+            allLoaded = false;
+            continue;
+        }
+        std::cout << std::left << std::setw(26) << name << std::right
+                  << std::setw(10) << triangleCount(scene)
+                  << std::setw(12) << times.load << std::setw(12) << times.build
+                  << std::setw(12) << times.traceTotal / options.frames
+                  << std::setw(12) << rays.total() / (times.traceTotal / 1000.0) / 1e6
+                  << std::setw(12) << sceneBytes(scene, renderer) / (1024.0 * 1024.0);
+        if (quality) {
+            // errors are small, 2 decimals would hide them
+            std::cout << std::setw(12) << times.denoiseTotal / options.frames << std::setprecision(5);
+            for (double rmse : {times.rmseTraced, times.rmseDenoised}){
+                if (rmse >= 0) std::cout << std::setw(12) << rmse;
+                else std::cout << std::setw(12) << "-";
+            }
+            std::cout << std::setprecision(2);
+        }
+        std::cout << std::endl;
+        stats.push_back(SceneStats{name, triangleCount(scene), times, renderer.tileStats()});
+    }
+    if (!options.stats.empty() && !writeStats(options.stats, options, stats)) {
+        std::cerr << "can't write " << options.stats << std::endl;
+        return 1;
+    }
+    return allLoaded ? 0 : 1;
+}
@@ -0,0 +1,859 @@
+// modified version of https://github.com/opengl-tutorials/ogl/blob/master/common/objloader.cpp
+
+#ifndef GRAPHICSPROGRAMMINGEXERCISES_OBJLOADER_H
+#define GRAPHICSPROGRAMMINGEXERCISES_OBJLOADER_H
+
+
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <clocale>
+#include <cfloat>
+#include <climits>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <type_traits>
+
+#include <glm/glm.hpp>
+
+#include "meshcache.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+// glad defines APIENTRY too, windows.h defines it again to the same calling convention
+#ifdef APIENTRY
+#undef APIENTRY
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Very, VERY simple OBJ loader.
+// Here is a short list of features a real function would provide :
+// - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
+// - Animations & bones (includes bones weights)
+// - Multiple UVs
+// - Loading from memory, stream, etc
+//
+// The file is memory mapped and parsed in place, with a tokenizer and a float parser that don't depend on the locale.
+// It reads the positions (v), uvs (vt), normals (vn) and faces (f) of any number of corners, which are split in a fan
+// of triangles. A corner is v, v/vt, v//vn or v/vt/vn, and negative indices count back from the last element read.
+// Corners without uv get (0, 0), and corners without normal get the normal of their triangle. Other lines are ignored.
+// With meshcache::enabled(), the first load writes a binary cache of the mesh next to the file, which later loads read
+// instead (see meshcache.h).
+
+namespace objloader {
+
+    // a read only view of a whole file, memory mapped where possible
+    class MappedFile{
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile() { close(); }
+
+        bool open(const char *path){
+            close();
+#ifdef _WIN32
+            file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            if (file == INVALID_HANDLE_VALUE) return false;
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(file, &file_size)) { close(); return false; }
+            bytes = (size_t) file_size.QuadPart;
+            if (bytes == 0) return true;
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping) data = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+            fd = ::open(path, O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0) { close(); return false; }
+            bytes = (size_t) st.st_size;
+            if (bytes == 0) return true;
+            void *address = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                data = (const char *) address;
+                // the parser reads the file once from start to end
+                madvise(address, bytes, MADV_SEQUENTIAL);
+            }
+#endif
+            if (!data) {
+                // not a mappable file (a pipe, or a special file system), read it instead
+                FILE *stream = fopen(path, "rb");
+                copy.resize(bytes);
+                bool read = stream && fread(&copy[0], 1, bytes, stream) == bytes;
+                if (stream) fclose(stream);
+                if (!read) { close(); return false; }
+                data = copy.data();
+            }
+            return true;
+        }
+
+        void close(){
+#ifdef _WIN32
+            if (data && data != copy.data()) UnmapViewOfFile(data);
+            if (mapping) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+            mapping = NULL;
+            file = INVALID_HANDLE_VALUE;
+#else
+            if (data && data != copy.data()) munmap((void *) data, bytes);
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+#endif
+            data = nullptr;
+            bytes = 0;
+            copy.clear();
+        }
+
+        const char *begin() const { return data; }
+        const char *end() const { return data + bytes; }
+        size_t size() const { return bytes; }
+
+    private:
+        const char *data = nullptr;
+        size_t bytes = 0;
+        std::string copy;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = NULL;
+#else
+        int fd = -1;
+#endif
+    };
+
+    inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+    inline bool isDigit(char c) { return (unsigned char) (c - '0') < 10; }
+
+    inline void skipBlanks(const char *&p, const char *end){
+        while (p < end && isBlank(*p)) p++;
+    }
+
+    // moves p to the start of the next line
+    inline void skipLine(const char *&p, const char *end){
+        const char *newline = (const char *) memchr(p, '\n', end - p);
+        p = newline ? newline + 1 : end;
+    }
+
+    // the decimal number of the text between begin and end, through strtof with the decimal point of the current locale
+    inline float parseFloatSlow(const char *begin, const char *end){
+        char buffer[128];
+        size_t length = std::min<size_t>(end - begin, sizeof(buffer) - 1);
+        memcpy(buffer, begin, length);
+        buffer[length] = 0;
+        char point = *localeconv()->decimal_point;
+        for (size_t i = 0; i < length; i++) if (buffer[i] == '.') buffer[i] = point;
+        return strtof(buffer, nullptr);
+    }
+
+    // parses a float at p ([+-]digits[.digits][e[+-]digits], inf and nan are not accepted) and moves p past it.
+    // The result is the correctly rounded float, like strtof: mantissas up to 2^24 with small exponents are exact in
+    // float arithmetic, up to 2^53 they are rounded once to double and a second time to float, which only differs from
+    // rounding once when the double falls exactly halfway between two floats. That case, and longer numbers, go
+    // through strtof
+    inline bool parseFloat(const char *&p, const char *end, float &out){
+        static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        const char *start = p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool any = false, truncated = false; // truncated: non zero digits after the first 19 were dropped
+        // leading zeros are not significant
+        for (; p < end && *p == '0'; p++) any = true;
+        for (; p < end && isDigit(*p); p++){
+            any = true;
+            if (digits < 19) mantissa = mantissa * 10 + (*p - '0'), digits++;
+            else exponent++, truncated |= *p != '0';
+        }
+        if (p < end && *p == '.') {
+            p++;
+            if (digits == 0) for (; p < end && *p == '0'; p++) any = true, exponent--;
+            for (; p < end && isDigit(*p); p++){
+                any = true;
+                if (digits < 19) mantissa = mantissa * 10 + (*p - '0'), digits++, exponent--;
+                else truncated |= *p != '0';
+            }
+        }
+        if (!any) { p = start; return false; }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            const char *e = p + 1;
+            bool negative_exponent = false;
+            if (e < end && (*e == '-' || *e == '+')) negative_exponent = *e++ == '-';
+            if (e < end && isDigit(*e)) {
+                int value = 0;
+                for (; e < end && isDigit(*e); e++) if (value < 100000) value = value * 10 + (*e - '0');
+                exponent += negative_exponent ? -value : value;
+                p = e;
+            }
+        }
+        if (p < end && !isBlank(*p) && *p != '\n') { p = start; return false; }
+
+        if (mantissa == 0) {
+            out = negative ? -0.0f : 0.0f;
+            return true;
+        }
+        if (!truncated && mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10) {
+            // both operands are exact floats, and a single float operation rounds correctly
+            float value = exponent < 0 ? float(mantissa) / float(powers[-exponent]) : float(mantissa) * float(powers[exponent]);
+            out = negative ? -value : value;
+            return true;
+        }
+        if (!truncated && mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+            double value = exponent < 0 ? double(mantissa) / powers[-exponent] : double(mantissa) * powers[exponent];
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            // the 29 low bits of the double are below the float precision, a 1 followed by zeros is halfway
+            if ((bits & 0x1fffffff) != 0x10000000 && value >= FLT_MIN && value <= FLT_MAX) {
+                out = negative ? -float(value) : float(value);
+                return true;
+            }
+        }
+        out = parseFloatSlow(start, p);
+        return true;
+    }
+
+    // parses a signed integer at p and moves p past it. Fails on values beyond INT_MAX, which can't index anything
+    inline bool parseIndex(const char *&p, const char *end, long &out){
+        bool negative = false;
+        const char *start = p;
+        if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+        if (p >= end || !isDigit(*p)) { p = start; return false; }
+        long value = 0;
+        for (; p < end && isDigit(*p); p++){
+            if (value > (INT_MAX - (*p - '0')) / 10) { p = start; return false; }
+            value = value * 10 + (*p - '0');
+        }
+        out = negative ? -value : value;
+        return true;
+    }
+
+    // the vertices and triangles of an OBJ file. Each triangle corner is three indices in corners, a position, an uv
+    // and a normal, counted from 0 (negative indices resolved), -1 where the corner has no uv or no normal
+    struct ObjData{
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> uvs; // with v inverted, as the tutorial loader did for DDS textures
+        std::vector<glm::vec3> normals;
+        std::vector<int> corners;
+        std::string error; // why parseOBJ failed
+    };
+
+    // resolves a 1 based (or negative, relative) OBJ index against the count of elements read so far
+    inline bool resolveIndex(long index, size_t count, int &out){
+        long resolved = index < 0 ? long(count) + index : index - 1;
+        if (index == 0 || resolved < 0 || resolved >= long(count)) return false;
+        out = int(resolved);
+        return true;
+    }
+
+    // calls work(i) for i in [0, count) on threads threads (the calling one included), which take the next i in turns
+    inline void parallelFor(size_t count, unsigned int threads, const std::function<void(size_t)> &work){
+        std::atomic<size_t> next(0);
+        auto worker = [&](){
+            for (size_t i = next++; i < count; i = next++) work(i);
+        };
+        std::vector<std::thread> pool;
+        for (unsigned int t = 1; t < std::min<size_t>(threads, count); t++) pool.emplace_back(worker);
+        worker();
+        for (std::thread &thread : pool) thread.join();
+    }
+
+    // the kind of statement of the line at p, which starts after the leading blanks
+    enum class Record{ Position, Uv, Normal, Face, Other };
+    inline Record recordAt(const char *p, const char *end){
+        char c = *p;
+        char next = p + 1 < end ? p[1] : '\n';
+        bool blank_after_two = p + 2 >= end || isBlank(p[2]);
+        if (c == 'v' && isBlank(next)) return Record::Position;
+        if (c == 'v' && next == 't' && blank_after_two) return Record::Uv;
+        if (c == 'v' && next == 'n' && blank_after_two) return Record::Normal;
+        if (c == 'f' && isBlank(next)) return Record::Face;
+        return Record::Other;
+    }
+
+    // the elements a part of a file adds, and its lines
+    struct ObjCounts{
+        size_t positions = 0, uvs = 0, normals = 0;
+        unsigned int lines = 0;
+    };
+
+    // counts the records between begin and end without parsing them
+    inline ObjCounts countOBJ(const char *begin, const char *end){
+        ObjCounts counts;
+        const char *p = begin;
+        while (p < end){
+            counts.lines++;
+            skipBlanks(p, end);
+            if (p >= end) break;
+            switch (recordAt(p, end)){
+                case Record::Position: counts.positions++; break;
+                case Record::Uv: counts.uvs++; break;
+                case Record::Normal: counts.normals++; break;
+                default: break;
+            }
+            skipLine(p, end);
+        }
+        return counts;
+    }
+
+    // parses the OBJ text between begin and end, which follows text that had the elements and lines of before. Calls
+    // handler.position(glm::vec3), handler.uv(glm::vec2), handler.normal(glm::vec3) for each element, and
+    // handler.triangle(const int *corners) for each triangle, with 9 indices as in ObjData::corners. Returns false,
+    // with error set, if the text isn't valid
+    template <typename Handler>
+    bool parseOBJ(const char *begin, const char *end, Handler &handler, ObjCounts before, std::string &error){
+        const char *p = begin;
+        ObjCounts &counts = before;
+        // corners of the current face, as 3 indices each
+        std::vector<int> face;
+        auto fail = [&](const char *what){
+            error = std::string(what) + " at line " + std::to_string(counts.lines);
+            return false;
+        };
+        while (p < end){
+            counts.lines++;
+            skipBlanks(p, end);
+            if (p >= end) break;
+            Record record = recordAt(p, end);
+            if (record == Record::Position) {
+                p++;
+                glm::vec3 v;
+                for (int i = 0; i < 3; i++){
+                    skipBlanks(p, end);
+                    if (!parseFloat(p, end, v[i])) return fail("bad vertex position");
+                }
+                handler.position(v);
+                counts.positions++;
+            }
+            else if (record == Record::Uv) {
+                p += 2;
+                glm::vec2 uv;
+                for (int i = 0; i < 2; i++){
+                    skipBlanks(p, end);
+                    if (!parseFloat(p, end, uv[i])) return fail("bad texture coordinate");
+                }
+                uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
+                handler.uv(uv);
+                counts.uvs++;
+            }
+            else if (record == Record::Normal) {
+                p += 2;
+                glm::vec3 n;
+                for (int i = 0; i < 3; i++){
+                    skipBlanks(p, end);
+                    if (!parseFloat(p, end, n[i])) return fail("bad normal");
+                }
+                handler.normal(n);
+                counts.normals++;
+            }
+            else if (record == Record::Face) {
+                p++;
+                face.clear();
+                while (true){
+                    skipBlanks(p, end);
+                    if (p >= end || *p == '\n' || *p == '#') break;
+                    long index;
+                    int v, vt = -1, vn = -1;
+                    if (!parseIndex(p, end, index) || !resolveIndex(index, counts.positions, v))
+                        return fail("bad face position index");
+                    if (p < end && *p == '/') {
+                        p++;
+                        if (p < end && *p != '/' &&
+                            (!parseIndex(p, end, index) || !resolveIndex(index, counts.uvs, vt)))
+                            return fail("bad face texture coordinate index");
+                        if (p < end && *p == '/') {
+                            p++;
+                            if (!parseIndex(p, end, index) || !resolveIndex(index, counts.normals, vn))
+                                return fail("bad face normal index");
+                        }
+                    }
+                    face.push_back(v);
+                    face.push_back(vt);
+                    face.push_back(vn);
+                }
+                if (face.size() < 9) return fail("face with less than 3 corners");
+                // a fan around the first corner, a quad gives the triangles 0 1 2 and 0 2 3 like the tutorial loader
+                int triangle[9] = {face[0], face[1], face[2]};
+                for (size_t k = 6; k < face.size(); k += 3){
+                    std::copy(face.begin() + k - 3, face.begin() + k + 3, triangle + 3);
+                    handler.triangle(triangle);
+                }
+            }
+            // comments, groups, materials and anything else are skipped
+            skipLine(p, end);
+        }
+        return true;
+    }
+
+    // appends the elements and triangles to an ObjData
+    struct ObjDataHandler{
+        ObjData &data;
+        void position(const glm::vec3 &v) { data.positions.push_back(v); }
+        void uv(const glm::vec2 &uv) { data.uvs.push_back(uv); }
+        void normal(const glm::vec3 &n) { data.normals.push_back(n); }
+        void triangle(const int *corners) { data.corners.insert(data.corners.end(), corners, corners + 9); }
+    };
+
+    // parses the OBJ text between begin and end into data, which must be empty. Returns false (with data.error set) if
+    // the text isn't valid
+    inline bool parseOBJ(const char *begin, const char *end, ObjData &data){
+        ObjDataHandler handler{data};
+        return parseOBJ(begin, end, handler, ObjCounts(), data.error);
+    }
+
+    // same as above on threads threads (0 = one per core), with the same result. The text is cut in line aligned
+    // chunks, a few per thread, which the threads take in turns: a first pass counts the elements of each chunk, so
+    // that their prefix sums give every chunk the offset of its elements (and the count that its relative indices
+    // refer to) before the second pass parses them in place. The triangles of each chunk are concatenated at the end.
+    // Small files are parsed on the calling thread
+    inline bool parseOBJ(const char *begin, const char *end, ObjData &data, unsigned int threads){
+        const size_t min_chunk_bytes = 1 << 20;
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t bytes = end - begin;
+        size_t chunk_count = std::min<size_t>(size_t(threads) * 4, bytes / min_chunk_bytes);
+        if (threads == 1 || chunk_count <= 1) return parseOBJ(begin, end, data);
+
+        // chunk i is [starts[i], starts[i + 1]), each starts at the beginning of a line
+        std::vector<const char *> starts(chunk_count + 1, end);
+        starts[0] = begin;
+        for (size_t i = 1; i < chunk_count; i++){
+            const char *p = std::max(begin + bytes * i / chunk_count, starts[i - 1]);
+            skipLine(p, end);
+            starts[i] = std::max(p, starts[i - 1]);
+        }
+        auto parallel = [&](const std::function<void(size_t)> &work){ parallelFor(chunk_count, threads, work); };
+
+        std::vector<ObjCounts> counts(chunk_count + 1);
+        parallel([&](size_t i){ counts[i + 1] = countOBJ(starts[i], starts[i + 1]); });
+        for (size_t i = 1; i <= chunk_count; i++){
+            counts[i].positions += counts[i - 1].positions;
+            counts[i].uvs += counts[i - 1].uvs;
+            counts[i].normals += counts[i - 1].normals;
+            counts[i].lines += counts[i - 1].lines;
+        }
+
+        data.positions.resize(counts[chunk_count].positions);
+        data.uvs.resize(counts[chunk_count].uvs);
+        data.normals.resize(counts[chunk_count].normals);
+        // writes the elements of a chunk where the prefix sums put them
+        struct ChunkHandler{
+            glm::vec3 *positions;
+            glm::vec2 *uvs;
+            glm::vec3 *normals;
+            std::vector<int> corners;
+            void position(const glm::vec3 &v) { *positions++ = v; }
+            void uv(const glm::vec2 &uv) { *uvs++ = uv; }
+            void normal(const glm::vec3 &n) { *normals++ = n; }
+            void triangle(const int *c) { corners.insert(corners.end(), c, c + 9); }
+        };
+        std::vector<ChunkHandler> chunks(chunk_count);
+        std::vector<std::string> errors(chunk_count);
+        parallel([&](size_t i){
+            ChunkHandler &chunk = chunks[i];
+            chunk.positions = data.positions.data() + counts[i].positions;
+            chunk.uvs = data.uvs.data() + counts[i].uvs;
+            chunk.normals = data.normals.data() + counts[i].normals;
+            parseOBJ(starts[i], starts[i + 1], chunk, counts[i], errors[i]);
+        });
+        // the first error of the file, as the serial parser reports it
+        for (size_t i = 0; i < chunk_count; i++)
+            if (!errors[i].empty()) {
+                data.error = errors[i];
+                return false;
+            }
+
+        std::vector<size_t> corner_offsets(chunk_count + 1, 0);
+        for (size_t i = 0; i < chunk_count; i++) corner_offsets[i + 1] = corner_offsets[i] + chunks[i].corners.size();
+        data.corners.resize(corner_offsets[chunk_count]);
+        parallel([&](size_t i){
+            std::copy(chunks[i].corners.begin(), chunks[i].corners.end(), data.corners.begin() + corner_offsets[i]);
+            std::vector<int>().swap(chunks[i].corners);
+        });
+        return true;
+    }
+
+    // maps and parses the file at path, on threads threads as above
+    inline bool parseOBJ(const char *path, ObjData &data, unsigned int threads = 1){
+        MappedFile file;
+        if (!file.open(path)) {
+            data.error = "can't open the file";
+            return false;
+        }
+        return parseOBJ(file.begin(), file.end(), data, threads);
+    }
+
+    // the normal of the triangle a b c, for its corners without normal
+    inline glm::vec3 faceNormal(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c){
+        glm::vec3 n = glm::cross(b - a, c - a);
+        float length = glm::length(n);
+        return length > 0 ? n / length : glm::vec3(0);
+    }
+
+    // the normal of the triangle whose 9 corner indices start at c
+    inline glm::vec3 faceNormal(const ObjData &data, const int *c){
+        return faceNormal(data.positions[c[0]], data.positions[c[3]], data.positions[c[6]]);
+    }
+
+    // calls corner(i, position, uv, normal) for each triangle corner i of data, on threads threads (0 = one per core)
+    // for large models, in order otherwise
+    template <typename Corner>
+    void forEachCorner(const ObjData &data, Corner &&corner, unsigned int threads = 1){
+        auto triangles = [&](size_t first, size_t last){
+            for (size_t t = first * 9; t < last * 9; t += 9){
+                const int *c = &data.corners[t];
+                glm::vec3 face_normal = c[2] < 0 || c[5] < 0 || c[8] < 0 ? faceNormal(data, c) : glm::vec3(0);
+                for (int k = 0; k < 9; k += 3)
+                    corner(t / 3 + k / 3, data.positions[c[k]], c[k + 1] < 0 ? glm::vec2(0) : data.uvs[c[k + 1]],
+                           c[k + 2] < 0 ? face_normal : data.normals[c[k + 2]]);
+            }
+        };
+        const size_t batch = 1 << 16;
+        size_t count = data.corners.size() / 9;
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads == 1 || count <= batch) triangles(0, count);
+        else parallelFor((count + batch - 1) / batch, threads, [&](size_t b){
+            triangles(b * batch, std::min(count, (b + 1) * batch));
+        });
+    }
+
+    // merges the triangle corners of data with the same position, uv and normal indices into one vertex: calls
+    // vertex(position, uv, normal) for each distinct corner, in the order they first appear, and fills indices with
+    // the vertex of each corner. Corners without normal take the normal of their triangle, so they are only merged
+    // within it. The corners of a position are chained from it, so no hashing is needed
+    template <typename Vertex>
+    void indexCorners(const ObjData &data, std::vector<unsigned int> &indices, Vertex &&vertex){
+        struct Entry{
+            int uv, normal;
+            unsigned int vertex;
+            int next; // next entry of the same position, -1 for none
+        };
+        std::vector<int> first(data.positions.size(), -1);
+        std::vector<Entry> entries;
+        entries.reserve(data.corners.size() / 6);
+        indices.resize(data.corners.size() / 3);
+        unsigned int vertex_count = 0;
+        for (size_t t = 0; t < data.corners.size(); t += 9){
+            const int *c = &data.corners[t];
+            bool flat = c[2] < 0 || c[5] < 0 || c[8] < 0;
+            glm::vec3 face_normal = flat ? faceNormal(data, c) : glm::vec3(0);
+            for (int k = 0; k < 9; k += 3){
+                int e = c[k + 2] < 0 ? -1 : first[c[k]];
+                while (e >= 0 && (entries[e].uv != c[k + 1] || entries[e].normal != c[k + 2])) e = entries[e].next;
+                if (e < 0) {
+                    if (c[k + 2] >= 0) {
+                        entries.push_back(Entry{c[k + 1], c[k + 2], vertex_count, first[c[k]]});
+                        first[c[k]] = int(entries.size() - 1);
+                    }
+                    vertex(data.positions[c[k]], c[k + 1] < 0 ? glm::vec2(0) : data.uvs[c[k + 1]],
+                           c[k + 2] < 0 ? face_normal : data.normals[c[k + 2]]);
+                    indices[t / 3 + k / 3] = vertex_count++;
+                }
+                else indices[t / 3 + k / 3] = entries[e].vertex;
+            }
+        }
+    }
+
+    // a parseOBJ handler that keeps the positions, uvs and normals (a face can refer to any of them read before it) and
+    // calls triangle(positions, uvs, normals) with the 3 corners of each triangle as soon as it's read, with the
+    // values loadOBJ gives them
+    template <typename Triangle>
+    struct StreamHandler{
+        Triangle &triangle_callback;
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> uvs;
+        std::vector<glm::vec3> normals;
+
+        explicit StreamHandler(Triangle &triangle) : triangle_callback(triangle) {}
+
+        void position(const glm::vec3 &v) { positions.push_back(v); }
+        void uv(const glm::vec2 &uv) { uvs.push_back(uv); }
+        void normal(const glm::vec3 &n) { normals.push_back(n); }
+        void triangle(const int *c){
+            glm::vec3 p[3] = {positions[c[0]], positions[c[3]], positions[c[6]]};
+            glm::vec3 face_normal = c[2] < 0 || c[5] < 0 || c[8] < 0 ? faceNormal(p[0], p[1], p[2]) : glm::vec3(0);
+            glm::vec2 t[3];
+            glm::vec3 n[3];
+            for (int k = 0; k < 3; k++){
+                t[k] = c[k * 3 + 1] < 0 ? glm::vec2(0) : uvs[c[k * 3 + 1]];
+                n[k] = c[k * 3 + 2] < 0 ? face_normal : normals[c[k * 3 + 2]];
+            }
+            triangle_callback((const glm::vec3 *) p, (const glm::vec2 *) t, (const glm::vec3 *) n);
+        }
+    };
+
+    // parses the OBJ text between begin and end on the calling thread, and calls triangle(const glm::vec3 *positions,
+    // const glm::vec2 *uvs, const glm::vec3 *normals) with the 3 corners of each triangle, in the order of the file, as
+    // it is parsed. Only the positions, uvs and normals are kept, not the triangles, so a large file needs a fraction
+    // of the memory of loadOBJ, which also holds the indices of every corner and then every corner expanded
+    template <typename Triangle>
+    bool streamOBJ(const char *begin, const char *end, Triangle &&triangle, std::string &error){
+        StreamHandler<typename std::remove_reference<Triangle>::type> handler(triangle);
+        return parseOBJ(begin, end, handler, ObjCounts(), error);
+    }
+
+    // same, with the OBJ file at path
+    template <typename Triangle>
+    bool streamOBJ(const char *path, Triangle &&triangle, std::string &error){
+        MappedFile file;
+        if (!file.open(path)) {
+            error = "can't open the file";
+            return false;
+        }
+        return streamOBJ(file.begin(), file.end(), triangle, error);
+    }
+
+    // same as streamOBJ, but the corners are gathered in batches, for a vertex buffer or a bvh builder filled in
+    // parts: calls batch(const glm::vec3 *positions, const glm::vec2 *uvs, const glm::vec3 *normals, size_t count,
+    // size_t first) with count corners, batch_size (rounded down to whole triangles) except in the last batch, the
+    // first of which is corner first of the file. The arrays are reused by the next batch
+    template <typename Batch>
+    bool streamOBJBatches(const char *path, size_t batch_size, Batch &&batch, std::string &error){
+        batch_size = std::max<size_t>(batch_size / 3, 1) * 3;
+        std::vector<glm::vec3> positions, normals;
+        std::vector<glm::vec2> uvs;
+        size_t count = 0, first = 0;
+        bool streamed = streamOBJ(path, [&](const glm::vec3 *p, const glm::vec2 *t, const glm::vec3 *n){
+            if (count == positions.size()) {
+                // grown up to a batch, so that small files don't take a whole one
+                size_t size = std::min(batch_size, std::max<size_t>(positions.size() * 2, 3 * 1024));
+                positions.resize(size);
+                uvs.resize(size);
+                normals.resize(size);
+            }
+            std::copy(p, p + 3, &positions[count]);
+            std::copy(t, t + 3, &uvs[count]);
+            std::copy(n, n + 3, &normals[count]);
+            count += 3;
+            if (count == batch_size) {
+                batch(positions.data(), uvs.data(), normals.data(), count, first);
+                first += count;
+                count = 0;
+            }
+        }, error);
+        if (streamed && count > 0)
+            batch(positions.data(), uvs.data(), normals.data(), count, first);
+        return streamed;
+    }
+
+    // the cache loadOBJ keeps of an OBJ file: a single indexed mesh, as the indexed loadOBJ makes it
+    inline bool writeOBJCache(const char *path, const glm::vec3 *positions, const glm::vec2 *uvs,
+                              const glm::vec3 *normals, size_t vertex_count, const unsigned int *indices,
+                              size_t index_count){
+        if (vertex_count == 0) return false;
+        std::vector<meshcache::MeshInput> meshes(1);
+        meshes[0].vertex_count = (uint32_t) vertex_count;
+        meshes[0].streams[unsigned(meshcache::Attribute::Position)] = &positions->x;
+        meshes[0].streams[unsigned(meshcache::Attribute::Normal)] = &normals->x;
+        meshes[0].streams[unsigned(meshcache::Attribute::TexCoord)] = &uvs->x;
+        meshes[0].indices = indices;
+        meshes[0].index_count = (uint32_t) index_count;
+        return meshcache::write(meshcache::cachePath(path, "objloader").c_str(), {path}, meshes);
+    }
+
+    // same, from the parsed file
+    inline bool writeOBJCache(const char *path, const ObjData &data){
+        std::vector<glm::vec3> positions, normals;
+        std::vector<glm::vec2> uvs;
+        std::vector<unsigned int> indices;
+        indexCorners(data, indices, [&](const glm::vec3 &position, const glm::vec2 &uv, const glm::vec3 &normal){
+            positions.push_back(position);
+            uvs.push_back(uv);
+            normals.push_back(normal);
+        });
+        return writeOBJCache(path, positions.data(), uvs.data(), normals.data(), positions.size(), indices.data(),
+                             indices.size());
+    }
+
+    // calls corner(i, position, uv, normal) for each triangle corner i of the mesh in an OBJ cache
+    template <typename Corner>
+    void forEachCorner(const meshcache::MeshCache &cache, Corner &&corner){
+        const glm::vec3 *positions = (const glm::vec3 *) cache.stream(0, meshcache::Attribute::Position);
+        const glm::vec2 *uvs = (const glm::vec2 *) cache.stream(0, meshcache::Attribute::TexCoord);
+        const glm::vec3 *normals = (const glm::vec3 *) cache.stream(0, meshcache::Attribute::Normal);
+        const unsigned int *indices = cache.indices(0);
+        for (size_t i = 0; i < cache.mesh(0).index_count; i++)
+            corner(i, positions[indices[i]], uvs[indices[i]], normals[indices[i]]);
+    }
+
+    // maps the cache of the OBJ file at path, if there's a valid one
+    inline bool openOBJCache(const char *path, meshcache::MeshCache &cache){
+        if (!meshcache::enabled() || !cache.open(meshcache::cachePath(path, "objloader").c_str())) return false;
+        if (cache.meshCount() == 1 && cache.stream(0, meshcache::Attribute::Position) &&
+            cache.stream(0, meshcache::Attribute::Normal) && cache.stream(0, meshcache::Attribute::TexCoord)) return true;
+        cache.close();
+        return false;
+    }
+}
+
+
+bool loadOBJ(
+        const char * path,
+        std::vector<float> & out_vertices,
+        std::vector<float> & out_uvs,
+        std::vector<float> & out_normals,
+        unsigned int threads = 1 // 0 = one per core, see objloader::parseOBJ
+){
+    printf("Loading OBJ file %s...\n", path);
+
+    // the cache of an earlier run is read instead of the file, or written once the file is parsed
+    meshcache::MeshCache cache;
+    objloader::ObjData data;
+    bool cached = objloader::openOBJCache(path, cache);
+    if (!cached) {
+        objloader::MappedFile file;
+        if( !file.open(path) ){
+            printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+            getchar();
+            return false;
+        }
+        if (!objloader::parseOBJ(file.begin(), file.end(), data, threads)){
+            printf("File can't be read by our simple parser :-( %s\n", data.error.c_str());
+            return false;
+        }
+        if (meshcache::enabled()) objloader::writeOBJCache(path, data);
+    }
+
+    // the corners are written in place, so that they can be filled in parallel
+    size_t corners = cached ? cache.mesh(0).index_count : data.corners.size() / 3;
+    out_vertices.resize(out_vertices.size() + corners * 3);
+    out_uvs.resize(out_uvs.size() + corners * 2);
+    out_normals.resize(out_normals.size() + corners * 3);
+    float *vertices = out_vertices.data() + out_vertices.size() - corners * 3;
+    float *uvs = out_uvs.data() + out_uvs.size() - corners * 2;
+    float *normals = out_normals.data() + out_normals.size() - corners * 3;
+    auto corner = [&](size_t i, const glm::vec3 &vertex, const glm::vec2 &uv, const glm::vec3 &normal){
+        vertices[i * 3] = vertex.x; vertices[i * 3 + 1] = vertex.y; vertices[i * 3 + 2] = vertex.z;
+        uvs[i * 2] = uv.x; uvs[i * 2 + 1] = uv.y;
+        normals[i * 3] = normal.x; normals[i * 3 + 1] = normal.y; normals[i * 3 + 2] = normal.z;
+    };
+    if (cached) objloader::forEachCorner(cache, corner);
+    else objloader::forEachCorner(data, corner, threads);
+    return true;
+}
+
+
+
+bool loadOBJ(
+        const char * path,
+        std::vector<glm::vec3> & out_vertices,
+        std::vector<glm::vec2> & out_uvs,
+        std::vector<glm::vec3> & out_normals,
+        unsigned int threads = 1 // 0 = one per core, see objloader::parseOBJ
+){
+    printf("Loading OBJ file %s...\n", path);
+
+    // the cache of an earlier run is read instead of the file, or written once the file is parsed
+    meshcache::MeshCache cache;
+    objloader::ObjData data;
+    bool cached = objloader::openOBJCache(path, cache);
+    if (!cached) {
+        objloader::MappedFile file;
+        if( !file.open(path) ){
+            printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+            getchar();
+            return false;
+        }
+        if (!objloader::parseOBJ(file.begin(), file.end(), data, threads)){
+            printf("File can't be read by our simple parser :-( %s\n", data.error.c_str());
+            return false;
+        }
+        if (meshcache::enabled()) objloader::writeOBJCache(path, data);
+    }
+
+    // the corners are written in place, so that they can be filled in parallel
+    size_t corners = cached ? cache.mesh(0).index_count : data.corners.size() / 3;
+    out_vertices.resize(out_vertices.size() + corners);
+    out_uvs.resize(out_uvs.size() + corners);
+    out_normals.resize(out_normals.size() + corners);
+    glm::vec3 *vertices = out_vertices.data() + out_vertices.size() - corners;
+    glm::vec2 *uvs = out_uvs.data() + out_uvs.size() - corners;
+    glm::vec3 *normals = out_normals.data() + out_normals.size() - corners;
+    auto corner = [&](size_t i, const glm::vec3 &vertex, const glm::vec2 &uv, const glm::vec3 &normal){
+        vertices[i] = vertex;
+        uvs[i] = uv;
+        normals[i] = normal;
+    };
+    if (cached) objloader::forEachCorner(cache, corner);
+    else objloader::forEachCorner(data, corner, threads);
+    return true;
+}
+
+
+
+// same as above, but each distinct combination of position, uv and normal is a single vertex, and out_indices has the
+// vertex of each triangle corner (three per triangle), for glDrawElements
+bool loadOBJ(
+        const char * path,
+        std::vector<glm::vec3> & out_vertices,
+        std::vector<glm::vec2> & out_uvs,
+        std::vector<glm::vec3> & out_normals,
+        std::vector<unsigned int> & out_indices,
+        unsigned int threads = 1 // 0 = one per core, see objloader::parseOBJ
+){
+    printf("Loading OBJ file %s...\n", path);
+
+    // the indices count from the vertices already in the output
+    unsigned int base = (unsigned int) out_vertices.size();
+
+    // the cache of an earlier run has the vertices and indices as they are made below
+    meshcache::MeshCache cache;
+    if (objloader::openOBJCache(path, cache)) {
+        size_t count = cache.mesh(0).vertex_count;
+        const glm::vec3 *positions = (const glm::vec3 *) cache.stream(0, meshcache::Attribute::Position);
+        const glm::vec2 *uvs = (const glm::vec2 *) cache.stream(0, meshcache::Attribute::TexCoord);
+        const glm::vec3 *normals = (const glm::vec3 *) cache.stream(0, meshcache::Attribute::Normal);
+        out_vertices.insert(out_vertices.end(), positions, positions + count);
+        out_uvs     .insert(out_uvs.end(), uvs, uvs + count);
+        out_normals .insert(out_normals.end(), normals, normals + count);
+        const unsigned int *indices = cache.indices(0);
+        out_indices.reserve(out_indices.size() + cache.mesh(0).index_count);
+        for (size_t i = 0; i < cache.mesh(0).index_count; i++) out_indices.push_back(base + indices[i]);
+        return true;
+    }
+
+    objloader::MappedFile file;
+    if( !file.open(path) ){
+        printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+        getchar();
+        return false;
+    }
+    objloader::ObjData data;
+    if (!objloader::parseOBJ(file.begin(), file.end(), data, threads)){
+        printf("File can't be read by our simple parser :-( %s\n", data.error.c_str());
+        return false;
+    }
+
+    std::vector<unsigned int> indices;
+    objloader::indexCorners(data, indices, [&](const glm::vec3 &vertex, const glm::vec2 &uv, const glm::vec3 &normal){
+        out_vertices.push_back(vertex);
+        out_uvs     .push_back(uv);
+        out_normals .push_back(normal);
+    });
+    out_indices.reserve(out_indices.size() + indices.size());
+    for (unsigned int index : indices) out_indices.push_back(base + index);
+
+    size_t count = out_vertices.size() - base;
+    if (meshcache::enabled())
+        objloader::writeOBJCache(path, out_vertices.data() + base, out_uvs.data() + out_uvs.size() - count,
+                                 out_normals.data() + out_normals.size() - count, count, indices.data(), indices.size());
+    return true;
+}
+
+
+#endif //GRAPHICSPROGRAMMINGEXERCISES_OBJLOADER_H
@@ -0,0 +1,226 @@
+//
+// Scenes rendered by the headless renderer and its benchmarks.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_SCENES_H
+#define ITU_GRAPHICS_PROGRAMMING_SCENES_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+#include "rt_types.h"
+#include "rt_instances.h"
+#include "rt_mapped_mesh.h"
+#include "primitives.h"
+#include "objloader.h"
+
+struct Scene {
+    std::string name;
+    std::vector<rt::vertex> vts;
+    // the object comes first in vts, the room after it
+    size_t objectVertices = 0;
+    // set for instanced scenes, which are traced with Renderer::setInstances and leave vts empty.
+    // instance 0 is the room, the others are the objects
+    std::shared_ptr<rt::InstancedScene> instances;
+    // set for scenes read from a file written by MappedMesh::write, traced with Renderer::setMappedMesh (vts is empty)
+    std::shared_ptr<rt::MappedMesh> mapped;
+    // default camera, the same one exercise_11_sol starts with
+    glm::vec3 cameraPos = glm::vec3(0.9f, 0.0f, 1.5f);
+    glm::vec3 cameraTarget = glm::vec3(0.9f, 0.0f, 0.5f);
+};
+
+// the room used by all scenes: a grey cube seen from the inside, the same one exercise_11_sol renders
+void addRoom(std::vector<rt::vertex> &vts){
+    std::vector<glm::vec3> points, normals;
+    std::vector<glm::vec4> colors;
+    std::vector<glm::vec2> uvs;
+    Primitives::makeCube(2.f, points, normals, uvs, colors);
+
+    glm::mat4 outsideout = glm::scale(glm::vec3(-2.f,-2.f,-2.f));
+    for (unsigned int i = 0; i < points.size(); i++){
+        rt::vertex v{outsideout * glm::vec4(points[i], 1.0f),
+                     glm::vec4(normals[i], 0),
+                     rt::grey,
+                     uvs[i]
+        };
+        vts.push_back(v);
+    }
+}
+
+// the room as a mesh for instancing, placed with a scale of 2. The room of addRoom is scaled by -2, which mirrors the
+// positions but not the baked normals; a transform with a negative scale would also flip the normals, so the normals
+// are reversed here instead, which makes the same room
+std::vector<rt::vertex> makeRoomMesh(){
+    std::vector<glm::vec3> points, normals;
+    std::vector<glm::vec4> colors;
+    std::vector<glm::vec2> uvs;
+    Primitives::makeCube(2.f, points, normals, uvs, colors);
+
+    std::vector<rt::vertex> vts;
+    for (unsigned int i = 0; i < points.size(); i++)
+        vts.push_back(rt::vertex{glm::vec4(points[i], 1.0f), glm::vec4(-normals[i], 0), rt::grey, uvs[i]});
+    return vts;
+}
+
+// the cube-in-cube scene of exercise_11_sol
+Scene makeCubeScene(){
+    Scene scene;
+    scene.name = "cube";
+
+    std::vector<glm::vec3> points, normals;
+    std::vector<glm::vec4> colors;
+    std::vector<glm::vec2> uvs;
+    Primitives::makeCube(2.f, points, normals, uvs, colors);
+
+    glm::mat4 scale = glm::scale(glm::vec3(.25f,.25f,.25f));
+    for (unsigned int i = 0; i < points.size(); i++){
+        rt::vertex v{scale * glm::vec4(points[i], 1.0f),
+                     glm::vec4(normals[i], 0),
+                     colors[i],
+                     uvs[i]
+        };
+        scene.vts.push_back(v);
+    }
+    scene.objectVertices = scene.vts.size();
+    addRoom(scene.vts);
+    return scene;
+}
+
+// an OBJ model, scaled to fit in the same space as the cube of the cube scene (a box of size .5 around the origin).
+// returns false if the file can't be loaded
+bool loadMesh(const std::string &path, std::vector<rt::vertex> &vts){
+    // loadOBJ waits for a key press when the file doesn't exist, which would block a benchmark run
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == NULL) return false;
+    fclose(file);
+
+    std::vector<glm::vec3> points, normals;
+    std::vector<glm::vec2> uvs;
+    if (!loadOBJ(path.c_str(), points, uvs, normals, 0) || points.empty()) return false;
+
+    glm::vec3 minP(FLT_MAX), maxP(-FLT_MAX);
+    for (const glm::vec3 &p : points){
+        minP = glm::min(minP, p);
+        maxP = glm::max(maxP, p);
+    }
+    glm::vec3 extent = maxP - minP;
+    float largest = glm::max(glm::max(extent.x, extent.y), glm::max(extent.z, 1e-6f));
+    glm::mat4 fit = glm::scale(glm::vec3(.5f / largest)) * glm::translate(-(minP + maxP) * .5f);
+
+    vts.clear();
+    for (unsigned int i = 0; i < points.size(); i++){
+        rt::vertex v{fit * glm::vec4(points[i], 1.0f),
+                     glm::vec4(normals[i], 0),
+                     glm::vec4(.8f, .6f, .3f, 1),
+                     uvs[i]
+        };
+        vts.push_back(v);
+    }
+    return true;
+}
+
+// an OBJ model inside the room
+bool makeMeshScene(const std::string &path, Scene &scene){
+    if (!loadMesh(path, scene.vts)) return false;
+    scene.name = path;
+    scene.objectVertices = scene.vts.size();
+    addRoom(scene.vts);
+    return true;
+}
+
+// copies of an object (the cube of the cube scene, or an OBJ model) on a 10 x 10 x 8 grid that fills the room in front
+// of the default camera, each copy half the size of the original and turned by a different angle. The objects and the
+// room are instances, so the meshes are stored once however many copies there are.
+bool makeGridScene(const std::string &object, Scene &scene){
+    std::vector<rt::vertex> objectVts;
+    if (object == "cube") {
+        Scene cube = makeCubeScene();
+        objectVts.assign(cube.vts.begin(), cube.vts.begin() + cube.objectVertices);
+    }
+    else if (!loadMesh(object, objectVts)) return false;
+
+    std::shared_ptr<const rt::MeshBVH> room = std::make_shared<rt::MeshBVH>(makeRoomMesh());
+    std::shared_ptr<const rt::MeshBVH> mesh = std::make_shared<rt::MeshBVH>(std::move(objectVts));
+
+    scene.name = "grid:" + object;
+    scene.vts.clear();
+    scene.instances = std::make_shared<rt::InstancedScene>();
+    scene.instances->add(room, glm::scale(glm::vec3(2.f)));
+    for (int z = 0; z < 8; z++)
+        for (int y = 0; y < 10; y++)
+            for (int x = 0; x < 10; x++){
+                glm::vec3 position(-1.6f + x * .35f, -1.6f + y * .35f, -1.8f + z * .3f);
+                float angle = glm::radians(float((x * 7 + y * 13 + z * 29) % 90));
+                scene.instances->add(mesh, glm::translate(position) * glm::rotate(angle, glm::vec3(0, 1, 0)) *
+                                           glm::scale(glm::vec3(.5f)));
+            }
+    scene.instances->build();
+    return true;
+}
+
+// bakes the instances of scene into its vertex list (positions and normals transformed), and drops the instances.
+// the flat scene renders the same image, for comparing memory use and speed with the instanced one
+void flattenScene(Scene &scene){
+    if (!scene.instances) return;
+    scene.vts.clear();
+    // the objects first and the room (instance 0) last, as in the other scenes
+    for (unsigned int n = 1; n <= scene.instances->size(); n++){
+        if (n == scene.instances->size()) scene.objectVertices = scene.vts.size();
+        const rt::Instance &instance = scene.instances->instance(n % scene.instances->size());
+        for (rt::vertex v : instance.mesh->vertices()){
+            v.pos = instance.transform * v.pos;
+            v.norm = glm::vec4(instance.normal_matrix * glm::vec3(v.norm), 0);
+            scene.vts.push_back(v);
+        }
+    }
+    scene.name += " (flat)";
+    scene.instances.reset();
+}
+
+// twists the object of scene (not the room) around the vertical axis through its center, by an angle that grows
+// with the height and with time, and moves it sideways. rest holds the vertices of the scene before any deformation
+void deformScene(Scene &scene, const std::vector<rt::vertex> &rest, float time){
+    for (size_t i = 0; i < scene.objectVertices; i++){
+        const rt::vertex &v = rest[i];
+        glm::mat4 twist = glm::translate(glm::vec3(.3f * glm::sin(time * .5f), 0, 0)) *
+                          glm::rotate(time * (v.pos.y + .25f) * 2.f, glm::vec3(0, 1, 0));
+        scene.vts[i].pos = twist * v.pos;
+        scene.vts[i].norm = twist * v.norm; // normals of a twist are not just rotated, but close enough to shade
+    }
+}
+
+// a scene written with --convert, read from its memory mapped file
+bool makeMappedScene(const std::string &path, Scene &scene){
+    scene.mapped = std::make_shared<rt::MappedMesh>();
+    if (!scene.mapped->open(path)) return false;
+    scene.name = "mapped:" + path;
+    return true;
+}
+
+// the fixed set of scenes measured by --bench, models are copied next to the executable by cmake
+const std::vector<std::string> benchmarkScenes = {
+        "cube",
+        "grid:cube",
+        "grid:car/Body_LOD0.obj",
+        "car/Body_LOD0.obj",
+        "car/Paint_LOD0.obj",
+        "car/Interior_LOD0.obj",
+        "car/Wheel_LOD0.obj"
+};
+
+bool makeScene(const std::string &name, Scene &scene){
+    if (name == "cube"){
+        scene = makeCubeScene();
+        return true;
+    }
+    if (name.compare(0, 5, "grid:") == 0)
+        return makeGridScene(name.substr(5), scene);
+    if (name.compare(0, 7, "mapped:") == 0)
+        return makeMappedScene(name.substr(7), scene);
+    return makeMeshScene(name, scene);
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_SCENES_H
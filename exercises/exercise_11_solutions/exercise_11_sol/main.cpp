@@ -4,10 +4,15 @@
 
 #include <vector>
 #include <chrono>
+#include <thread>
+#include <future>
 #include <string>
+#include <cstdlib>
+#include <iomanip>
 #include <glm/gtx/transform.hpp>
 #include "rt_renderer.h"
 #include "primitives.h"
+#include "pixel_buffer_ring.h"
 
 #include "camera.h"
 
@@ -16,9 +21,12 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void button_input_callback(GLFWwindow* window, int button, int action, int mods);
 void cursor_input_callback(GLFWwindow* window, double posX, double posY);
 void processInput(GLFWwindow* window);
+void printTileStats();
 
-// rasterization grid resolution
-const int max_W = 64, max_H = 64;
+// rasterization grid resolution, the default is small enough for a debug build to trace in real time. Pass a larger
+// one on the command line (e.g. exercise_11_sol 800 800) to see the pixel buffer ring overlap the trace of a frame
+// with the upload of the previous one
+int max_W = 64, max_H = 64;
 
 // window resolution
 const unsigned int SCR_WIDTH = 800;
@@ -29,11 +37,28 @@ rt::Renderer renderer;
 
 float deltaTime = 0;
 unsigned int rtDepth = 2;
-
-int main()
+// accumulate jittered samples while the camera doesn't move
+bool progressive = false;
+// trace breadth first (renderWavefront) instead of one recursive path per pixel
+bool wavefront = false;
+// only trace what changed since the previous frame (renderIncremental)
+bool incremental = true;
+
+int main(int argc, char *argv[])
 {
     using namespace std;
 
+    if (argc == 3) {
+        max_W = atoi(argv[1]);
+        max_H = atoi(argv[2]);
+    }
+    if ((argc != 1 && argc != 3) || max_W <= 0 || max_H <= 0 || max_W > 8192 || max_H > 8192) {
+        std::cout << "usage: " << argv[0] << " [width height]   resolution of the traced image (default 64 64, "
+                  << "at most 8192 8192)" << std::endl;
+        return -1;
+    }
+    std::cout << "Tracing " << max_W << "x" << max_H << " pixels" << std::endl;
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -100,12 +125,25 @@ int main()
         vts.push_back(v);
     }
 
+    // build the acceleration structure once, it is reused by every ray in every frame
+    // ------------------------------------------------------------------------------
+    renderer.setIntersectionKernel(rt::IntersectionKernel::Auto);
+    std::cout << "Triangle intersection kernel: " << rt::simd::name(renderer.intersectionKernel()) << std::endl;
+    renderer.buildAccelerationStructure(vts);
+    const rt::BVHBuildReport &bvhReport = renderer.accelerationStructureReport();
+    std::cout << "BVH: " << bvhReport.triangles << " triangles, " << bvhReport.nodes << " nodes, "
+              << bvhReport.leaves << " leaves, depth " << bvhReport.max_depth << ", SAH cost " << bvhReport.sah_cost
+              << ", built in " << bvhReport.build_ms << " ms" << std::endl;
+    std::cout << "Triangle store: " << renderer.triangleStoreBytes() / 1024.0f << " KB (vertex list: "
+              << vts.size() * sizeof(rt::vertex) / 1024.0f << " KB)" << std::endl;
+
+    // trace the frame in tiles, using one thread per core
+    renderer.setThreadCount(0);
+    renderer.setTileSize(8);
+    std::cout << "Rendering with " << renderer.threadCount() << " threads" << std::endl;
 
 
-    // initialize our custom frame buffer
-    // ----------------------------------
-    // every frame we will: draw to it, upload it to a texture, and copy the texture to the window frame buffer.
-    FrameBuffer<uint32_t> customBuffer(max_W, max_H);
+    rt::AccumulationBuffer accumulation(max_W, max_H);
 
 
     // initialize texture we will use to upload our buffer to GPU
@@ -120,6 +158,16 @@ int main()
     // set texture filtering parameters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // allocate the texture once, frames are copied into it with glTexSubImage2D
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, max_W, max_H, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    // initialize our custom frame buffers
+    // -----------------------------------
+    // every frame we will: draw to one of them, upload it to the texture, and copy the texture to the window frame buffer.
+    // there are three of them, so that the tracer draws frame N+1 while frame N is transferred to the GPU
+    PixelBufferRing pixelBuffers(max_W, max_H, 3);
+    std::cout << "Frame upload: " << (pixelBuffers.persistentMapping() ? "persistently mapped" : "mapped")
+              << " pixel buffer objects" << std::endl;
 
     // initialize openGL frame buffer object
     // ------------------------------------
@@ -139,6 +187,17 @@ int main()
     std::cout << "3 - two reflections" << std::endl;
     std::cout << "4 - three reflections" << std::endl;
     std::cout << "5 - four reflections" << std::endl;
+    std::cout << "T - print the time spent in each tile of the last frame" << std::endl;
+    std::cout << "B - toggle breadth first (wavefront) tracing" << std::endl;
+    std::cout << "I - toggle incremental rendering (reuse the previous frame when the camera moves, skip still frames)" << std::endl;
+    std::cout << "P - toggle progressive rendering (anti-aliasing that refines while the camera is still)" << std::endl;
+    std::cout << "N - toggle the denoiser (not applied to incremental frames)" << std::endl;
+
+    // the frame traced in the background while the previous one is uploaded and shown, returns false if the
+    // frame buffer was left untouched because nothing changed
+    std::future<bool> nextFrame;
+    float traceMs = 0, uploadMs = 0;
+    std::string frameInfo;
 
     while (!glfwWindowShouldClose(window))
     {
@@ -146,23 +205,51 @@ int main()
         auto frameStart = std::chrono::high_resolution_clock::now();
         std::chrono::duration<float> appTime = frameStart - begin;
 
-        processInput(window);
+        // wait for the frame traced during the previous iteration, and start its transfer to the GPU
+        // ---------------------------------------------------------------------------------------
+        if (nextFrame.valid()) {
+            bool frameChanged = nextFrame.get();
+            traceMs = renderer.lastTraceTime();
+            frameInfo.clear();
+            if (incremental && !progressive && !wavefront)
+                frameInfo = " - traced " + std::to_string(renderer.incrementalStats().traced) + " px";
+            if (progressive)
+                frameInfo = " - pass " + std::to_string(accumulation.passes()) + ", converged " +
+                            std::to_string(accumulation.convergedCount() * 100 / (max_W * max_H)) + "%";
+            if (frameChanged) {
+                auto uploadStart = std::chrono::high_resolution_clock::now();
+                pixelBuffers.upload(bufferTexture);
+                uploadMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - uploadStart).count();
+            }
+        }
 
-        // render to our custom frame buffer
-        // ---------------------------------
-        customBuffer.clearBuffer(rt::Colors::toRGBA32(rt::Colors::black));
+        // the renderer is idle here, so input can change its settings
+        processInput(window);
 
+        // render the next frame to one of our custom frame buffers, in the background
+        // ---------------------------------------------------------------------------
         glm::mat4 scale = glm::scale(glm::vec3(.5f,.5f,.5f));
 
-        renderer.render(vts, glm::mat4(1), camera.GetViewMatrix(), 70.0f, rtDepth, customBuffer);
+        FrameBuffer<uint32_t> &customBuffer = pixelBuffers.acquire();
+        // every render method writes all the pixels, except renderIncremental when nothing changed, and then the
+        // buffer is not uploaded
+        glm::mat4 view = camera.GetViewMatrix();
+        unsigned int depth = rtDepth;
+        bool progressiveFrame = progressive, wavefrontFrame = wavefront, incrementalFrame = incremental;
+        nextFrame = std::async(std::launch::async, [&, view, depth, progressiveFrame, wavefrontFrame, incrementalFrame]{
+            if (progressiveFrame)
+                renderer.renderProgressive(vts, glm::mat4(1), view, 70.0f, depth, accumulation, customBuffer);
+            else if (wavefrontFrame)
+                renderer.renderWavefront(vts, glm::mat4(1), view, 70.0f, depth, customBuffer);
+            else if (incrementalFrame)
+                return renderer.renderIncremental(vts, glm::mat4(1), view, 70.0f, depth, customBuffer) != rt::FrameUpdate::Skipped;
+            else
+                renderer.render(vts, glm::mat4(1), view, 70.0f, depth, customBuffer);
+            return true;
+        });
 
         // show our rendered image
         // -----------------------
-        // upload the custom color buffer to the GPU using the texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, bufferTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, max_W, max_H, 0, GL_RGBA, GL_UNSIGNED_BYTE, customBuffer.buffer);
-
         // set opengl frame buffer object to read from our texture, we will copy from it
         glBindFramebuffer(GL_READ_FRAMEBUFFER, oglFrameBuffer);
         glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bufferTexture, 0);
@@ -179,14 +266,17 @@ int main()
         glfwSwapBuffers(window);
         glfwPollEvents();
 
-        // control render loop frequency (busy wait)
+        // control render loop frequency, sleeping instead of spinning so that still frames cost (almost) no cpu
         std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now()-frameStart;
-        while (loopInterval > elapsed.count()) {
-            elapsed = std::chrono::high_resolution_clock::now() - frameStart;
-        }
+        if (loopInterval > elapsed.count())
+            std::this_thread::sleep_for(std::chrono::duration<float>(loopInterval - elapsed.count()));
+        elapsed = std::chrono::high_resolution_clock::now() - frameStart;
         deltaTime = elapsed.count();
-        glfwSetWindowTitle(window, ("Exercise 11 - FPS: " + std::to_string(int(1.0f/deltaTime + .5f))).c_str());
+        std::string title = "Exercise 11 - FPS: " + std::to_string(int(1.0f/deltaTime + .5f)) +
+                            " - trace: " + std::to_string(traceMs) + " ms - upload: " + std::to_string(uploadMs) + " ms";
+        glfwSetWindowTitle(window, title.c_str());
     }
+    if (nextFrame.valid()) nextFrame.get();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
@@ -236,6 +326,35 @@ void processInput(GLFWwindow *window) {
     if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS) rtDepth = 4;
     if (glfwGetKey(window, GLFW_KEY_5) == GLFW_PRESS) rtDepth = 5;
 
+    static bool tKeyDown = false;
+    bool tKeyPressed = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+    if (tKeyPressed && !tKeyDown) printTileStats();
+    tKeyDown = tKeyPressed;
+
+    static bool pKeyDown = false;
+    bool pKeyPressed = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (pKeyPressed && !pKeyDown) progressive = !progressive;
+    pKeyDown = pKeyPressed;
+
+    static bool bKeyDown = false;
+    bool bKeyPressed = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+    if (bKeyPressed && !bKeyDown) wavefront = !wavefront;
+    bKeyDown = bKeyPressed;
+
+    static bool nKeyDown = false;
+    bool nKeyPressed = glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS;
+    if (nKeyPressed && !nKeyDown) {
+        rt::DenoiseSettings denoise = renderer.denoiseSettings();
+        denoise.enabled = !denoise.enabled;
+        renderer.setDenoiseSettings(denoise);
+    }
+    nKeyDown = nKeyPressed;
+
+    static bool iKeyDown = false;
+    bool iKeyPressed = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+    if (iKeyPressed && !iKeyDown) incremental = !incremental;
+    iKeyDown = iKeyPressed;
+
     // movement commands
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.ProcessKeyboard(FORWARD, deltaTime);
@@ -249,6 +368,43 @@ void processInput(GLFWwindow *window) {
 }
 
 
+// prints the tile timings of the last frame as a grid (top row of the image first), followed by the time each
+// thread was busy and the ray counters of the frame. Tiles with many reflections stand out, and so does the imbalance
+// between threads
+void printTileStats(){
+    const std::vector<rt::TileStats> &tiles = renderer.tileStats();
+    if (tiles.empty()) return;
+
+    unsigned int tilesX = (max_W + renderer.tileSize() - 1) / renderer.tileSize();
+    unsigned int tilesY = (unsigned int) tiles.size() / tilesX;
+    std::vector<float> workerTime(renderer.threadCount(), 0);
+
+    std::cout << "tile times (ms):" << std::endl << std::fixed << std::setprecision(2);
+    for (int ty = tilesY - 1; ty >= 0; ty--){
+        for (unsigned int tx = 0; tx < tilesX; tx++)
+            std::cout << std::setw(7) << tiles[ty * tilesX + tx].ms;
+        std::cout << std::endl;
+    }
+    for (const rt::TileStats &tile : tiles) workerTime[tile.worker] += tile.ms;
+
+    float busiest = 0, total = 0;
+    std::cout << "thread busy times (ms):";
+    for (float t : workerTime){
+        std::cout << " " << t;
+        busiest = std::max(busiest, t);
+        total += t;
+    }
+    std::cout << std::endl << "imbalance (busiest / average): " << busiest / (total / workerTime.size()) << std::endl;
+
+    const rt::RayCounters &rays = renderer.frameRays();
+    double rayCount = std::max<double>(rays.total(), 1);
+    std::cout << "rays: " << rays.primary << " primary, " << rays.shadow << " shadow, " << rays.secondary
+              << " secondary, hit rate " << 100.0 * rays.hitRate() << "%" << std::endl
+              << "per ray: " << rays.nodes_visited / rayCount << " bvh nodes, " << rays.triangle_tests / rayCount
+              << " triangle tests" << std::endl;
+    std::cout.unsetf(std::ios_base::floatfield);
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
@@ -0,0 +1,130 @@
+//
+// Ring of frame buffers backed by OpenGL pixel buffer objects (PBOs), to upload the frames of the CPU tracer without
+// stalling it.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_PIXEL_BUFFER_RING_H
+#define ITU_GRAPHICS_PROGRAMMING_PIXEL_BUFFER_RING_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include "frame_buffer.h"
+
+// the context is OpenGL 3.3, buffer storage (persistent mapping) is core in 4.4 and comes from ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// glTexImage2D from client memory makes the driver copy the whole frame before returning, and the copy can't start
+// before the frame is finished. Instead, each frame of the ring has its own PBO: the frame is written to (or copied
+// into) the PBO, and glTexSubImage2D from a bound PBO only queues the transfer, which the GPU does asynchronously while
+// the tracer renders the next frame into the next buffer of the ring. A fence per PBO tells when the GPU is done
+// reading it, so the buffer can be written again (with 3 buffers that is practically never a wait).
+// when the driver supports ARB_buffer_storage the PBOs are mapped once (persistent and coherent mapping) and the
+// frame buffers point straight into them, so the tracer writes pixels into memory the GPU reads from, with no copy.
+// otherwise frames are rendered in regular memory and copied into an unsynchronized mapping of the PBO
+class PixelBufferRing {
+public:
+    PixelBufferRing(unsigned int width, unsigned int height, unsigned int count = 3)
+            : W(width), H(height), pbos(count), fences(count, nullptr) {
+        size = GLsizeiptr(W) * H * sizeof(uint32_t);
+        glGenBuffers(count, pbos.data());
+
+        typedef void (APIENTRY *BufferStorageFunction)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+        BufferStorageFunction bufferStorage = nullptr;
+        if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+            bufferStorage = (BufferStorageFunction) glfwGetProcAddress("glBufferStorage");
+
+        const GLbitfield persistent_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        for (unsigned int i = 0; i < count; i++){
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+            void *mapped = nullptr;
+            if (bufferStorage) {
+                bufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, persistent_flags);
+                mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, persistent_flags);
+            }
+            else
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+
+            // a buffer that can't be mapped persistently is still mapped for each upload
+            persistent.push_back(mapped != nullptr);
+            if (mapped) frames.emplace_back(new FrameBuffer<uint32_t>(W, H, (uint32_t *) mapped));
+            else frames.emplace_back(new FrameBuffer<uint32_t>(W, H));
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    ~PixelBufferRing(){
+        for (GLsync fence : fences)
+            if (fence) glDeleteSync(fence);
+        frames.clear();
+        for (unsigned int i = 0; i < pbos.size(); i++){
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+            if (persistent[i]) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers((GLsizei) pbos.size(), pbos.data());
+    }
+
+    PixelBufferRing(PixelBufferRing const&) = delete;
+    void operator=(PixelBufferRing const&) = delete;
+
+    // true if the frame buffers are persistently mapped PBOs (no copy on upload)
+    bool persistentMapping() const { return persistent[0]; }
+
+    // moves to the next buffer of the ring and returns it, once the GPU is done reading it. It can be written by any
+    // thread until it is uploaded, the other OpenGL calls must happen in the thread of the context
+    FrameBuffer<uint32_t> &acquire(){
+        current = (current + 1) % frames.size();
+        waitForGPU(current);
+        return *frames[current];
+    }
+
+    // starts the transfer of the buffer returned by the last acquire to texture (GL_RGBA8, W x H), and returns without
+    // waiting for it. The texture must have been allocated (e.g. with glTexImage2D and a null pointer)
+    void upload(GLuint texture){
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[current]);
+        if (!persistent[current]) {
+            // the fence waited for in acquire guarantees the GPU is no longer reading this PBO
+            void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            if (mapped) {
+                memcpy(mapped, frames[current]->buffer, size);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        // with a PBO bound, the last argument is an offset in the PBO instead of a pointer
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, W, H, GL_RGBA, GL_UNSIGNED_BYTE, (const void *) 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    unsigned int W, H;
+    GLsizeiptr size;
+    std::vector<GLuint> pbos;
+    std::vector<GLsync> fences;
+    std::vector<std::unique_ptr<FrameBuffer<uint32_t>>> frames;
+    unsigned int current = 0;
+    std::vector<bool> persistent;
+
+    void waitForGPU(unsigned int i){
+        if (!fences[i]) return;
+        // flush in case the fence was not submitted yet, then wait (1 ms at a time) until the transfer is done
+        GLenum status = glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        while (status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(fences[i], 0, 1000000);
+        glDeleteSync(fences[i]);
+        fences[i] = nullptr;
+    }
+};
+
+#endif //ITU_GRAPHICS_PROGRAMMING_PIXEL_BUFFER_RING_H
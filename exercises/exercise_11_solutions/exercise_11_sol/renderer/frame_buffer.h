@@ -5,6 +5,7 @@
 #ifndef ITU_GRAPHICS_PROGRAMMING_FRAME_BUFFER_H
 #define ITU_GRAPHICS_PROGRAMMING_FRAME_BUFFER_H
 
+#include <cassert>
 
 template<class T>
 class FrameBuffer {
@@ -16,7 +17,13 @@ public:
         buffer = new T[W * H];
     }
 
-    ~FrameBuffer() { delete[] buffer; } // clean our memory
+    // uses memory owned by someone else (e.g. a mapped pixel buffer object), which must hold W * H values
+    FrameBuffer(unsigned int width, unsigned int height, T *external) : W(width), H(height), buffer(external), owner(false) {}
+
+    ~FrameBuffer() { if (owner) delete[] buffer; } // clean our memory
+
+    FrameBuffer(FrameBuffer const&) = delete;
+    void operator=(FrameBuffer const&) = delete;
 
     void clearBuffer(T value) {
         int size = W * H;
@@ -34,6 +41,8 @@ public:
         return buffer[x + y * W];
     }
 
+private:
+    bool owner = true;
 };
 
 
@@ -0,0 +1,113 @@
+//
+// Per pixel sample accumulation for progressive rendering.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_ACCUMULATION_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_ACCUMULATION_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+
+namespace rt{
+
+    // running sum of the samples traced through each pixel, and of their luminance and squared luminance, so that
+    // the variance of the pixel estimate is known without storing the samples.
+    // a pixel stops receiving samples once the standard error of its luminance falls under tolerance (after at least
+    // min_samples), or when it reaches max_samples
+    class AccumulationBuffer{
+    public:
+        unsigned int min_samples = 4;
+        unsigned int max_samples = 256;
+        // standard error of the pixel luminance that counts as converged, in [0, 1] color units (~half an 8 bit step)
+        float tolerance = 0.002f;
+
+        AccumulationBuffer(unsigned int w = 0, unsigned int h = 0) { resize(w, h); }
+
+        void resize(unsigned int w, unsigned int h){
+            W = w; H = h;
+            sum.assign(W * H, glm::vec4(0));
+            lum_sum.assign(W * H, 0.0);
+            lum_sq_sum.assign(W * H, 0.0);
+            samples.assign(W * H, 0);
+            done.assign(W * H, 0);
+            pass = 0;
+            converged_count = 0;
+        }
+
+        // drops all the samples, e.g. after the camera moved
+        void reset() { resize(W, H); }
+
+        unsigned int width() const { return W; }
+        unsigned int height() const { return H; }
+        // number of passes accumulated since the last reset
+        unsigned int passes() const { return pass; }
+        unsigned int sampleCount(unsigned int x, unsigned int y) const { return samples[x + y * W]; }
+        bool converged(unsigned int x, unsigned int y) const { return done[x + y * W] != 0; }
+        unsigned int convergedCount() const { return converged_count; }
+        bool allConverged() const { return converged_count == W * H; }
+
+        // adds one sample to pixel (x, y), and marks it as converged if its estimate is good enough.
+        // each pixel must only be written by one thread at a time
+        void addSample(unsigned int x, unsigned int y, const Colors::color &c){
+            unsigned int i = x + y * W;
+            double lum = luminance(c);
+            sum[i] += c;
+            lum_sum[i] += lum;
+            lum_sq_sum[i] += lum * lum;
+            unsigned int n = ++samples[i];
+
+            if (n >= max_samples) done[i] = 1;
+            else if (n >= min_samples) {
+                double mean = lum_sum[i] / n;
+                double variance = std::max(lum_sq_sum[i] / n - mean * mean, 0.0) * n / (n - 1);
+                // standard error of the mean, it shrinks with 1/sqrt(n)
+                if (std::sqrt(variance / n) < tolerance) done[i] = 1;
+            }
+        }
+
+        // the average of the samples of pixel (x, y)
+        Colors::color average(unsigned int x, unsigned int y) const {
+            unsigned int i = x + y * W;
+            return samples[i] > 0 ? sum[i] / float(samples[i]) : Colors::color(0);
+        }
+
+        // called once all the samples of a pass have been added
+        void endPass(){
+            pass++;
+            converged_count = 0;
+            for (unsigned char d : done) converged_count += d;
+        }
+
+        static double luminance(const Colors::color &c) { return 0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b; }
+
+    private:
+        unsigned int W = 0, H = 0;
+        std::vector<glm::vec4> sum;
+        // luminance statistics are kept in double, float sums of squares lose the variance after a few hundred samples
+        std::vector<double> lum_sum, lum_sq_sum;
+        std::vector<unsigned int> samples;
+        std::vector<unsigned char> done;
+        unsigned int pass = 0;
+        unsigned int converged_count = 0;
+    };
+
+    // small stateless random numbers, so that every pixel and sample gets its own independent sequence no matter
+    // which thread traces it (and frames are reproducible)
+    inline uint32_t hashPCG(uint32_t v){
+        uint32_t state = v * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    // uniform float in [0, 1)
+    inline float randomFloat(uint32_t &seed){
+        seed = hashPCG(seed);
+        return float(seed >> 8) * (1.0f / 16777216.0f);
+    }
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_ACCUMULATION_H
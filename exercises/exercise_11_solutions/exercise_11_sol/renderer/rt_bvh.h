@@ -0,0 +1,398 @@
+//
+// Bounding volume hierarchy (BVH) used to accelerate ray/model intersection queries.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_BVH_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_BVH_H
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <chrono>
+#include <cfloat>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+
+namespace rt{
+
+    // axis aligned bounding box
+    struct AABB{
+        glm::vec3 min = glm::vec3(FLT_MAX);
+        glm::vec3 max = glm::vec3(-FLT_MAX);
+
+        void grow(const glm::vec3 &p) { min = glm::min(min, p); max = glm::max(max, p); }
+        void grow(const AABB &b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+        bool valid() const { return min.x <= max.x; }
+
+        // half of the surface area, the constant factor cancels out in the SAH
+        float area() const {
+            if (!valid()) return 0;
+            glm::vec3 e = max - min;
+            return e.x * e.y + e.y * e.z + e.z * e.x;
+        }
+
+        // slab test, returns the entry distance or FLT_MAX if the box is missed (or farther than t_max)
+        float intersect(const glm::vec3 &origin, const glm::vec3 &inv_dir, float t_max) const {
+            glm::vec3 t0 = (min - origin) * inv_dir;
+            glm::vec3 t1 = (max - origin) * inv_dir;
+            glm::vec3 t_near = glm::min(t0, t1);
+            glm::vec3 t_far = glm::max(t0, t1);
+            float t_enter = glm::max(glm::max(t_near.x, t_near.y), glm::max(t_near.z, 0.0f));
+            float t_exit = glm::min(glm::min(t_far.x, t_far.y), glm::min(t_far.z, t_max));
+            return t_enter <= t_exit ? t_enter : FLT_MAX;
+        }
+    };
+
+    // 32 bytes, two nodes per cache line
+    struct BVHNode{
+        AABB bounds;
+        unsigned int left_first; // index of the left child (inner node) or of the first triangle (leaf)
+        unsigned int count;      // number of triangles in the leaf, 0 for inner nodes
+        bool isLeaf() const { return count > 0; }
+    };
+
+    // summary of the last build, used to see where the time goes
+    struct BVHBuildReport{
+        unsigned int triangles = 0;
+        unsigned int nodes = 0;
+        unsigned int leaves = 0;
+        unsigned int max_depth = 0;
+        float sah_cost = 0;
+        float build_ms = 0;
+    };
+
+    // binary BVH built with the surface area heuristic (SAH), evaluated over a fixed number of bins per axis.
+    // triangles are referenced by index (first vertex / 3) into the vertex list the BVH was built from, so the
+    // vertex list itself is never reordered
+    class BVH{
+    public:
+        static const unsigned int bin_count = 16;
+        static const unsigned int stack_size = 64;
+
+        // leaves with at most this many triangles are kept whenever the SAH doesn't find a cheaper split
+        unsigned int max_leaf_size = 4;
+        // number of triangles tested at once in a leaf, the SAH charges one intersection_cost per group
+        unsigned int leaf_packet_width = 1;
+
+        // relative costs used by the SAH, a node traversal is cheaper than a triangle test
+        float traversal_cost = 1.0f;
+        float intersection_cost = 1.5f;
+
+        // the leaves of the mesh bvhs, whatever the intersection kernel: up to 8 triangles (an AVX2 packet, or two SSE
+        // ones), costed per group of 4. All the kernels trace the same tree, so they find the same hits
+        void useKernelLeaves(){
+            max_leaf_size = 8;
+            leaf_packet_width = 4;
+        }
+
+        // bounds of each triangle of vts
+        static std::vector<AABB> triangleBounds(const std::vector<vertex> &vts){
+            unsigned int tri_count = (unsigned int) vts.size() / 3;
+            std::vector<AABB> bounds(tri_count);
+            for (unsigned int i = 0; i < tri_count; i++){
+                bounds[i].grow(glm::vec3(vts[i * 3].pos));
+                bounds[i].grow(glm::vec3(vts[i * 3 + 1].pos));
+                bounds[i].grow(glm::vec3(vts[i * 3 + 2].pos));
+            }
+            return bounds;
+        }
+
+        void build(const std::vector<vertex> &vts){
+            auto start = std::chrono::high_resolution_clock::now();
+
+            build(triangleBounds(vts));
+
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            report.build_ms = elapsed.count();
+        }
+
+        // builds the hierarchy over any kind of primitive given by its bounds (e.g. the instances of a scene),
+        // leaves reference primitives by their index in primitive_bounds. The report still calls them triangles
+        void build(std::vector<AABB> primitive_bounds){
+            auto start = std::chrono::high_resolution_clock::now();
+
+            unsigned int tri_count = (unsigned int) primitive_bounds.size();
+            nodes.clear();
+            tri_indices.resize(tri_count);
+            tri_bounds = std::move(primitive_bounds);
+            tri_centroids.resize(tri_count);
+            report = BVHBuildReport();
+            report.triangles = tri_count;
+
+            if (tri_count == 0) return;
+
+            for (unsigned int i = 0; i < tri_count; i++){
+                tri_indices[i] = i;
+                tri_centroids[i] = (tri_bounds[i].min + tri_bounds[i].max) * 0.5f;
+            }
+
+            // a binary tree with at least one triangle per leaf has at most 2n - 1 nodes
+            nodes.reserve(tri_count * 2);
+            nodes.push_back(BVHNode());
+            nodes[0].left_first = 0;
+            nodes[0].count = tri_count;
+            updateBounds(0);
+            subdivide(0, 0);
+
+            report.nodes = (unsigned int) nodes.size();
+            report.sah_cost = sahCost();
+
+            // only needed during the build
+            tri_bounds = std::vector<AABB>();
+            tri_centroids = std::vector<glm::vec3>();
+
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            report.build_ms = elapsed.count();
+        }
+
+        // updates the bounds of every node after the triangles moved, keeping the tree as it is. vts must hold the same
+        // triangles as the vertex list the tree was built from. It is much cheaper than a build, but the tree gets
+        // worse as triangles move away from where they were at build time (sahCost() grows)
+        void refit(const std::vector<vertex> &vts){
+            if (nodes.empty()) return;
+            // children are always stored after their parent, so walking the nodes backwards visits the children of
+            // an inner node before the node itself
+            for (unsigned int n = (unsigned int) nodes.size(); n-- > 0;){
+                BVHNode &node = nodes[n];
+                node.bounds = AABB();
+                if (node.isLeaf()) {
+                    for (unsigned int i = node.left_first; i < node.left_first + node.count; i++){
+                        const vertex *p = &vts[tri_indices[i] * 3];
+                        node.bounds.grow(glm::vec3(p[0].pos));
+                        node.bounds.grow(glm::vec3(p[1].pos));
+                        node.bounds.grow(glm::vec3(p[2].pos));
+                    }
+                }
+                else {
+                    node.bounds.grow(nodes[node.left_first].bounds);
+                    node.bounds.grow(nodes[node.left_first + 1].bounds);
+                }
+            }
+        }
+
+        // same as above, for a tree built over primitive bounds
+        void refit(const std::vector<AABB> &primitive_bounds){
+            for (unsigned int n = (unsigned int) nodes.size(); n-- > 0;){
+                BVHNode &node = nodes[n];
+                node.bounds = AABB();
+                if (node.isLeaf()) {
+                    for (unsigned int i = node.left_first; i < node.left_first + node.count; i++)
+                        node.bounds.grow(primitive_bounds[tri_indices[i]]);
+                }
+                else {
+                    node.bounds.grow(nodes[node.left_first].bounds);
+                    node.bounds.grow(nodes[node.left_first + 1].bounds);
+                }
+            }
+        }
+
+        bool empty() const { return nodes.empty(); }
+        // bounds of everything in the hierarchy
+        AABB bounds() const { return nodes.empty() ? AABB() : nodes[0].bounds; }
+        // memory used by the nodes and the triangle indices
+        size_t bytes() const { return nodes.size() * sizeof(BVHNode) + tri_indices.size() * sizeof(unsigned int); }
+        unsigned int triangleCount() const { return (unsigned int) tri_indices.size(); }
+        const BVHBuildReport &buildReport() const { return report; }
+        const std::vector<BVHNode> &getNodes() const { return nodes; }
+        // leaves reference the range [left_first, left_first + count) of this array
+        const std::vector<unsigned int> &triangleIndices() const { return tri_indices; }
+
+        // expected cost of a random ray query, relative to the root area
+        float sahCost() const {
+            if (nodes.empty()) return 0;
+            float root_area = nodes[0].bounds.area();
+            if (root_area <= 0) return 0;
+            float cost = 0;
+            for (const BVHNode &node : nodes){
+                float p = node.bounds.area() / root_area;
+                cost += node.isLeaf() ? p * leafCost(node.count) : p * traversal_cost;
+            }
+            return cost;
+        }
+
+        // front to back traversal of the hierarchy.
+        // leaf_test(first, count, t_max) is called for each leaf the ray reaches before t_max, with the range of
+        // triangleIndices() contained in that leaf; it should shrink t_max when it finds a closer hit, and return
+        // true to stop the traversal right away (used by any-hit queries).
+        // nodes_visited, if given, is incremented for every node the traversal enters
+        template <typename LeafTest>
+        bool traverse(const Ray &ray, float t_max, LeafTest &&leaf_test, uint64_t *nodes_visited = nullptr) const {
+            if (nodes.empty()) return false;
+            return traverse(nodes.data(), ray, t_max, leaf_test, nodes_visited);
+        }
+
+        // same as above, over a tree stored elsewhere (e.g. in a memory mapped file) with the same layout: the root at
+        // nodes[0], and the children of an inner node at left_first and left_first + 1
+        template <typename LeafTest>
+        static bool traverse(const BVHNode *nodes, const Ray &ray, float t_max, LeafTest &&leaf_test,
+                             uint64_t *nodes_visited = nullptr) {
+            glm::vec3 inv_dir = 1.0f / ray.direction;
+            if (nodes[0].bounds.intersect(ray.origin, inv_dir, t_max) == FLT_MAX) return false;
+
+            // postponed nodes are stored with their entry distance, so they can be culled once t_max shrinks
+            unsigned int stack[stack_size];
+            float stack_dist[stack_size];
+            unsigned int stack_top = 0;
+            unsigned int current = 0;
+            // counted in a local, incrementing through the pointer would keep it in memory
+            uint64_t visited = 0;
+
+            while (true){
+                const BVHNode &node = nodes[current];
+                visited++;
+                if (node.isLeaf()){
+                    if (leaf_test(node.left_first, node.count, t_max)) {
+                        if (nodes_visited) *nodes_visited += visited;
+                        return true;
+                    }
+                }
+                else {
+                    unsigned int near_id = node.left_first, far_id = node.left_first + 1;
+                    float t_near = nodes[near_id].bounds.intersect(ray.origin, inv_dir, t_max);
+                    float t_far = nodes[far_id].bounds.intersect(ray.origin, inv_dir, t_max);
+                    if (t_far < t_near) { std::swap(t_near, t_far); std::swap(near_id, far_id); }
+
+                    if (t_near != FLT_MAX){
+                        // visit the closest child first, so that t_max shrinks as early as possible
+                        if (t_far != FLT_MAX) {
+                            stack[stack_top] = far_id;
+                            stack_dist[stack_top++] = t_far;
+                        }
+                        current = near_id;
+                        continue;
+                    }
+                }
+                // pop the next node that can still contain a closer hit
+                do {
+                    if (stack_top == 0) {
+                        if (nodes_visited) *nodes_visited += visited;
+                        return false;
+                    }
+                    stack_top--;
+                } while (stack_dist[stack_top] > t_max);
+                current = stack[stack_top];
+            }
+        }
+
+    private:
+        std::vector<BVHNode> nodes;
+        std::vector<unsigned int> tri_indices;
+        // per triangle data used only during the build
+        std::vector<AABB> tri_bounds;
+        std::vector<glm::vec3> tri_centroids;
+        BVHBuildReport report;
+
+        float leafCost(unsigned int count) const {
+            return intersection_cost * ((count + leaf_packet_width - 1) / leaf_packet_width);
+        }
+
+        void updateBounds(unsigned int node_id){
+            BVHNode &node = nodes[node_id];
+            node.bounds = AABB();
+            for (unsigned int i = 0; i < node.count; i++)
+                node.bounds.grow(tri_bounds[tri_indices[node.left_first + i]]);
+        }
+
+        void subdivide(unsigned int node_id, unsigned int depth){
+            report.max_depth = std::max(report.max_depth, depth);
+
+            unsigned int axis; float split_pos;
+            float split_cost = findBestSplit(nodes[node_id], axis, split_pos);
+            float leaf_cost = leafCost(nodes[node_id].count);
+
+            // the traversal stack is bounded, so very deep trees are forced into (large) leaves
+            if ((nodes[node_id].count <= max_leaf_size && split_cost >= leaf_cost) ||
+                split_cost == FLT_MAX || depth + 2 >= stack_size) {
+                report.leaves++;
+                return;
+            }
+
+            // partition the triangle indices in place
+            unsigned int first = nodes[node_id].left_first, count = nodes[node_id].count;
+            unsigned int i = first, j = first + count;
+            while (i < j){
+                if (tri_centroids[tri_indices[i]][axis] < split_pos) i++;
+                else std::swap(tri_indices[i], tri_indices[--j]);
+            }
+            unsigned int left_count = i - first;
+            if (left_count == 0 || left_count == count) {
+                report.leaves++;
+                return;
+            }
+
+            // children are allocated as a pair, the right child is always left_first + 1
+            unsigned int left_id = (unsigned int) nodes.size();
+            nodes.push_back(BVHNode());
+            nodes.push_back(BVHNode());
+            nodes[left_id].left_first = first;
+            nodes[left_id].count = left_count;
+            nodes[left_id + 1].left_first = i;
+            nodes[left_id + 1].count = count - left_count;
+            nodes[node_id].left_first = left_id;
+            nodes[node_id].count = 0;
+
+            updateBounds(left_id);
+            updateBounds(left_id + 1);
+            subdivide(left_id, depth + 1);
+            subdivide(left_id + 1, depth + 1);
+        }
+
+        // binned SAH, returns the cost of the best split (in units of the node area) or FLT_MAX if no split is possible
+        float findBestSplit(const BVHNode &node, unsigned int &best_axis, float &best_pos) const {
+            float best_cost = FLT_MAX;
+            float parent_area = node.bounds.area();
+            if (parent_area <= 0) return FLT_MAX;
+
+            for (unsigned int axis = 0; axis < 3; axis++){
+                // bins are placed over the centroid bounds, not the node bounds
+                float c_min = FLT_MAX, c_max = -FLT_MAX;
+                for (unsigned int i = 0; i < node.count; i++){
+                    float c = tri_centroids[tri_indices[node.left_first + i]][axis];
+                    c_min = std::min(c_min, c);
+                    c_max = std::max(c_max, c);
+                }
+                if (c_min == c_max) continue;
+
+                AABB bin_bounds[bin_count];
+                unsigned int bin_tris[bin_count] = {0};
+                float scale = bin_count / (c_max - c_min);
+                for (unsigned int i = 0; i < node.count; i++){
+                    unsigned int tri = tri_indices[node.left_first + i];
+                    unsigned int bin = std::min(bin_count - 1, (unsigned int) ((tri_centroids[tri][axis] - c_min) * scale));
+                    bin_tris[bin]++;
+                    bin_bounds[bin].grow(tri_bounds[tri]);
+                }
+
+                // sweep from both sides to get the area and triangle count at each side of the bin_count - 1 planes
+                float left_area[bin_count - 1], right_area[bin_count - 1];
+                unsigned int left_tris[bin_count - 1], right_tris[bin_count - 1];
+                AABB left_box, right_box;
+                unsigned int left_sum = 0, right_sum = 0;
+                for (unsigned int i = 0; i < bin_count - 1; i++){
+                    left_sum += bin_tris[i];
+                    left_tris[i] = left_sum;
+                    left_box.grow(bin_bounds[i]);
+                    left_area[i] = left_box.area();
+                    right_sum += bin_tris[bin_count - 1 - i];
+                    right_tris[bin_count - 2 - i] = right_sum;
+                    right_box.grow(bin_bounds[bin_count - 1 - i]);
+                    right_area[bin_count - 2 - i] = right_box.area();
+                }
+
+                for (unsigned int i = 0; i < bin_count - 1; i++){
+                    if (left_tris[i] == 0 || right_tris[i] == 0) continue;
+                    float cost = traversal_cost +
+                            (leafCost(left_tris[i]) * left_area[i] + leafCost(right_tris[i]) * right_area[i]) / parent_area;
+                    if (cost < best_cost){
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_pos = c_min + (i + 1) / scale;
+                    }
+                }
+            }
+            return best_cost;
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_BVH_H
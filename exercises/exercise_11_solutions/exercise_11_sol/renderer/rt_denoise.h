@@ -0,0 +1,87 @@
+//
+// Edge avoiding a-trous filter for the frames of the tracer, guided by the normal, depth and albedo of the surface
+// seen through each pixel.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_DENOISE_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_DENOISE_H
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+
+namespace rt{
+
+    struct DenoiseSettings{
+        bool enabled = false;
+        // passes of the 5x5 filter, the distance between its taps doubles every pass (3 passes cover 29x29 pixels)
+        unsigned int iterations = 3;
+        // a tap weighs exp(-1) less (on top of its B3 spline weight) when it differs from the center pixel by sigma.
+        // the color term keeps shadow edges, highlights and reflections, which the other guides don't see
+        float sigma_color = 0.2f;   // color distance, halved after every pass so the later (wider) passes blur less
+        float sigma_normal = 0.3f;  // distance between the unit normals
+        float sigma_depth = 0.002f; // depth difference relative to the depth of the center pixel, per pixel of distance
+        float sigma_albedo = 0.1f;  // albedo distance, keeps the edges between colors of the same surface
+    };
+
+    // the surface the primary ray of a pixel hit, which guides the denoiser
+    struct AuxSample{
+        glm::vec3 normal = glm::vec3(0);
+        float depth = 0; // distance along the primary ray, 0 if it hit nothing
+        Colors::color albedo = Colors::color(0);
+    };
+
+    namespace denoise{
+
+        // B3 spline, the kernel of the a-trous wavelet transform
+        const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+        // one pass of the filter over row y of a W x H frame, with the taps step pixels apart. Pixels that hit nothing
+        // are left as they are, and never used as taps of the others
+        inline void filterRow(const Colors::color *src, Colors::color *dst, const AuxSample *aux,
+                              unsigned int W, unsigned int H, unsigned int y, unsigned int step, float sigma_color,
+                              const DenoiseSettings &settings){
+            // the weight of a tap is exp(-sum of (distance / sigma)^2), one exp per tap. The depth term is not squared
+            const float color_scale = 1.0f / (sigma_color * sigma_color);
+            const float normal_scale = 1.0f / (settings.sigma_normal * settings.sigma_normal);
+            const float albedo_scale = 1.0f / (settings.sigma_albedo * settings.sigma_albedo);
+            for (unsigned int x = 0; x < W; x++){
+                unsigned int p = x + y * W;
+                const AuxSample &center = aux[p];
+                const Colors::color &c = src[p];
+                if (center.depth == 0) { dst[p] = c; continue; }
+
+                // the depth tolerance grows with the distance on screen, surfaces seen at an angle change depth
+                // steadily from one pixel to the next
+                const float depth_scale = 1.0f / (settings.sigma_depth * center.depth * float(step));
+                glm::vec3 sum(0);
+                float weight_sum = 0;
+                for (int dy = -2; dy <= 2; dy++){
+                    int ty = int(y) + dy * int(step);
+                    if (ty < 0 || ty >= int(H)) continue;
+                    for (int dx = -2; dx <= 2; dx++){
+                        int tx = int(x) + dx * int(step);
+                        if (tx < 0 || tx >= int(W)) continue;
+                        unsigned int q = unsigned(tx) + unsigned(ty) * W;
+                        const AuxSample &tap = aux[q];
+                        if (tap.depth == 0) continue;
+
+                        glm::vec3 dc = glm::vec3(src[q]) - glm::vec3(c);
+                        glm::vec3 dn = tap.normal - center.normal;
+                        glm::vec3 da = glm::vec3(tap.albedo) - glm::vec3(center.albedo);
+                        float distance = glm::dot(dc, dc) * color_scale + glm::dot(dn, dn) * normal_scale +
+                                         std::abs(tap.depth - center.depth) * depth_scale +
+                                         glm::dot(da, da) * albedo_scale;
+                        float w = kernel[dx + 2] * kernel[dy + 2] * std::exp(-distance);
+                        sum += w * glm::vec3(src[q]);
+                        weight_sum += w;
+                    }
+                }
+                // the center tap always has a weight, so weight_sum > 0
+                dst[p] = Colors::color(sum / weight_sum, c.a);
+            }
+        }
+    }
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_DENOISE_H
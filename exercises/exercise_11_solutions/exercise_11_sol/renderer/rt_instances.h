@@ -0,0 +1,131 @@
+//
+// Two level acceleration structure: a top level BVH over instances, each instance a transform of a shared mesh with its
+// own (bottom level) BVH.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_INSTANCES_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_INSTANCES_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_bvh.h"
+#include "rt_simd.h"
+#include "rt_triangle_store.h"
+
+namespace rt{
+
+    // a mesh in its own (object) space, with the BVH over its triangles. Built once, and shared by all the instances
+    // that use it, so a mesh used a hundred times is stored once
+    class MeshBVH{
+    public:
+        explicit MeshBVH(std::vector<vertex> vertices) : vts(std::move(vertices)) {
+            tree.useKernelLeaves();
+            tree.build(vts);
+            tris.build(vts, tree.triangleIndices());
+        }
+
+        const std::vector<vertex> &vertices() const { return vts; }
+        const BVH &bvh() const { return tree; }
+        const TriangleStore &triangles() const { return tris; }
+        // memory used by the vertices, the bvh and the triangle store
+        size_t bytes() const { return vts.size() * sizeof(vertex) + tree.bytes() + tris.bytes(); }
+
+    private:
+        std::vector<vertex> vts;
+        BVH tree;
+        TriangleStore tris;
+    };
+
+    struct Instance{
+        std::shared_ptr<const MeshBVH> mesh;
+        glm::mat4 transform;     // object space to model space
+        glm::mat4 inverse;       // model space to object space, rays are moved to object space with it
+        glm::mat3 normal_matrix; // inverse transpose of transform, for the normals
+        AABB bounds;             // bounds of the transformed mesh, in model space
+    };
+
+    // the top level of the two level structure: a BVH whose primitives are instances. Rays are transformed into the
+    // object space of each instance they reach, and traverse the BVH of its mesh from there. Moving an instance only
+    // needs a new top level (one primitive per instance), the meshes are never rebuilt
+    class InstancedScene{
+    public:
+        // returns the index of the new instance, which is also its Hit::instance_ID
+        unsigned int add(std::shared_ptr<const MeshBVH> mesh, const glm::mat4 &transform){
+            Instance instance;
+            instance.mesh = std::move(mesh);
+            instances.push_back(std::move(instance));
+            setTransform((unsigned int) instances.size() - 1, transform);
+            return (unsigned int) instances.size() - 1;
+        }
+
+        // call build() once all instances are placed
+        void setTransform(unsigned int i, const glm::mat4 &transform){
+            Instance &instance = instances[i];
+            instance.transform = transform;
+            instance.inverse = glm::inverse(transform);
+            instance.normal_matrix = glm::transpose(glm::mat3(instance.inverse));
+
+            // the box around the 8 transformed corners of the mesh bounds
+            AABB object = instance.mesh->bvh().bounds();
+            instance.bounds = AABB();
+            for (int corner = 0; corner < 8; corner++){
+                glm::vec3 p((corner & 1) ? object.max.x : object.min.x,
+                            (corner & 2) ? object.max.y : object.min.y,
+                            (corner & 4) ? object.max.z : object.min.z);
+                instance.bounds.grow(glm::vec3(transform * glm::vec4(p, 1)));
+            }
+        }
+
+        // builds the top level BVH, cheap enough to do every frame when instances move
+        void build(){
+            std::vector<AABB> bounds(instances.size());
+            for (unsigned int i = 0; i < instances.size(); i++) bounds[i] = instances[i].bounds;
+            top_level.max_leaf_size = 2;
+            top_level.build(std::move(bounds));
+            changes++;
+        }
+
+        // updates the top level after instances moved, without rebuilding it. Cheaper than build() for small motions,
+        // but the tree degrades as the instances move apart from where they were at the last build
+        void refit(){
+            std::vector<AABB> bounds(instances.size());
+            for (unsigned int i = 0; i < instances.size(); i++) bounds[i] = instances[i].bounds;
+            top_level.refit(bounds);
+            changes++;
+        }
+
+        unsigned int size() const { return (unsigned int) instances.size(); }
+        const Instance &instance(unsigned int i) const { return instances[i]; }
+        const BVH &topLevel() const { return top_level; }
+        // incremented by each build and refit, so that renderers can tell the scene changed
+        unsigned int version() const { return changes; }
+
+        // triangles in the scene, counting each instance
+        size_t triangleCount() const {
+            size_t count = 0;
+            for (const Instance &instance : instances) count += instance.mesh->bvh().triangleCount();
+            return count;
+        }
+
+        // memory used by the instances, the top level and the distinct meshes
+        size_t bytes() const {
+            size_t total = instances.size() * sizeof(Instance) + top_level.bytes();
+            std::vector<const MeshBVH *> meshes;
+            for (const Instance &instance : instances) meshes.push_back(instance.mesh.get());
+            std::sort(meshes.begin(), meshes.end());
+            meshes.erase(std::unique(meshes.begin(), meshes.end()), meshes.end());
+            for (const MeshBVH *mesh : meshes) total += mesh->bytes();
+            return total;
+        }
+
+    private:
+        std::vector<Instance> instances;
+        BVH top_level;
+        unsigned int changes = 0;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_INSTANCES_H
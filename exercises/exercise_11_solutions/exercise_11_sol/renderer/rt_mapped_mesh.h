@@ -0,0 +1,555 @@
+//
+// Out of core meshes: a file with the triangles and the BVH of a mesh, grouped in page aligned clusters, that the tracer
+// memory maps and reads from directly. Only the clusters rays reach are paged in.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_MAPPED_MESH_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_MAPPED_MESH_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_bvh.h"
+#include "rt_simd.h"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#endif
+
+namespace rt{
+
+    // file layout, all offsets in bytes from the start of the file:
+    //   header (one page)
+    //   top level nodes: the BVH above the clusters, a leaf is one cluster (left_first is its index, count is 1)
+    //   cluster table
+    //   clusters, each one starting on a page: the nodes of its subtree (indices local to the cluster, leaves index
+    //     its triangles), then its triangles as 9 arrays (v0, e1 and e2, one component each) of stride floats
+    //   vertices, starting on a page: the 3 vertices of every triangle, in the order of the clusters, only read to shade
+    //     hits. Triangle i (counting over all the clusters) is made of the vertices 3 * i, 3 * i + 1 and 3 * i + 2
+    // the nodes and vertices are stored as they are in memory, so the files are only read on the platform they were
+    // written on (the header records the sizes it checks)
+    struct MappedMeshHeader{
+        static const uint32_t current_version = 1;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t vertex_size, node_size; // sizeof(vertex), sizeof(BVHNode) of the writer
+        uint32_t triangle_count;
+        uint32_t cluster_count;
+        uint32_t top_node_count;
+        uint32_t cluster_bytes;  // size the clusters were cut to
+        uint32_t reserved;
+        uint64_t top_nodes_offset;
+        uint64_t clusters_offset;
+        uint64_t vertices_offset;
+        uint64_t file_bytes;
+    };
+
+    struct MappedCluster{
+        uint64_t offset;         // of the cluster nodes, page aligned
+        uint32_t bytes;          // nodes and triangles
+        uint32_t node_count;
+        uint32_t first_triangle; // of the cluster, in the vertex section
+        uint32_t triangle_count;
+        uint32_t stride;         // floats in each triangle array, a multiple of 8 with room for a SIMD load past the end
+        uint32_t reserved;
+    };
+
+    // the triangles of one cluster, read straight from the mapping. Same accessors as TriangleStore, so the renderer
+    // tests them with the same leaf loops
+    struct ClusterTriangles{
+        const float *components = nullptr; // 9 arrays of stride floats
+        unsigned int stride = 0;
+        unsigned int first_triangle = 0;
+
+        unsigned int triangleID(unsigned int i) const { return first_triangle + i; }
+
+        glm::vec3 v0(unsigned int i) const { return component3(0, i); }
+        glm::vec3 e1(unsigned int i) const { return component3(3, i); }
+        glm::vec3 e2(unsigned int i) const { return component3(6, i); }
+
+        simd::TrianglePacket packet(unsigned int first) const {
+            const float *c = components + first;
+            return simd::TrianglePacket{{c, c + stride, c + 2 * stride},
+                                        {c + 3 * stride, c + 4 * stride, c + 5 * stride},
+                                        {c + 6 * stride, c + 7 * stride, c + 8 * stride}};
+        }
+
+    private:
+        glm::vec3 component3(unsigned int k, unsigned int i) const {
+            return glm::vec3(components[k * stride + i], components[(k + 1) * stride + i], components[(k + 2) * stride + i]);
+        }
+    };
+
+    struct MappedMeshWriteReport{
+        unsigned int triangles = 0;
+        unsigned int clusters = 0;
+        unsigned int top_nodes = 0;
+        uint64_t file_bytes = 0;
+        float build_ms = 0; // bvh
+        float write_ms = 0;
+    };
+
+    // paging of the clusters, see MappedMesh::stats
+    struct MappedMeshStats{
+        unsigned int clusters_touched = 0; // reached by a ray in the current frame
+        unsigned int clusters_loaded = 0;  // reached since they were last released
+        uint64_t loaded_bytes = 0;         // of the loaded clusters
+        uint64_t cached_bytes = 0;         // of the file in the page cache, the part of the mesh in memory
+        uint64_t prefetches = 0;           // cluster loads since the mesh was opened
+        uint64_t releases = 0;             // clusters dropped to stay within the resident budget
+    };
+
+    // counters of the whole process, zero where the platform doesn't have them
+    struct ProcessMemoryStats{
+        uint64_t minor_faults = 0;    // page faults served from memory (e.g. the page cache)
+        uint64_t major_faults = 0;    // page faults that waited for the disk
+        uint64_t read_bytes = 0;      // read from the disk (Linux /proc/self/io)
+        uint64_t resident_bytes = 0;  // current resident set
+        uint64_t peak_resident_bytes = 0;
+    };
+
+    class MappedMesh{
+    public:
+        static const uint64_t page_size = 4096; // of the file layout, a multiple of the page size of the system
+
+        MappedMesh() = default;
+        MappedMesh(const MappedMesh &) = delete;
+        MappedMesh &operator=(const MappedMesh &) = delete;
+        ~MappedMesh() { close(); }
+
+        // writes the triangles of vts to path, with a bvh cut in clusters of about cluster_bytes (a single leaf may be
+        // larger). Returns false if the file can't be written
+        static bool write(const std::string &path, const std::vector<vertex> &vts, unsigned int cluster_bytes = 64 * 1024,
+                          MappedMeshWriteReport *report = nullptr){
+            auto start = std::chrono::high_resolution_clock::now();
+            BVH bvh;
+            bvh.useKernelLeaves();
+            bvh.build(vts);
+            const std::vector<BVHNode> &nodes = bvh.getNodes();
+            const std::vector<unsigned int> &ids = bvh.triangleIndices();
+            if (nodes.empty()) return false;
+
+            // nodes and triangles below each node, children are stored after their parent
+            std::vector<unsigned int> subtree_nodes(nodes.size(), 1), subtree_first(nodes.size()), subtree_count(nodes.size());
+            for (size_t n = nodes.size(); n-- > 0;){
+                const BVHNode &node = nodes[n];
+                if (node.isLeaf()) { subtree_first[n] = node.left_first; subtree_count[n] = node.count; continue; }
+                subtree_nodes[n] += subtree_nodes[node.left_first] + subtree_nodes[node.left_first + 1];
+                subtree_first[n] = subtree_first[node.left_first]; // the left child has the first triangles
+                subtree_count[n] = subtree_count[node.left_first] + subtree_count[node.left_first + 1];
+            }
+            auto clusterBytes = [&](unsigned int n){
+                return uint64_t(subtree_nodes[n]) * sizeof(BVHNode) + 9 * sizeof(float) * uint64_t(stride(subtree_count[n]));
+            };
+
+            // the top level keeps the nodes above the largest subtrees that fit in a cluster
+            std::vector<BVHNode> top;
+            std::vector<unsigned int> cluster_roots;
+            copyTree(nodes, 0, top, [&](unsigned int n, BVHNode &copy){
+                if (!nodes[n].isLeaf() && clusterBytes(n) > cluster_bytes) return false;
+                copy.left_first = (unsigned int) cluster_roots.size();
+                copy.count = 1;
+                cluster_roots.push_back(n);
+                return true;
+            });
+
+            MappedMeshHeader header{};
+            memcpy(header.magic, "RTMESH", 6);
+            header.version = MappedMeshHeader::current_version;
+            header.vertex_size = sizeof(vertex);
+            header.node_size = sizeof(BVHNode);
+            header.triangle_count = (unsigned int) ids.size();
+            header.cluster_count = (unsigned int) cluster_roots.size();
+            header.top_node_count = (unsigned int) top.size();
+            header.cluster_bytes = cluster_bytes;
+            header.top_nodes_offset = page_size;
+            header.clusters_offset = header.top_nodes_offset + top.size() * sizeof(BVHNode);
+            std::vector<MappedCluster> clusters(cluster_roots.size());
+            uint64_t offset = pageAlign(header.clusters_offset + clusters.size() * sizeof(MappedCluster));
+            for (size_t c = 0; c < clusters.size(); c++){
+                unsigned int root = cluster_roots[c];
+                clusters[c].offset = offset;
+                clusters[c].bytes = (uint32_t) clusterBytes(root);
+                clusters[c].node_count = subtree_nodes[root];
+                clusters[c].first_triangle = subtree_first[root];
+                clusters[c].triangle_count = subtree_count[root];
+                clusters[c].stride = stride(subtree_count[root]);
+                offset = pageAlign(offset + clusters[c].bytes);
+            }
+            header.vertices_offset = offset;
+            header.file_bytes = offset + uint64_t(ids.size()) * 3 * sizeof(vertex);
+
+            std::ofstream file(path, std::ios::binary);
+            if (!file) return false;
+            auto padTo = [&](uint64_t position){
+                static const char zeros[page_size] = {};
+                uint64_t at = (uint64_t) file.tellp();
+                if (position > at) file.write(zeros, std::streamsize(position - at));
+            };
+            file.write((const char *) &header, sizeof(header));
+            padTo(header.top_nodes_offset);
+            file.write((const char *) top.data(), std::streamsize(top.size() * sizeof(BVHNode)));
+            file.write((const char *) clusters.data(), std::streamsize(clusters.size() * sizeof(MappedCluster)));
+
+            std::vector<BVHNode> local;
+            std::vector<float> components;
+            for (size_t c = 0; c < clusters.size(); c++){
+                const MappedCluster &cluster = clusters[c];
+                local.clear();
+                copyTree(nodes, cluster_roots[c], local, [&](unsigned int n, BVHNode &copy){
+                    if (!nodes[n].isLeaf()) return false;
+                    copy.left_first -= cluster.first_triangle;
+                    return true;
+                });
+                components.assign(9 * size_t(cluster.stride), 0.0f); // padding triangles have zero edges, never hit
+                for (unsigned int i = 0; i < cluster.triangle_count; i++){
+                    const vertex *p = &vts[ids[cluster.first_triangle + i] * 3];
+                    for (int k = 0; k < 3; k++){
+                        components[k * cluster.stride + i] = p[0].pos[k];
+                        components[(3 + k) * cluster.stride + i] = p[1].pos[k] - p[0].pos[k];
+                        components[(6 + k) * cluster.stride + i] = p[2].pos[k] - p[0].pos[k];
+                    }
+                }
+                padTo(cluster.offset);
+                file.write((const char *) local.data(), std::streamsize(local.size() * sizeof(BVHNode)));
+                file.write((const char *) components.data(), std::streamsize(components.size() * sizeof(float)));
+            }
+            padTo(header.vertices_offset);
+            for (unsigned int id : ids)
+                file.write((const char *) &vts[id * 3], 3 * sizeof(vertex));
+            file.close();
+            if (!file) return false;
+
+            if (report) {
+                report->triangles = header.triangle_count;
+                report->clusters = header.cluster_count;
+                report->top_nodes = header.top_node_count;
+                report->file_bytes = header.file_bytes;
+                report->build_ms = bvh.buildReport().build_ms;
+                std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+                report->write_ms = elapsed.count() - report->build_ms;
+            }
+            return true;
+        }
+
+        // maps the file at path, returns false if it can't be opened or wasn't written by MappedMesh::write on this
+        // platform. Nothing is read but the header, the top level and the cluster table, which are checked to stay
+        // inside the file (the nodes inside the clusters are not, that would read the whole file)
+        bool open(const std::string &path){
+            close();
+            if (!mapFile(path)) return false;
+            const MappedMeshHeader &h = *(const MappedMeshHeader *) data;
+            if (mapped_bytes < page_size || memcmp(h.magic, "RTMESH", 6) != 0 ||
+                h.version != MappedMeshHeader::current_version || h.vertex_size != sizeof(vertex) ||
+                h.node_size != sizeof(BVHNode) || h.file_bytes != mapped_bytes || h.top_node_count == 0) {
+                close();
+                return false;
+            }
+            header = h;
+            if (!validLayout()) {
+                close();
+                return false;
+            }
+            stamps.reset(new std::atomic<uint32_t>[header.cluster_count]);
+            for (unsigned int c = 0; c < header.cluster_count; c++) stamps[c].store(0, std::memory_order_relaxed);
+            frame = 1;
+            prefetches.store(0);
+            releases = 0;
+            return true;
+        }
+
+        void close(){
+#ifdef _WIN32
+            if (data) UnmapViewOfFile(data);
+            if (mapping) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+            mapping = nullptr;
+            file = INVALID_HANDLE_VALUE;
+#else
+            if (data) munmap((void *) data, mapped_bytes);
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+#endif
+            data = nullptr;
+            mapped_bytes = 0;
+            stamps.reset();
+        }
+
+        bool isOpen() const { return data != nullptr; }
+        unsigned int triangleCount() const { return header.triangle_count; }
+        unsigned int clusterCount() const { return header.cluster_count; }
+        unsigned int clusterBytes() const { return header.cluster_bytes; }
+        uint64_t fileBytes() const { return header.file_bytes; }
+
+        // the top level, traversed with BVH::traverse
+        const BVHNode *topNodes() const { return (const BVHNode *) (data + header.top_nodes_offset); }
+        // 3 per triangle, see MappedMeshHeader
+        const vertex *vertices() const { return (const vertex *) (data + header.vertices_offset); }
+
+        // the nodes of cluster c, and its triangles in tris. The first time in a frame that a cluster is reached, it is
+        // marked as touched; if it was not loaded, the whole cluster is prefetched, rather than letting each of its
+        // pages fault in on its own. Safe to call from several threads
+        const BVHNode *cluster(unsigned int c, ClusterTriangles &tris) const {
+            const MappedCluster &info = clusterInfo(c);
+            if (stamps[c].load(std::memory_order_relaxed) != frame && stamps[c].exchange(frame) == 0) prefetch(info);
+            tris.components = (const float *) (data + info.offset + info.node_count * sizeof(BVHNode));
+            tris.stride = info.stride;
+            tris.first_triangle = info.first_triangle;
+            return (const BVHNode *) (data + info.offset);
+        }
+
+        // a budget for the loaded clusters, in bytes (0 = no limit). Enforced by nextFrame
+        void setResidentBudget(uint64_t bytes) { resident_budget = bytes; }
+        uint64_t residentBudget() const { return resident_budget; }
+
+        // call between frames, while no ray is traced: starts counting the clusters of a new frame, and releases the
+        // clusters that were reached the longest time ago until the loaded ones fit in the resident budget
+        void nextFrame(){
+            if (resident_budget > 0) {
+                std::vector<std::pair<uint32_t, unsigned int>> loaded; // last frame reached, cluster
+                uint64_t loaded_bytes = 0;
+                for (unsigned int c = 0; c < header.cluster_count; c++){
+                    uint32_t stamp = stamps[c].load(std::memory_order_relaxed);
+                    if (stamp == 0) continue;
+                    loaded.push_back(std::make_pair(stamp, c));
+                    loaded_bytes += residentBytes(clusterInfo(c));
+                }
+                std::sort(loaded.begin(), loaded.end());
+                for (size_t i = 0; i < loaded.size() && loaded_bytes > resident_budget; i++){
+                    const MappedCluster &info = clusterInfo(loaded[i].second);
+                    release(info);
+                    stamps[loaded[i].second].store(0, std::memory_order_relaxed);
+                    loaded_bytes -= residentBytes(info);
+                    releases++;
+                }
+            }
+            if (++frame == 0) frame = 1; // 0 marks the clusters that are not loaded
+        }
+
+        MappedMeshStats stats() const {
+            MappedMeshStats s;
+            for (unsigned int c = 0; c < header.cluster_count; c++){
+                uint32_t stamp = stamps[c].load(std::memory_order_relaxed);
+                if (stamp == 0) continue;
+                s.clusters_touched += stamp == frame;
+                s.clusters_loaded++;
+                s.loaded_bytes += residentBytes(clusterInfo(c));
+            }
+            s.prefetches = prefetches.load();
+            s.releases = releases;
+#ifndef _WIN32
+            // pages of the file in the page cache, whether this process faulted them in or not
+#ifdef __APPLE__
+            std::vector<char> resident((mapped_bytes + systemPageSize() - 1) / systemPageSize());
+#else
+            std::vector<unsigned char> resident((mapped_bytes + systemPageSize() - 1) / systemPageSize());
+#endif
+            if (mincore((void *) data, mapped_bytes, resident.data()) == 0)
+                for (char page : resident) s.cached_bytes += (page & 1) * systemPageSize();
+#endif
+            return s;
+        }
+
+        static ProcessMemoryStats processStats(){
+            ProcessMemoryStats s;
+#ifdef _WIN32
+            // page faults and the peak working set need psapi, which this header doesn't link
+#else
+            struct rusage usage{};
+            if (getrusage(RUSAGE_SELF, &usage) == 0) {
+                s.minor_faults = (uint64_t) usage.ru_minflt;
+                s.major_faults = (uint64_t) usage.ru_majflt;
+#ifdef __APPLE__
+                s.peak_resident_bytes = (uint64_t) usage.ru_maxrss; // bytes on macOS, kilobytes on Linux
+#else
+                s.peak_resident_bytes = (uint64_t) usage.ru_maxrss * 1024;
+#endif
+            }
+            unsigned long long value = 0;
+            if (FILE *io = fopen("/proc/self/io", "r")) {
+                char line[128];
+                while (fgets(line, sizeof(line), io))
+                    if (sscanf(line, "read_bytes: %llu", &value) == 1) s.read_bytes = value;
+                fclose(io);
+            }
+            unsigned long long size, resident;
+            if (FILE *statm = fopen("/proc/self/statm", "r")) {
+                if (fscanf(statm, "%llu %llu", &size, &resident) == 2) s.resident_bytes = resident * systemPageSize();
+                fclose(statm);
+            }
+#endif
+            return s;
+        }
+
+    private:
+        MappedMeshHeader header{};
+        const char *data = nullptr;
+        uint64_t mapped_bytes = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#else
+        int fd = -1;
+#endif
+        // the last frame each cluster was reached in, 0 if it is not loaded
+        std::unique_ptr<std::atomic<uint32_t>[]> stamps;
+        uint32_t frame = 1;
+        uint64_t resident_budget = 0;
+        mutable std::atomic<uint64_t> prefetches{0};
+        uint64_t releases = 0;
+
+        static uint64_t pageAlign(uint64_t offset) { return (offset + page_size - 1) / page_size * page_size; }
+
+        // the triangle arrays of a cluster, a multiple of 8 floats (32 byte aligned arrays) with room for an 8 wide
+        // load starting at the last triangle
+        static unsigned int stride(unsigned int triangles) { return (triangles + 8 + 7) / 8 * 8; }
+
+        // copies the tree under root to out with each pair of children next to each other, as BVH::traverse expects.
+        // leaf(n, copy) decides whether node n becomes a leaf of the copy, and fills in the leaf
+        template <typename Leaf>
+        static void copyTree(const std::vector<BVHNode> &nodes, unsigned int root, std::vector<BVHNode> &out, Leaf &&leaf){
+            std::vector<std::pair<unsigned int, unsigned int>> stack{{root, (unsigned int) out.size()}}; // source, copy
+            out.push_back(nodes[root]);
+            while (!stack.empty()){
+                unsigned int n = stack.back().first, copy = stack.back().second;
+                stack.pop_back();
+                if (leaf(n, out[copy])) continue;
+                unsigned int left = nodes[n].left_first;
+                out[copy].left_first = (unsigned int) out.size();
+                out.push_back(nodes[left]);
+                out.push_back(nodes[left + 1]);
+                stack.push_back({left + 1, out[copy].left_first + 1});
+                stack.push_back({left, out[copy].left_first});
+            }
+        }
+
+        // whether size bytes at offset are inside the mapping, and offset is a multiple of alignment
+        bool inFile(uint64_t offset, uint64_t size, uint64_t alignment) const {
+            return offset % alignment == 0 && offset <= mapped_bytes && size <= mapped_bytes - offset;
+        }
+
+        // checks that the sections of the header, the top level nodes and the cluster table only point inside the
+        // file, so that a corrupted file fails to open instead of crashing the tracer
+        bool validLayout() const {
+            if (!inFile(header.top_nodes_offset, uint64_t(header.top_node_count) * sizeof(BVHNode), alignof(BVHNode)) ||
+                !inFile(header.clusters_offset, uint64_t(header.cluster_count) * sizeof(MappedCluster),
+                        alignof(MappedCluster)) ||
+                !inFile(header.vertices_offset, uint64_t(header.triangle_count) * 3 * sizeof(vertex), alignof(vertex)))
+                return false;
+            // children are stored after their parent, the leaves are clusters
+            const BVHNode *top = topNodes();
+            for (unsigned int n = 0; n < header.top_node_count; n++){
+                if (top[n].isLeaf() ? top[n].count != 1 || top[n].left_first >= header.cluster_count
+                                    : top[n].left_first <= n || top[n].left_first >= header.top_node_count - 1)
+                    return false;
+            }
+            for (unsigned int c = 0; c < header.cluster_count; c++){
+                const MappedCluster &info = clusterInfo(c);
+                if (info.node_count == 0 || info.stride != stride(info.triangle_count) ||
+                    info.bytes != uint64_t(info.node_count) * sizeof(BVHNode) + 9 * sizeof(float) * uint64_t(info.stride) ||
+                    !inFile(info.offset, info.bytes, page_size) ||
+                    uint64_t(info.first_triangle) + info.triangle_count > header.triangle_count)
+                    return false;
+            }
+            return true;
+        }
+
+        const MappedCluster &clusterInfo(unsigned int c) const {
+            return ((const MappedCluster *) (data + header.clusters_offset))[c];
+        }
+
+        // the cluster and the vertices of its triangles, which are only read by shading
+        uint64_t residentBytes(const MappedCluster &info) const {
+            return info.bytes + uint64_t(info.triangle_count) * 3 * sizeof(vertex);
+        }
+
+        static uint64_t systemPageSize(){
+#ifdef _WIN32
+            return page_size;
+#else
+            static const uint64_t size = (uint64_t) sysconf(_SC_PAGESIZE);
+            return size;
+#endif
+        }
+
+        bool mapFile(const std::string &path){
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                               FILE_FLAG_RANDOM_ACCESS, nullptr);
+            LARGE_INTEGER size;
+            if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart == 0) return false;
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!mapping) return false;
+            data = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            mapped_bytes = (uint64_t) size.QuadPart;
+            return data != nullptr;
+#else
+            fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st{};
+            if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) return false;
+            void *address = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (address == MAP_FAILED) return false;
+            data = (const char *) address;
+            mapped_bytes = (uint64_t) st.st_size;
+            // rays jump around the file, read ahead only what prefetch asks for
+            madvise(address, mapped_bytes, MADV_RANDOM);
+            return true;
+#endif
+        }
+
+        // the range of the file under [offset, offset + bytes), widened to whole pages
+        void pages(uint64_t offset, uint64_t bytes, uint64_t &first, uint64_t &length) const {
+            first = offset / systemPageSize() * systemPageSize();
+            length = std::min(offset + bytes, mapped_bytes) - first;
+        }
+
+        void prefetch(const MappedCluster &info) const {
+            prefetches++;
+#ifndef _WIN32
+            uint64_t first, length;
+            pages(info.offset, info.bytes, first, length);
+            madvise((void *) (data + first), length, MADV_WILLNEED);
+#endif
+        }
+
+        // drops the pages of the cluster and of its vertices from the process and from the page cache. Pages shared with
+        // a neighbouring cluster go too, and fault in again when it is reached
+        void release(const MappedCluster &info) const {
+#ifndef _WIN32
+            uint64_t ranges[2][2] = {{info.offset, info.bytes},
+                                     {header.vertices_offset + uint64_t(info.first_triangle) * 3 * sizeof(vertex),
+                                      uint64_t(info.triangle_count) * 3 * sizeof(vertex)}};
+            for (auto &range : ranges){
+                uint64_t first, length;
+                pages(range[0], range[1], first, length);
+                madvise((void *) (data + first), length, MADV_DONTNEED);
+#ifdef POSIX_FADV_DONTNEED
+                posix_fadvise(fd, (off_t) first, (off_t) length, POSIX_FADV_DONTNEED);
+#endif
+            }
+#else
+            (void) info; // the working set of a mapped view is trimmed by the system
+#endif
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_MAPPED_MESH_H
@@ -6,22 +6,508 @@
 #define ITU_GRAPHICS_PROGRAMMING_RT_RENDERER_H
 
 #include <vector>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include "rt_types.h"
+#include "rt_bvh.h"
+#include "rt_wide_bvh.h"
+#include "rt_thread_pool.h"
+#include "rt_simd.h"
+#include "rt_triangle_store.h"
+#include "rt_accumulation.h"
+#include "rt_instances.h"
+#include "rt_mapped_mesh.h"
+#include "rt_resolve.h"
+#include "rt_denoise.h"
 #include "frame_buffer.h"
 
 namespace rt{
     using namespace Colors;
     using namespace glm;
 
+    // number of rays traced, by kind, and the work done to trace them
+    struct RayCounters{
+        uint64_t primary = 0;   // one per pixel
+        uint64_t shadow = 0;    // towards the light
+        uint64_t secondary = 0; // reflections
+
+        uint64_t hits = 0;           // primary and secondary rays that hit a triangle
+        uint64_t occluded = 0;       // shadow rays blocked before the light
+        uint64_t nodes_visited = 0;  // bvh nodes entered, of both levels for instanced scenes
+        uint64_t triangle_tests = 0; // ray/triangle tests, a SIMD test counts the triangles of its packet
+
+        uint64_t total() const { return primary + shadow + secondary; }
+        // nodes and triangles, the cost measure of the pixel cost map
+        uint64_t work() const { return nodes_visited + triangle_tests; }
+        // fraction of the primary and secondary rays that hit something
+        double hitRate() const { return primary + secondary > 0 ? double(hits) / double(primary + secondary) : 0.0; }
+        RayCounters &operator+=(const RayCounters &other){
+            primary += other.primary; shadow += other.shadow; secondary += other.secondary;
+            hits += other.hits; occluded += other.occluded;
+            nodes_visited += other.nodes_visited; triangle_tests += other.triangle_tests;
+            return *this;
+        }
+    };
+
+    // timing of one tile of the last rendered frame
+    struct TileStats{
+        unsigned int x, y, w, h; // pixel rectangle covered by the tile
+        unsigned int worker;     // thread that rendered it
+        float ms;                // time spent tracing the tile
+        RayCounters rays;        // rays traced in the tile
+    };
+
+    // time spent in each stage of the last renderWavefront call, in milliseconds, summed over all bounces
+    struct WavefrontTimes{
+        float generate = 0; // primary rays
+        float extend = 0;   // closest hit of the rays in the queue
+        float shade = 0;    // local illumination of the hits, shadow and reflection rays
+        float shadow = 0;   // visibility of the light
+        float resolve = 0;  // combining the bounces of each pixel, and the resolve pass
+        float sort = 0;     // sorting the secondary rays and measuring their coherence, when enabled
+        float extend_secondary = 0; // the part of extend spent on the secondary rays
+    };
+
+    // how alike consecutive rays of a queue are, summed over the secondary queues of a frame. The closer the
+    // directions and origins of the rays traced one after the other, the more of the bvh they share in the cache
+    struct RayCoherence{
+        uint64_t pairs = 0;       // consecutive rays
+        uint64_t same_octant = 0; // pairs whose directions have the same signs
+        double cosine = 0;        // sum of the cosines between consecutive directions
+        double distance = 0;      // sum of the distances between consecutive origins, over the diagonal of the queue bounds
+
+        double sameOctant() const { return pairs ? double(same_octant) / pairs : 0; }
+        double meanCosine() const { return pairs ? cosine / pairs : 0; }
+        double meanDistance() const { return pairs ? distance / pairs : 0; }
+    };
+    // the secondary rays of the last renderWavefront call, in the order they were spawned and in the order they were traced
+    struct SecondaryRayStats{
+        RayCoherence spawned, traced;
+    };
+
+    // the rays from the camera through the image plane of a frame, in model space
+    struct PrimaryRays{
+        mat4 model_to_view;
+        // find the transformation that move points from camera space to model space
+        mat4 view_to_model;
+        // the bottom left corner of the image plane/camera sensor
+        vec4 lower_left_corner;
+        vec4 cam_pos;
+        // the distance from the center of one pixel to the next along the horizontal and vertical axes of the screen
+        vec2 pixel_size;
+        unsigned int width, height; // image size, in pixels
+
+        PrimaryRays(const mat4 &m, const mat4 &v, float fov_degrees, unsigned int W, unsigned int H) : width(W), height(H){
+            float aspect_ratio = float(W) / float(H);
+            // we use the fov and the tangent function to compute where is the bottom of the projection plane,
+            // we assume that the projection place is 1 unit in front of the camera (z == -1)
+            float bottom = - tan(abs(radians(fov_degrees)) * 0.5f);
+
+            model_to_view = v * m;
+            view_to_model = inverse(model_to_view);
+            lower_left_corner = vec4(bottom * aspect_ratio, bottom, -1, 1);
+            // we transform the camera position (also the convergence point of light rays) from camera coordinates to MODEL coordinates
+            // notice that we implicitly assume that the camera position is at 0,0,0 in its one coordinate space
+            cam_pos = view_to_model * vec4(0,0,0,1);
+            // notice that * and / are applied component wise
+            pixel_size = abs(vec2(lower_left_corner)) * 2.0f / vec2(W, H);
+        }
+
+        // the ray through the image position (x, y), in pixels. Integer positions are pixel corners, with (0, 0) at
+        // the bottom left corner of the image
+        Ray generate(float x, float y) const {
+            vec4 pixel_pos = lower_left_corner + vec4 (vec2(x, y) * pixel_size,0, 0);
+            pixel_pos = view_to_model * pixel_pos;  // transform from camera coord space to model coord space
+            return Ray(cam_pos, normalize(pixel_pos - cam_pos));
+        }
+
+        // the inverse of generate: the image position (in pixels) a point in model space projects to.
+        // returns false if the point is behind the camera
+        bool project(const vec3 &model_pos, vec2 &pixel) const {
+            vec4 view_pos = model_to_view * vec4(model_pos, 1);
+            if (view_pos.z >= 0) return false;
+            // the intersection with the image plane at z == -1
+            vec2 plane_pos = vec2(view_pos) / -view_pos.z;
+            pixel = (plane_pos - vec2(lower_left_corner)) / pixel_size;
+            return true;
+        }
+    };
+
+    // how renderIncremental produced the last frame
+    enum class FrameUpdate{
+        Skipped,     // nothing changed, the frame buffer still holds the previous frame
+        Reprojected, // the previous frame was reprojected to the new camera, only the holes were traced
+        Full         // every pixel was traced
+    };
+
+    // local illumination of the hits
+    enum class ShadingModel{
+        Phong,   // ambient, diffuse and specular terms, the model of the exercise
+        Diffuse, // ambient and diffuse, no specular highlight
+        Flat     // the interpolated color of the surface, no light (and so no shadow rays)
+    };
+
+    // what traceRay computes at each hit. The image doesn't depend on specialized: the generic traceRay checks the
+    // depth and the settings at every hit, the specialized kernels are compiled for each combination of depth,
+    // shadows and shading model, with the recursion unrolled and the unused terms left out
+    struct TraceSettings{
+        bool shadows = true; // without shadow rays, every hit sees the light
+        ShadingModel shading = ShadingModel::Phong;
+        bool specialized = true;
+    };
+
+    // node layout traversed for the vertex list of the render methods (the meshes of instanced scenes and mapped meshes
+    // are always binary)
+    enum class BVHFormat{
+        Binary, // BVH, 32 byte nodes with two children
+        Wide    // WideBVH collapsed from it, 64 byte nodes with four children and quantized bounds
+    };
+
+    // what the last call to refitAccelerationStructure did
+    struct RefitStats{
+        float refit_ms = 0;        // updating the bvh bounds and the triangle store
+        float sah_cost = 0;        // of the refit bvh
+        float sah_growth = 1;      // sah_cost relative to the cost of the bvh right after it was built
+        bool rebuilding = false;   // a rebuild is running in the background
+        unsigned int rebuilds = 0; // background rebuilds swapped in since the last buildAccelerationStructure
+    };
+
+    struct IncrementalStats{
+        FrameUpdate update = FrameUpdate::Full;
+        unsigned int reprojected = 0; // pixels reused from the previous frame
+        unsigned int traced = 0;      // pixels traced
+    };
+
     class Renderer{
         // limits the number of reflections, 1 == no reflection
         const unsigned int max_recursion = 5;
         // mixture parameter for combining local illumination and reflected color
         float p_rg = 0.4f;
 
+        // acceleration structure and the vertex list it was built from
+        BVH bvh;
+        TriangleStore triangles; // the triangles of bvh_vts in bvh leaf order
+        const std::vector<vertex> *bvh_vts = nullptr;
+        // collapsed from bvh after every build and refit, when the format is Wide
+        BVHFormat bvh_format = BVHFormat::Binary;
+        WideBVH wide_bvh;
+        // when set, rays are traced against the instances instead of a vertex list
+        const InstancedScene *instances = nullptr;
+        // same, for a mesh read from a memory mapped file
+        const MappedMesh *mapped_mesh = nullptr;
+        // duration of the last call to render, in milliseconds
+        float trace_ms = 0;
+
+        // kernel used to test the triangles in the bvh leaves
+        IntersectionKernel kernel = IntersectionKernel::Scalar;
+
+        TraceSettings trace_settings;
+        // the trace function of the current frame and the depth it traces to, chosen by beginTrace
+        typedef color (Renderer::*TraceKernel)(const Ray &, const std::vector<vertex> &, RayCounters &, Hit &, AuxSample *);
+        TraceKernel frame_kernel = &Renderer::traceGeneric;
+        unsigned int frame_depth = 1;
+
+        // the frame is split in square tiles of tile_size pixels, which are traced in parallel by the pool
+        unsigned int tile_size = 16;
+        std::unique_ptr<ThreadPool> pool{new ThreadPool(1)};
+        // the render methods trace linear colors into hdr_frame, and convert it to the 8 bit frame buffer at the end
+        // (the resolve pass), so that the conversion is not in the middle of the tracing loops
+        std::unique_ptr<FrameBuffer<color>> hdr_frame;
+        ResolveSettings resolve_settings, resolved_settings; // current ones, and the ones of the last resolve
+        float resolve_ms = 0;
+        // when enabled, the frame is denoised (into denoised_frame) before the resolve pass. The primary rays write
+        // what they hit to aux while denoising is enabled
+        DenoiseSettings denoise_settings;
+        std::vector<AuxSample> aux;
+        std::unique_ptr<FrameBuffer<color>> denoised_frame;
+        std::vector<color> denoise_scratch;
+        bool frame_denoised = false;
+        bool progressive_aux = false; // aux holds the first samples of the current progressive accumulation
+        float denoise_ms = 0;
+        std::vector<TileStats> tile_stats;
+        RayCounters frame_rays;
+        // work done for each pixel of the last frame, only recorded on demand
+        bool record_pixel_cost = false;
+        std::vector<uint32_t> pixel_cost;
+
+        // everything the image depends on, used to find out what changed since the previous frame
+        struct ViewState{
+            mat4 model_view;
+            float fov_degrees;
+            unsigned int depth;
+            unsigned int width, height;
+            const std::vector<vertex> *vts;
+            size_t vertex_count;
+            unsigned int scene_version;
+            const InstancedScene *instances;
+            unsigned int instances_version;
+            const MappedMesh *mapped_mesh;
+
+            // same scene and settings, only the camera may differ
+            bool sameScene(const ViewState &other) const {
+                return fov_degrees == other.fov_degrees && depth == other.depth && width == other.width &&
+                       height == other.height && vts == other.vts && vertex_count == other.vertex_count &&
+                       scene_version == other.scene_version && instances == other.instances &&
+                       instances_version == other.instances_version && mapped_mesh == other.mapped_mesh;
+            }
+            bool operator==(const ViewState &other) const {
+                return sameScene(other) && model_view == other.model_view;
+            }
+        };
+        ViewState viewState(const std::vector<vertex> &vts, const mat4 &m, const mat4 &v, float fov_degrees,
+                            unsigned int depth, unsigned int width, unsigned int height) const {
+            return ViewState{v * m, fov_degrees, depth, width, height, &vts, vts.size(), scene_version,
+                             instances, instances ? instances->version() : 0, mapped_mesh};
+        }
+
+        // the samples of renderProgressive are dropped when the view or the accumulation buffer changes
+        ViewState progressive_view{};
+        const AccumulationBuffer *progressive_acc = nullptr;
+        // incremented every time the acceleration structure is rebuilt
+        unsigned int scene_version = 0;
+
+        // the local illumination at a hit point. The ambient term is always there, the direct term (diffuse and
+        // specular) only if nothing blocks shadow_ray before it reaches the light
+        struct LocalShading{
+            color ambient;
+            color direct;
+            Ray shadow_ray;
+            float light_dist;
+            vec3 position;
+            vec3 normal;
+            color albedo;
+        };
+
+        // queues of renderWavefront, kept between frames to avoid reallocating them
+        struct WavefrontRay{
+            Ray ray;
+            unsigned int pixel;
+        };
+        struct WavefrontQueues{
+            std::vector<WavefrontRay> rays, next;   // rays of the current and the next bounce
+            std::vector<Hit> hits;                  // closest hit of each ray in rays
+            std::vector<LocalShading> shading;      // shading of each hit, and its shadow ray
+            std::vector<color> local;               // local illumination of each pixel at each bounce
+            std::vector<unsigned char> path_length; // number of surfaces hit by the path of each pixel
+            std::vector<uint64_t> sort_keys;        // sort key << 32 | index in rays
+        } wavefront;
+        WavefrontTimes wavefront_times;
+        SecondaryRayStats secondary_ray_stats;
+        bool sort_secondary_rays = false;
+        bool measure_ray_coherence = false;
+
+        // the last frame of renderIncremental, with the model space position of the primary hit of each pixel
+        struct ReprojectionCache{
+            enum : unsigned char { no_hit = 255 }; // age of pixels that can't be reprojected
+            ViewState view{};
+            bool valid = false;
+            bool complete = false; // every pixel was traced for the current view
+            std::vector<vec3> positions;
+            std::vector<color> colors;
+            std::vector<unsigned char> age; // number of frames since the pixel was traced
+            // the frame being reprojected
+            std::vector<vec3> next_positions;
+            std::vector<color> next_colors;
+            std::vector<unsigned char> next_age;
+            std::vector<float> next_dist;
+            std::vector<unsigned int> holes;
+        } reprojection;
+        IncrementalStats incremental_stats;
+        // reprojected pixels older than this are traced again, and frames with more holes than this fraction of
+        // their pixels are traced completely
+        unsigned int max_reprojection_age = 8;
+        float max_hole_fraction = 0.5f;
+
+        // refitAccelerationStructure starts a rebuild of the bvh in the background once the refit tree costs this many
+        // times more (SAH) than right after its build, 0 disables the rebuilds
+        float rebuild_threshold = 1.5f;
+        float built_sah_cost = 0;
+        std::future<BVH> rebuild;
+        RefitStats refit_stats;
+
     public:
+        // builds the BVH over vts, it is used by all the intersection queries made with the same vertex list.
+        // vts must outlive the renderer (or the next call to this method), and be rebuilt if it changes
+        void buildAccelerationStructure(const std::vector<vertex> &vts){
+            // a rebuild of the previous vertex list is of no use anymore
+            if (rebuild.valid()) rebuild.wait();
+            rebuild = std::future<BVH>();
+            refit_stats = RefitStats();
+
+            bvh.useKernelLeaves();
+            bvh.build(vts);
+            triangles.build(vts, bvh.triangleIndices());
+            buildWideBVH();
+            bvh_vts = &vts;
+            built_sah_cost = bvh.buildReport().sah_cost;
+            scene_version++;
+        }
+
+        // call when the vertices of vts moved (deforming or animated meshes), vts must hold the same triangles as
+        // the list the acceleration structure was built from. The bounds of the bvh are updated without changing its
+        // structure, which costs about as much as copying the triangles. When the motion made the tree too slow (see
+        // setRebuildThreshold) a new tree is built on another thread from the current positions, and replaces the
+        // refit one in a later call, once it is ready
+        void refitAccelerationStructure(const std::vector<vertex> &vts){
+            if (bvh.empty() || bvh.triangleCount() * 3 != vts.size()) {
+                buildAccelerationStructure(vts);
+                return;
+            }
+            auto start = std::chrono::high_resolution_clock::now();
+
+            if (rebuild.valid() && rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                // built from older positions, the refit below moves it to the current ones
+                bvh = rebuild.get();
+                built_sah_cost = bvh.buildReport().sah_cost;
+                refit_stats.rebuilds++;
+            }
+            bvh.refit(vts);
+            // same triangles in the same order, only the positions change
+            triangles.build(vts, bvh.triangleIndices());
+            buildWideBVH(); // collapsing again is about as cheap as refitting the wide nodes
+            bvh_vts = &vts;
+            scene_version++;
+
+            refit_stats.sah_cost = bvh.sahCost();
+            refit_stats.sah_growth = built_sah_cost > 0 ? refit_stats.sah_cost / built_sah_cost : 1;
+            if (rebuild_threshold > 0 && refit_stats.sah_growth > rebuild_threshold && !rebuild.valid()) {
+                // the build only needs the triangle bounds, vts may change while it runs
+                BVH settings;
+                settings.max_leaf_size = bvh.max_leaf_size;
+                settings.leaf_packet_width = bvh.leaf_packet_width;
+                rebuild = std::async(std::launch::async, [settings, bounds = BVH::triangleBounds(vts)]() mutable {
+                    BVH built = settings;
+                    built.build(std::move(bounds));
+                    return built;
+                });
+            }
+            refit_stats.rebuilding = rebuild.valid();
+
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            refit_stats.refit_ms = elapsed.count();
+        }
+
+        // SAH cost growth that triggers a background rebuild in refitAccelerationStructure, 0 to never rebuild
+        void setRebuildThreshold(float threshold) { rebuild_threshold = threshold; }
+        const RefitStats &refitStats() const { return refit_stats; }
+
+        // traces scene instead of the vertex list passed to the render methods (which can then be empty), until it is
+        // set back to nullptr. scene must be built, and outlive its use; rebuilding it (e.g. after moving instances)
+        // is picked up by the next frame
+        void setInstances(const InstancedScene *scene) { instances = scene; }
+        const InstancedScene *instancedScene() const { return instances; }
+
+        // traces mesh instead of the vertex list passed to the render methods, like setInstances. mesh must be open,
+        // and outlive its use. The instances take precedence when both are set
+        void setMappedMesh(const MappedMesh *mesh) { mapped_mesh = mesh; }
+        const MappedMesh *mappedMesh() const { return mapped_mesh; }
+
+        // the wide format is collapsed from the binary bvh (built as before), and used once it exists: right away if the
+        // acceleration structure is built, otherwise from the next build
+        void setBVHFormat(BVHFormat format){
+            bvh_format = format;
+            buildWideBVH();
+            scene_version++;
+        }
+        BVHFormat bvhFormat() const { return bvh_format; }
+
+        const BVHBuildReport &accelerationStructureReport() const { return bvh.buildReport(); }
+        // memory read by intersection tests, the vertex list itself is only read for shading
+        size_t triangleStoreBytes() const { return triangles.bytes(); }
+        size_t accelerationStructureBytes() const { return bvh.bytes() + wide_bvh.bytes(); }
+        // the nodes traversed in the current format
+        size_t bvhNodeBytes() const {
+            return useWideBVH() ? wide_bvh.bytes() : bvh.getNodes().size() * sizeof(BVHNode);
+        }
+        size_t bvhNodeCount() const { return useWideBVH() ? wide_bvh.nodeCount() : bvh.getNodes().size(); }
+        // duration of the last render call, including the resolve pass
+        float lastTraceTime() const { return trace_ms; }
+        float lastResolveTime() const { return resolve_ms; }
+
+        // exposure, tone mapping and encoding of the 8 bit frames, from the next frame on
+        void setResolveSettings(const ResolveSettings &settings) { resolve_settings = settings; }
+        const ResolveSettings &resolveSettings() const { return resolve_settings; }
+        // the linear colors of the last frame, before exposure and tone mapping (e.g. to save HDR images), denoised if
+        // it was. Null before the first frame
+        const FrameBuffer<color> *hdrFrame() const { return frame_denoised ? denoised_frame.get() : hdr_frame.get(); }
+        // the same, as traced (before denoising)
+        const FrameBuffer<color> *tracedFrame() const { return hdr_frame.get(); }
+
+        // denoising of the next frames, can be changed between any two frames. Frames of render, renderProgressive and
+        // renderWavefront are denoised, renderIncremental reuses pixels it has no aux samples for and never denoises.
+        // enabling it while renderProgressive accumulates starts the accumulation over, the aux samples come from the
+        // first pass
+        void setDenoiseSettings(const DenoiseSettings &settings) { denoise_settings = settings; }
+        const DenoiseSettings &denoiseSettings() const { return denoise_settings; }
+        // duration of the denoising of the last frame (included in lastTraceTime), 0 if it was not denoised
+        float lastDenoiseTime() const { return denoise_ms; }
+        // what the primary ray of each pixel hit in the last denoised frame, pixel (x, y) at x + y * width
+        const std::vector<AuxSample> &auxSamples() const { return aux; }
+
+        // converts the last frame to fb (of the same size) again with the current settings, e.g. to change the
+        // exposure of a still image without tracing it again. Rows are converted in parallel
+        void resolveFrame(FrameBuffer<uint32_t> &fb){
+            if (!hdr_frame || hdr_frame->W != fb.W || hdr_frame->H != fb.H) return;
+            auto start = std::chrono::high_resolution_clock::now();
+            const FrameBuffer<color> &hdr = *hdrFrame();
+            pool->parallelFor(fb.H, [&](unsigned int row, unsigned int){
+                resolve::resolveRow(hdr.buffer + row * fb.W, fb.buffer + row * fb.W, fb.W, resolve_settings);
+            });
+            resolved_settings = resolve_settings;
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            resolve_ms = elapsed.count();
+        }
+
+        // number of threads used by render, 0 means one per hardware core and 1 renders on the calling thread only
+        void setThreadCount(unsigned int thread_count){
+            if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+            if (thread_count != pool->size()) pool.reset(new ThreadPool(thread_count));
+        }
+        unsigned int threadCount() const { return pool->size(); }
+
+        // selects how triangles are tested against rays, kernels not supported by the cpu fall back to narrower
+        // ones (down to the scalar code). Only used when tracing with the bvh
+        // from the next frame on, the progressive and incremental frames start over
+        void setTraceSettings(const TraceSettings &settings){
+            trace_settings = settings;
+            scene_version++;
+        }
+        const TraceSettings &traceSettings() const { return trace_settings; }
+
+        void setIntersectionKernel(IntersectionKernel k) { kernel = simd::resolve(k); }
+        IntersectionKernel intersectionKernel() const { return kernel; }
+
+        void setTileSize(unsigned int size) { tile_size = size > 0 ? size : 1; }
+        unsigned int tileSize() const { return tile_size; }
+        // per tile timing of the last frame, in row-major tile order
+        const std::vector<TileStats> &tileStats() const { return tile_stats; }
+        // rays traced in the last frame
+        const RayCounters &frameRays() const { return frame_rays; }
+        // records the work done for each pixel (RayCounters::work, summed over all the rays of the pixel) in the next
+        // frames, to see where the time goes. It costs a bit of memory traffic per pixel, so it is off by default
+        void setPixelCostRecording(bool record) { record_pixel_cost = record; }
+        // the per pixel work of the last frame, pixel (x, y) at x + y * width (bottom row first, as FrameBuffer).
+        // empty unless recording; pixels that were not traced (reprojected, converged) have no cost
+        const std::vector<uint32_t> &pixelCost() const { return pixel_cost; }
+        const WavefrontTimes &wavefrontTimes() const { return wavefront_times; }
+        const SecondaryRayStats &secondaryRayStats() const { return secondary_ray_stats; }
+        // renderWavefront sorts the reflection rays of each bounce by direction octant, then by the Morton code of
+        // their origin, before intersecting them. The image is the same, each ray still adds to its own pixel
+        void setSecondaryRaySorting(bool enabled) { sort_secondary_rays = enabled; }
+        bool secondaryRaySorting() const { return sort_secondary_rays; }
+        // fills secondaryRayStats, which costs a pass over each queue (two when sorting)
+        void setRayCoherenceMeasurement(bool enabled) { measure_ray_coherence = enabled; }
+        // what the last call to renderIncremental did
+        const IncrementalStats &incrementalStats() const { return incremental_stats; }
+        void setReprojectionLimits(unsigned int max_age, float max_holes){
+            max_reprojection_age = std::min(max_age, 254u);
+            max_hole_fraction = max_holes;
+        }
+
         void render(const std::vector<vertex> &vts,
                     const glm::mat4 &m,
                     const glm::mat4 &v,
@@ -29,23 +515,11 @@ namespace rt{
                     unsigned int depth,
                     FrameBuffer <uint32_t> &fb) {
 
-            float aspect_ratio = fb.H / fb.W;
-            // we use the fov and the tangent function to compute where is the bottom of the projection plane,
-            // we assume that the projection place is 1 unit in front of the camera (z == -1)
-            float bottom = - tan(abs(radians(fov_degrees)) * 0.5f);
-
-            // find the transformation that move points from camera space to model space
-            mat4 view_to_model = inverse(v * m);
-            // the bottom left corner of the image plane/camera sensor
-            vec4 lower_left_corner = vec4(bottom * aspect_ratio, bottom, -1, 1);
-            // we transform the camera position (also the convergence point of light rays) from camera coordinates to MODEL coordinates
-            // notice that we implicitly assume that the camera position is at 0,0,0 in its one coordinate space
-            vec4 cam_pos = view_to_model * vec4(0,0,0,1);
-
-            // the distance from the center of one pixel to the next along the horizontal and vertical axes of the screen
-            // notice that * and / are applied component wise
-            vec2 pixel_size = abs(vec2(lower_left_corner)) * 2.0f / vec2(fb.H, fb.W);
+            auto start = std::chrono::high_resolution_clock::now();
+            FrameBuffer<color> &hdr = hdrTarget(fb.W, fb.H);
 
+            PrimaryRays camera(m, v, fov_degrees, fb.W, fb.H);
+            beginTrace(depth);
 
             // TODO ex 11.1 iterate through all pixels in the buffer (width: [0, fb.W), height:[0, fb.H])
             //  for each pixel,
@@ -56,71 +530,445 @@ namespace rt{
             //  all intersection computations should happen in the same space, no matter what that space is)
             //  - create a ray with the camera origin, and the vector from the camera origin to the pixel you have just found
             //  - call the TraceRay method using that ray, and store the resulting color in the frame buffer (fb)
-            for (int c = 0; c < fb.W; c++){
-                for(int r = 0; r < fb.H; r++){
-                    vec4 pixel_pos = lower_left_corner + vec4 (vec2(c, r) * pixel_size,0, 0);
-                    pixel_pos = view_to_model * pixel_pos;  // transform from camera coord space to model coord space
-                    Ray ray(cam_pos, normalize(pixel_pos - cam_pos));
-                    color col = traceRay(ray, depth, vts);  // trace te ray / compute the color
-                    fb.paintAt(c, r, toRGBA32(col));        // set the color on the frame buffer
+            beginPixelCost(fb.W * fb.H);
+            AuxSample *aux_samples = auxTarget(fb.W * fb.H);
+            if (aux_samples) progressive_aux = false; // they replace those of the progressive accumulation
+            renderTiles(fb.W, fb.H, [&](unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, RayCounters &rays){
+                for (unsigned int r = y0; r < y1; r++){
+                    for (unsigned int c = x0; c < x1; c++){
+                        uint64_t work = rays.work();
+                        Ray ray = camera.generate(float(c), float(r));
+                        Hit hit;
+                        AuxSample *aux_sample = aux_samples ? &aux_samples[c + r * fb.W] : nullptr;
+                        color col = trace(ray, vts, rays, hit, aux_sample);  // trace te ray / compute the color
+                        hdr.paintAt(c, r, col);                                        // set the color on the frame buffer
+                        addPixelCost(c + r * fb.W, rays, work);
+                    }
+                }
+                rays.primary += (x1 - x0) * (y1 - y0);
+            });
+            denoiseFrame(aux_samples != nullptr);
+            resolveFrame(fb);
+
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            trace_ms = elapsed.count();
+
+        }
+
+        // traces the pixels [x0, x1) x [y0, y1) of a width x height frame, with the same rays as render, into colors
+        // (row by row, from the bottom left pixel of the region). Nothing is resolved or denoised, and the tile stats
+        // are relative to the region. Used to split the frames between processes
+        void renderRegion(const std::vector<vertex> &vts,
+                          const glm::mat4 &m,
+                          const glm::mat4 &v,
+                          const float fov_degrees,
+                          unsigned int depth,
+                          unsigned int width, unsigned int height,
+                          unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+                          std::vector<color> &colors) {
+
+            auto start = std::chrono::high_resolution_clock::now();
+            PrimaryRays camera(m, v, fov_degrees, width, height);
+            beginTrace(depth);
+            unsigned int w = x1 - x0, h = y1 - y0;
+            colors.resize(w * h);
+            renderTiles(w, h, [&](unsigned int tx0, unsigned int ty0, unsigned int tx1, unsigned int ty1, RayCounters &rays){
+                for (unsigned int r = ty0; r < ty1; r++){
+                    for (unsigned int c = tx0; c < tx1; c++){
+                        Ray ray = camera.generate(float(x0 + c), float(y0 + r));
+                        Hit hit;
+                        colors[c + r * w] = trace(ray, vts, rays, hit);
+                    }
+                }
+                rays.primary += (tx1 - tx0) * (ty1 - ty0);
+            });
+
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            trace_ms = elapsed.count();
+        }
+
+        // progressive version of render: each call adds one jittered sample to every pixel of acc that has not
+        // converged yet, and writes the average of all the samples so far to fb. The samples are kept for as long as
+        // the scene, camera, fov and depth don't change, so calling it while the view is static refines the image
+        // (anti-aliasing) and gets cheaper as pixels converge, it costs nothing once the whole image has converged.
+        // acc is resized to match fb. Call acc.reset() if the vertices change in place
+        void renderProgressive(const std::vector<vertex> &vts,
+                               const glm::mat4 &m,
+                               const glm::mat4 &v,
+                               const float fov_degrees,
+                               unsigned int depth,
+                               AccumulationBuffer &acc,
+                               FrameBuffer <uint32_t> &fb) {
+
+            auto start = std::chrono::high_resolution_clock::now();
+
+            ViewState view = viewState(vts, m, v, fov_degrees, depth, fb.W, fb.H);
+            if (acc.width() != fb.W || acc.height() != fb.H) acc.resize(fb.W, fb.H);
+            else if (!(view == progressive_view) || &acc != progressive_acc) acc.reset();
+            progressive_view = view;
+            progressive_acc = &acc;
+            // the aux samples are written by the first pass
+            if (denoise_settings.enabled && !progressive_aux && acc.passes() > 0) acc.reset();
+            if (acc.passes() == 0) progressive_aux = denoise_settings.enabled;
+            AuxSample *aux_samples = progressive_aux ? auxTarget(fb.W * fb.H) : nullptr;
+
+            PrimaryRays camera(m, v, fov_degrees, fb.W, fb.H);
+            FrameBuffer<color> &hdr = hdrTarget(fb.W, fb.H);
+            beginPixelCost(fb.W * fb.H);
+            beginTrace(depth);
+
+            renderTiles(fb.W, fb.H, [&](unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, RayCounters &rays){
+                for (unsigned int r = y0; r < y1; r++){
+                    for (unsigned int c = x0; c < x1; c++){
+                        if (!acc.converged(c, r)) {
+                            uint64_t work = rays.work();
+                            // the first sample goes through the same point as in render, the next ones are spread
+                            // uniformly over a pixel wide square centered on it, so the average stays aligned with render
+                            unsigned int sample = acc.sampleCount(c, r);
+                            vec2 offset(0.0f);
+                            if (sample > 0) {
+                                uint32_t seed = hashPCG(c + r * fb.W) ^ hashPCG(sample);
+                                offset.x = randomFloat(seed) - 0.5f;
+                                offset.y = randomFloat(seed) - 0.5f;
+                            }
+                            Ray ray = camera.generate(float(c) + offset.x, float(r) + offset.y);
+                            Hit hit;
+                            AuxSample *aux_sample = aux_samples && sample == 0 ? &aux_samples[c + r * fb.W] : nullptr;
+                            acc.addSample(c, r, trace(ray, vts, rays, hit, aux_sample));
+                            rays.primary++;
+                            addPixelCost(c + r * fb.W, rays, work);
+                        }
+                        hdr.paintAt(c, r, acc.average(c, r));
+                    }
+                }
+            });
+            acc.endPass();
+            // the aux samples stay valid while the accumulation goes on, and as long as no other frame overwrites them
+            denoiseFrame(denoise_settings.enabled && progressive_aux);
+            resolveFrame(fb);
+
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            trace_ms = elapsed.count();
+        }
+
+        // render for interactive use. fb is left untouched when nothing changed, so it should hold (or show) the
+        // previous frame, otherwise all its pixels are written
+        // - if the scene, camera and settings didn't change since the last complete frame, nothing is traced
+        // - if only the camera moved, the primary hits of the previous frame are projected into the new view, and only
+        //   the pixels left without a hit (disocclusions, borders), those next to much closer geometry (where a far
+        //   surface may show through a gap), and those reprojected for too many frames are traced. Shading is reused
+        //   as is, so view dependent effects (specular, reflections) lag behind until...
+        // - ...the camera stops, then the frame is traced completely once
+        FrameUpdate renderIncremental(const std::vector<vertex> &vts,
+                                      const glm::mat4 &m,
+                                      const glm::mat4 &v,
+                                      const float fov_degrees,
+                                      unsigned int depth,
+                                      FrameBuffer <uint32_t> &fb) {
+
+            auto start = std::chrono::high_resolution_clock::now();
+            ViewState view = viewState(vts, m, v, fov_degrees, depth, fb.W, fb.H);
+            ReprojectionCache &cache = reprojection;
+            unsigned int pixel_count = fb.W * fb.H;
+            incremental_stats = IncrementalStats();
+            beginPixelCost(pixel_count);
+
+            if (cache.valid && cache.complete && view == cache.view) {
+                incremental_stats.update = FrameUpdate::Skipped;
+                frame_rays = RayCounters();
+                tile_stats.clear();
+                // nothing to trace, but the exposure or tone mapping may have changed
+                resolve_ms = 0;
+                if (!(resolve_settings == resolved_settings)) resolveFrame(fb);
+                std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+                trace_ms = elapsed.count();
+                return FrameUpdate::Skipped;
+            }
+
+            PrimaryRays camera(m, v, fov_degrees, fb.W, fb.H);
+            beginTrace(depth);
+            bool reprojected = cache.valid && view.sameScene(cache.view) && !(view == cache.view) &&
+                               reproject(camera);
+
+            if (reprojected) {
+                // trace the holes, in batches of consecutive pixels
+                const unsigned int batch = 64;
+                unsigned int hole_count = (unsigned int) cache.holes.size();
+                unsigned int batches = (hole_count + batch - 1) / batch;
+                std::vector<RayCounters> batch_rays(batches);
+                pool->parallelFor(batches, [&](unsigned int b, unsigned int){
+                    RayCounters rays; // counted locally, neighbouring batches share cache lines
+                    for (unsigned int i = b * batch; i < std::min(hole_count, (b + 1) * batch); i++)
+                        tracePixel(cache.holes[i] % fb.W, cache.holes[i] / fb.W, camera, vts, rays);
+                    batch_rays[b] = rays;
+                });
+                frame_rays = RayCounters();
+                for (const RayCounters &rays : batch_rays) frame_rays += rays;
+                frame_rays.primary = hole_count;
+                tile_stats.clear();
+
+                incremental_stats.update = FrameUpdate::Reprojected;
+                incremental_stats.traced = hole_count;
+                incremental_stats.reprojected = pixel_count - hole_count;
+            }
+            else {
+                cache.positions.resize(pixel_count);
+                cache.colors.resize(pixel_count);
+                cache.age.resize(pixel_count);
+                renderTiles(fb.W, fb.H, [&](unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, RayCounters &rays){
+                    for (unsigned int r = y0; r < y1; r++){
+                        for (unsigned int c = x0; c < x1; c++){
+                            tracePixel(c, r, camera, vts, rays);
+                        }
+                    }
+                    rays.primary += (x1 - x0) * (y1 - y0);
+                });
+                incremental_stats.update = FrameUpdate::Full;
+                incremental_stats.traced = pixel_count;
+            }
+
+            // the cache holds the colors of the whole frame
+            std::copy(cache.colors.begin(), cache.colors.end(), hdrTarget(fb.W, fb.H).buffer);
+            denoiseFrame(false);
+            resolveFrame(fb);
+
+            cache.view = view;
+            cache.valid = true;
+            cache.complete = !reprojected;
+
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            trace_ms = elapsed.count();
+            return incremental_stats.update;
+        }
+
+        // renders the same image as render, but breadth first instead of one recursive path per pixel: all primary
+        // rays are generated and intersected as one batch, their hits are shaded, which fills a queue of shadow rays
+        // and a queue of reflection rays, and the reflection queue is traced the same way for each bounce. Every
+        // stage runs over a whole queue in parallel, so rays doing the same work stay together.
+        // the bounces of each pixel are combined at the end in the order the recursion of traceRay unwinds, so the
+        // result is exactly the same as render
+        void renderWavefront(const std::vector<vertex> &vts,
+                             const glm::mat4 &m,
+                             const glm::mat4 &v,
+                             const float fov_degrees,
+                             unsigned int depth,
+                             FrameBuffer <uint32_t> &fb) {
+
+            auto start = std::chrono::high_resolution_clock::now();
+            auto stage_start = start;
+            auto stageTime = [&stage_start](float &stage_ms){
+                auto now = std::chrono::high_resolution_clock::now();
+                stage_ms += std::chrono::duration<float, std::milli>(now - stage_start).count();
+                stage_start = now;
+            };
+
+            // traceRay clamps depth the same way, and always shades the first hit
+            unsigned int bounces = std::max(1u, std::min(depth, max_recursion));
+            unsigned int pixel_count = fb.W * fb.H;
+            WavefrontQueues &q = wavefront;
+            q.local.resize(pixel_count * bounces);
+            q.path_length.assign(pixel_count, 0);
+            wavefront_times = WavefrontTimes();
+            secondary_ray_stats = SecondaryRayStats();
+            frame_rays = RayCounters();
+            tile_stats.clear();
+            beginPixelCost(pixel_count);
+
+            PrimaryRays camera(m, v, fov_degrees, fb.W, fb.H);
+            FrameBuffer<color> &hdr = hdrTarget(fb.W, fb.H);
+            AuxSample *aux_samples = auxTarget(pixel_count);
+            if (aux_samples) progressive_aux = false; // they replace those of the progressive accumulation
+            q.rays.resize(pixel_count);
+            parallelRange(pixel_count, [&](unsigned int i, RayCounters &){
+                q.rays[i] = WavefrontRay{camera.generate(float(i % fb.W), float(i / fb.W)), i};
+                if (aux_samples) aux_samples[i] = AuxSample(); // the primary hits are written when they are shaded
+            });
+            frame_rays.primary = pixel_count;
+            stageTime(wavefront_times.generate);
+
+            for (unsigned int bounce = 0; bounce < bounces && !q.rays.empty(); bounce++){
+                unsigned int count = (unsigned int) q.rays.size();
+                color *local = &q.local[bounce * pixel_count];
+
+                if (bounce > 0 && (sort_secondary_rays || measure_ray_coherence)) {
+                    if (measure_ray_coherence) measureCoherence(q.rays, secondary_ray_stats.spawned);
+                    if (sort_secondary_rays) {
+                        sortRays(q);
+                        if (measure_ray_coherence) measureCoherence(q.rays, secondary_ray_stats.traced);
+                    }
+                    else secondary_ray_stats.traced = secondary_ray_stats.spawned;
+                    stageTime(wavefront_times.sort);
+                }
+
+                q.hits.assign(count, Hit());
+                parallelRange(count, [&](unsigned int i, RayCounters &rays){
+                    uint64_t work = rays.work();
+                    intersect(q.rays[i].ray, vts, q.hits[i], rays);
+                    addPixelCost(q.rays[i].pixel, rays, work);
+                });
+                if (bounce > 0) {
+                    float before = wavefront_times.extend;
+                    stageTime(wavefront_times.extend);
+                    wavefront_times.extend_secondary += wavefront_times.extend - before;
                 }
+                else stageTime(wavefront_times.extend);
+
+                q.shading.resize(count);
+                parallelRange(count, [&](unsigned int i, RayCounters &){
+                    if (q.hits[i].hit_ID < 0) return;
+                    q.shading[i] = shadeHit(q.rays[i].ray, q.hits[i], vts, trace_settings.shading);
+                    local[q.rays[i].pixel] = q.shading[i].ambient;
+                    if (bounce == 0 && aux_samples) aux_samples[q.rays[i].pixel] = auxSample(q.hits[i], q.shading[i]);
+                });
+                // the reflection rays of the hits are the next queue, misses end their path here
+                q.next.clear();
+                for (unsigned int i = 0; i < count; i++){
+                    if (q.hits[i].hit_ID < 0) continue;
+                    q.path_length[q.rays[i].pixel] = (unsigned char) (bounce + 1);
+                    if (bounce + 1 < bounces)
+                        q.next.push_back(WavefrontRay{reflectedRay(q.rays[i].ray, q.shading[i]), q.rays[i].pixel});
+                }
+                stageTime(wavefront_times.shade);
+
+                // every hit has a shadow ray, so the shading queue doubles as the shadow ray queue
+                bool lit = trace_settings.shading != ShadingModel::Flat, shadows = lit && trace_settings.shadows;
+                if (lit) parallelRange(count, [&](unsigned int i, RayCounters &rays){
+                    if (q.hits[i].hit_ID < 0) return;
+                    const LocalShading &shading = q.shading[i];
+                    uint64_t work = rays.work();
+                    if (!shadows || lightVisible(shading.shadow_ray, shading.light_dist, vts, rays))
+                        local[q.rays[i].pixel] += shading.direct;
+                    addPixelCost(q.rays[i].pixel, rays, work);
+                });
+                stageTime(wavefront_times.shadow);
+
+                if (shadows)
+                    frame_rays.shadow += count - std::count_if(q.hits.begin(), q.hits.end(), [](const Hit &h){ return h.hit_ID < 0; });
+                frame_rays.secondary += q.next.size();
+                std::swap(q.rays, q.next);
             }
 
+            // col = local + p_rg * reflected color, from the last bounce back to the first one
+            parallelRange(pixel_count, [&](unsigned int p, RayCounters &){
+                int length = q.path_length[p];
+                color col = black; // the color of a path that leaves the scene
+                int b = length - 1;
+                if (length == (int) bounces) col = q.local[b-- * pixel_count + p]; // the last bounce doesn't reflect
+                for (; b >= 0; b--)
+                    col = q.local[b * pixel_count + p] + p_rg * col;
+                hdr.buffer[p] = col;
+            });
+            denoiseFrame(aux_samples != nullptr);
+            resolveFrame(fb);
+            stageTime(wavefront_times.resolve);
+
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            trace_ms = elapsed.count();
         }
 
 
         color traceRay(const Ray & ray,
                        unsigned int depth,
                        const std::vector<vertex> &vts){
-            // this is here to ensure we don't end up with a long recursion that can freeze the program (or cause a stack overflow)
-            depth = depth > max_recursion ? max_recursion : depth;
+            RayCounters rays;
+            return traceRay(ray, depth, vts, rays);
+        }
 
-            color col = black; // used to output a color
+        // same as above, the shadow and reflection rays spawned are added to rays
+        color traceRay(const Ray & ray,
+                       unsigned int depth,
+                       const std::vector<vertex> &vts,
+                       RayCounters &rays){
             Hit hitInfo; // used to store the hit information
-            if (!rayModelIntersection(ray, vts, hitInfo)) return col; // no hit, return black
-
-
-            // TODO ex 11.2 replace the current i_normal and i_col computation with their interpolated versions
-            vec3 i_normal = vts[hitInfo.hit_ID].norm * hitInfo.barycentric.x + vts[hitInfo.hit_ID+1].norm * hitInfo.barycentric.y + vts[hitInfo.hit_ID+2].norm * hitInfo.barycentric.z;
-            i_normal = normalize(i_normal);
-            color i_col = vts[hitInfo.hit_ID].col * hitInfo.barycentric.x + vts[hitInfo.hit_ID+1].col * hitInfo.barycentric.y + vts[hitInfo.hit_ID+2].col * hitInfo.barycentric.z;
+            return traceRay(ray, depth, vts, rays, hitInfo);
+        }
 
-            vec3 i_pos = ray.origin + ray.direction * hitInfo.dist;
+        // same as above, the closest hit of ray (if any) is returned in hitInfo, which must be a default constructed Hit.
+        // when aux is given, the surface that was hit is written to it, for the denoiser
+        color traceRay(const Ray & ray,
+                       unsigned int depth,
+                       const std::vector<vertex> &vts,
+                       RayCounters &rays,
+                       Hit &hitInfo,
+                       AuxSample *aux = nullptr){
+            // this is here to ensure we don't end up with a long recursion that can freeze the program (or cause a stack overflow)
+            depth = depth > max_recursion ? max_recursion : depth;
 
-            // TODO ex 11.3 implement the phong reflection model for the point light below
-            float ambient = 0.1f, diffuse = 0.5f, specular = 0.5f, shininess = 10;
-            vec3 light_pos(0,1.9f,0); // light position in model space
-            vec3 light_dir = normalize(light_pos - i_pos);
+            color col = black; // used to output a color
+            if (!intersect(ray, vts, hitInfo, rays)) {
+                if (aux) *aux = AuxSample();
+                return col; // no hit, return black
+            }
 
-            col = ambient * i_col;
+            LocalShading shading = shadeHit(ray, hitInfo, vts, trace_settings.shading);
+            if (aux) *aux = auxSample(hitInfo, shading);
+            col = shading.ambient;
 
-            // TODO ex 11.4 check if the light source is visible from i_pos, we only use the diffuse and specular components if that is the case
-            Ray shadow_ray(i_pos + i_normal * .001f, light_dir); // i_normal * .001f is handling numerical precision issues, it prevents self-intersection
-            float light_dist = length(light_pos - i_pos);
-            Hit shadow_hit;
-            // check if there is geometry in the direction of the light, and if the closest geometry is closer than the light source
-            if (rayModelIntersection(shadow_ray, vts, shadow_hit) && light_dist < shadow_hit.dist) {
-                // the light is visible from i_pos (there is no occlusion), so we compute direct lighting
-                col += diffuse * i_col * max(dot(light_dir, i_normal), .0f) +
-                       specular * pow(max(dot(light_dir, i_normal), .0f), shininess);
+            if (trace_settings.shading != ShadingModel::Flat) {
+                if (!trace_settings.shadows) col += shading.direct;
+                else {
+                    rays.shadow++;
+                    if (lightVisible(shading.shadow_ray, shading.light_dist, vts, rays)) {
+                        // the light is visible from i_pos (there is no occlusion), so we compute direct lighting
+                        col += shading.direct;
+                    }
+                }
             }
 
             // the recursion/reflection happens here!
             if (depth > 1) {
-                Ray reflected_ray(i_pos, reflect(ray.direction, i_normal));
-                reflected_ray.origin -= ray.direction * .001f; // this is a small offset to address numerical precision issues
                 // integrate the current color with the reflection color by a p_rg factor
-                col += p_rg * traceRay(reflected_ray, depth - 1, vts);
+                rays.secondary++;
+                col += p_rg * traceRay(reflectedRay(ray, shading), depth - 1, vts, rays);
+            }
+
+            return col;
+        }
+
+        // traceRay compiled for one depth, shadows setting and shading model: the reflections are unrolled into calls
+        // to the kernel of depth - 1, and the branches on the settings are resolved at compile time. Same colors and
+        // counters as traceRay with these settings
+        template <unsigned int Depth, bool Shadows, ShadingModel Model>
+        color traceKernel(const Ray & ray,
+                          const std::vector<vertex> &vts,
+                          RayCounters &rays,
+                          Hit &hitInfo,
+                          AuxSample *aux){
+            if (!intersect(ray, vts, hitInfo, rays)) {
+                if (aux) *aux = AuxSample();
+                return black;
+            }
+
+            LocalShading shading = shadeHit(ray, hitInfo, vts, Model);
+            if (aux) *aux = auxSample(hitInfo, shading);
+            color col = shading.ambient;
+
+            if (Model != ShadingModel::Flat) {
+                if (!Shadows) col += shading.direct;
+                else {
+                    rays.shadow++;
+                    if (lightVisible(shading.shadow_ray, shading.light_dist, vts, rays)) col += shading.direct;
+                }
             }
 
+            if (Depth > 1) {
+                rays.secondary++;
+                Hit reflected;
+                // Depth - 1, the last kernel instantiates itself in a branch it never takes
+                col += p_rg * traceKernel<(Depth > 1 ? Depth - 1 : 1), Shadows, Model>(reflectedRay(ray, shading), vts,
+                                                                                       rays, reflected, nullptr);
+            }
             return col;
         }
 
         // returns false if no intersection
         // intersection results are returned in the "hit" reference variable
+        // the tests made are added to counters, when given
         static bool rayModelIntersection(const Ray & ray,
                                          const std::vector<vertex> &vts,
-                                         Hit &hit){
+                                         Hit &hit,
+                                         RayCounters *counters = nullptr){
+            if (counters) counters->triangle_tests += vts.size() / 3;
             for (int i = 0; i < vts.size(); i+=3)
             {
                 float dist_temp;
@@ -137,6 +985,209 @@ namespace rt{
             return hit.hit_ID < 0 ? false : true;
         }
 
+        // same as above, but only the triangles in the leaves of the bvh (a BVH, or a WideBVH collapsed from it) reached
+        // by the ray are tested. triangles must hold the triangles of the vertex list in the order of
+        // bvh.triangleIndices(), so that each leaf is a contiguous range of the store. kernel must be supported by the
+        // cpu (see simd::resolve)
+        template <typename Tree>
+        static bool rayModelIntersection(const Ray & ray,
+                                         const Tree &bvh,
+                                         const TriangleStore &triangles,
+                                         Hit &hit,
+                                         IntersectionKernel kernel = IntersectionKernel::Scalar,
+                                         RayCounters *counters = nullptr){
+            bvh.traverse(ray, hit.dist, [&](unsigned int first, unsigned int count, float &t_max){
+                if (counters) counters->triangle_tests += count;
+                leafIntersection(ray, triangles, first, count, kernel, hit, t_max);
+                return false; // we want the closest hit, keep traversing
+            }, counters ? &counters->nodes_visited : nullptr);
+            return hit.hit_ID < 0 ? false : true;
+        }
+
+        // true if a hit at distance t on triangle id should replace the current hit, closer than t_max. A hit at the
+        // same distance as the current one is kept if its triangle id is lower, so that all the kernels pick the same
+        // triangle when two are hit at once (e.g. on a shared edge), whatever the order they test them in
+        static bool closerHit(float t, unsigned int id, float t_max, const Hit &hit){
+            return t < t_max || (t == t_max && t == hit.dist && hit.hit_ID >= 0 && (int) id * 3 < hit.hit_ID);
+        }
+
+        // closest hit among the triangles [first, first + count) of triangles (a TriangleStore, or anything with the
+        // same packet, v0, e1, e2 and triangleID accessors), closer than t_max. hit and t_max are updated on a hit
+        template <typename Triangles>
+        static void leafIntersection(const Ray & ray, const Triangles &triangles, unsigned int first, unsigned int count,
+                                     IntersectionKernel kernel, Hit &hit, float &t_max){
+            unsigned int width = simd::width(kernel);
+            if (width > 1) {
+                // test the leaf triangles in groups of width, loaded straight from the store
+                for (unsigned int group = first; group < first + count; group += width){
+                    float t[8], u[8], v[8];
+                    int mask = simd::intersect(kernel, ray, triangles.packet(group),
+                                               std::min(width, first + count - group), t_max, t, u, v);
+                    for (unsigned int lane = 0; mask != 0; lane++, mask >>= 1){
+                        unsigned int id = triangles.triangleID(group + lane);
+                        if ((mask & 1) && closerHit(t[lane], id, t_max, hit)) {
+                            hit.hit_ID = id * 3;
+                            hit.dist = t_max = t[lane];
+                            hit.barycentric = vec3(1.0f - u[lane] - v[lane], u[lane], v[lane]);
+                        }
+                    }
+                }
+                return;
+            }
+
+            for (unsigned int i = first; i < first + count; i++)
+            {
+                float dist_temp;
+                vec3 barycentric_temp;
+                if (rayTriangleIntersection(ray, triangles.v0(i), triangles.e1(i), triangles.e2(i), dist_temp, barycentric_temp) &&
+                    closerHit(dist_temp, triangles.triangleID(i), t_max, hit))
+                {
+                    hit.hit_ID = triangles.triangleID(i) * 3;
+                    hit.dist = t_max = dist_temp;
+                    hit.barycentric = barycentric_temp;
+                }
+            }
+        }
+
+        // any-hit query: returns true as soon as a triangle is hit closer than max_dist. It doesn't look for the
+        // closest hit nor compute its barycentric coordinates, which is all a shadow ray needs
+        static bool rayModelOccluded(const Ray & ray,
+                                     const std::vector<vertex> &vts,
+                                     float max_dist,
+                                     RayCounters *counters = nullptr){
+            for (size_t i = 0; i < vts.size(); i+=3)
+            {
+                float t, u, v;
+                if (rayTriangleIntersection(ray, vts[i].pos, vts[i+1].pos - vts[i].pos, vts[i+2].pos - vts[i].pos, t, u, v) && t < max_dist) {
+                    if (counters) counters->triangle_tests += i / 3 + 1;
+                    return true;
+                }
+            }
+            if (counters) counters->triangle_tests += vts.size() / 3;
+            return false;
+        }
+
+        // same as above, testing only the leaves of the bvh reached by the ray before max_dist, the traversal stops
+        // at the first hit
+        template <typename Tree>
+        static bool rayModelOccluded(const Ray & ray,
+                                     const Tree &bvh,
+                                     const TriangleStore &triangles,
+                                     float max_dist,
+                                     IntersectionKernel kernel = IntersectionKernel::Scalar,
+                                     RayCounters *counters = nullptr){
+            return bvh.traverse(ray, max_dist, [&](unsigned int first, unsigned int count, float &t_max){
+                return leafOccluded(ray, triangles, first, count, kernel, t_max, counters);
+            }, counters ? &counters->nodes_visited : nullptr);
+        }
+
+        // true if one of the triangles [first, first + count) of triangles is hit closer than t_max, see leafIntersection
+        template <typename Triangles>
+        static bool leafOccluded(const Ray & ray, const Triangles &triangles, unsigned int first, unsigned int count,
+                                 IntersectionKernel kernel, float t_max, RayCounters *counters){
+            unsigned int width = simd::width(kernel);
+            if (width > 1) {
+                for (unsigned int group = first; group < first + count; group += width){
+                    unsigned int group_count = std::min(width, first + count - group);
+                    if (counters) counters->triangle_tests += group_count;
+                    if (simd::occluded(kernel, ray, triangles.packet(group), group_count, t_max))
+                        return true;
+                }
+                return false;
+            }
+
+            for (unsigned int i = first; i < first + count; i++)
+            {
+                float t, u, v;
+                if (counters) counters->triangle_tests++;
+                if (rayTriangleIntersection(ray, triangles.v0(i), triangles.e1(i), triangles.e2(i), t, u, v) && t < t_max)
+                    return true;
+            }
+            return false;
+        }
+
+        // closest hit among the instances of scene. The top level bvh is traversed in model space, and the ray is moved
+        // to the object space of each instance it reaches to traverse the bvh of its mesh. The direction is not
+        // normalized after the transform, so hit distances stay in model space units and compare across instances
+        static bool rayInstancesIntersection(const Ray & ray,
+                                             const InstancedScene &scene,
+                                             Hit &hit,
+                                             IntersectionKernel kernel = IntersectionKernel::Scalar,
+                                             RayCounters *counters = nullptr){
+            const std::vector<unsigned int> &ids = scene.topLevel().triangleIndices();
+            scene.topLevel().traverse(ray, hit.dist, [&](unsigned int first, unsigned int count, float &t_max){
+                for (unsigned int i = first; i < first + count; i++){
+                    const Instance &instance = scene.instance(ids[i]);
+                    Hit local_hit;
+                    local_hit.dist = t_max;
+                    if (rayModelIntersection(objectSpaceRay(ray, instance), instance.mesh->bvh(),
+                                             instance.mesh->triangles(), local_hit, kernel, counters)) {
+                        hit = local_hit;
+                        hit.instance_ID = (int) ids[i];
+                        t_max = hit.dist;
+                    }
+                }
+                return false;
+            }, counters ? &counters->nodes_visited : nullptr);
+            return hit.hit_ID < 0 ? false : true;
+        }
+
+        // any-hit query among the instances of scene
+        static bool rayInstancesOccluded(const Ray & ray,
+                                         const InstancedScene &scene,
+                                         float max_dist,
+                                         IntersectionKernel kernel = IntersectionKernel::Scalar,
+                                         RayCounters *counters = nullptr){
+            const std::vector<unsigned int> &ids = scene.topLevel().triangleIndices();
+            return scene.topLevel().traverse(ray, max_dist, [&](unsigned int first, unsigned int count, float &t_max){
+                for (unsigned int i = first; i < first + count; i++){
+                    const Instance &instance = scene.instance(ids[i]);
+                    if (rayModelOccluded(objectSpaceRay(ray, instance), instance.mesh->bvh(),
+                                         instance.mesh->triangles(), t_max, kernel, counters))
+                        return true;
+                }
+                return false;
+            }, counters ? &counters->nodes_visited : nullptr);
+        }
+
+        // closest hit in a memory mapped mesh: the top level leads to the clusters, whose subtrees are traversed where
+        // they are mapped. hit_ID indexes MappedMesh::vertices
+        static bool rayMappedIntersection(const Ray & ray,
+                                          const MappedMesh &mesh,
+                                          Hit &hit,
+                                          IntersectionKernel kernel = IntersectionKernel::Scalar,
+                                          RayCounters *counters = nullptr){
+            uint64_t *nodes_visited = counters ? &counters->nodes_visited : nullptr;
+            BVH::traverse(mesh.topNodes(), ray, hit.dist, [&](unsigned int cluster, unsigned int, float &t_max){
+                ClusterTriangles tris;
+                const BVHNode *nodes = mesh.cluster(cluster, tris);
+                BVH::traverse(nodes, ray, t_max, [&](unsigned int first, unsigned int count, float &cluster_t_max){
+                    if (counters) counters->triangle_tests += count;
+                    leafIntersection(ray, tris, first, count, kernel, hit, cluster_t_max);
+                    return false;
+                }, nodes_visited);
+                t_max = hit.dist;
+                return false;
+            }, nodes_visited);
+            return hit.hit_ID < 0 ? false : true;
+        }
+
+        // any-hit query in a memory mapped mesh
+        static bool rayMappedOccluded(const Ray & ray,
+                                      const MappedMesh &mesh,
+                                      float max_dist,
+                                      IntersectionKernel kernel = IntersectionKernel::Scalar,
+                                      RayCounters *counters = nullptr){
+            uint64_t *nodes_visited = counters ? &counters->nodes_visited : nullptr;
+            return BVH::traverse(mesh.topNodes(), ray, max_dist, [&](unsigned int cluster, unsigned int, float &t_max){
+                ClusterTriangles tris;
+                const BVHNode *nodes = mesh.cluster(cluster, tris);
+                return BVH::traverse(nodes, ray, t_max, [&](unsigned int first, unsigned int count, float &cluster_t_max){
+                    return leafOccluded(ray, tris, first, count, kernel, cluster_t_max, counters);
+                }, nodes_visited);
+            }, nodes_visited);
+        }
+
         // returns false if no intersection
         static bool rayTriangleIntersection(const Ray & ray,
                                             const vertex & p1,
@@ -144,8 +1195,29 @@ namespace rt{
                                             const vertex & p3,
                                             float & t, vec3 & barycentric)
         {
-            vec3 e1 = p2.pos - p1.pos;
-            vec3 e2 = p3.pos - p1.pos;
+            return rayTriangleIntersection(ray, p1.pos, p2.pos - p1.pos, p3.pos - p1.pos, t, barycentric);
+        }
+
+        // same as above, with the triangle given by its first vertex and its two edges (p2 - p1 and p3 - p1)
+        static bool rayTriangleIntersection(const Ray & ray,
+                                            const vec3 & p1,
+                                            const vec3 & e1,
+                                            const vec3 & e2,
+                                            float & t, vec3 & barycentric)
+        {
+            float u, v;
+            if (!rayTriangleIntersection(ray, p1, e1, e2, t, u, v)) return false;
+            barycentric = vec3(1.0f - u - v, u, v);
+            return true;
+        }
+
+        // same as above, returns the u and v barycentric coordinates (of p2 and p3) instead of the full barycentric vector
+        static bool rayTriangleIntersection(const Ray & ray,
+                                            const vec3 & p1,
+                                            const vec3 & e1,
+                                            const vec3 & e2,
+                                            float & t, float & u, float & v)
+        {
             vec3 q = cross(ray.direction, e2);
             float a = dot(e1, q);
 
@@ -154,14 +1226,14 @@ namespace rt{
             if (abs(a) < tolerance) return false;
 
             float f = 1.0f / a;
-            vec3 s = ray.origin - vec3(p1.pos);
-            float u = f * dot(s, q);
+            vec3 s = ray.origin - p1;
+            u = f * dot(s, q);
 
             // if u < 0, intersection with plane is not within the triangle
             if (u < -tolerance) return false;
 
             vec3 r = cross(s, e1);
-            float v = f * dot(ray.direction, r);
+            v = f * dot(ray.direction, r);
 
             // if v < 0 or u+v > 1, intersection with plane is not within the triangle
             if (v < -tolerance || u + v > 1) return false;
@@ -171,10 +1243,368 @@ namespace rt{
             if (t < 0)
                 return false;
 
-            barycentric = vec3(1.0f - u - v, u, v);
+            return true;
+        }
+
+    private:
+        LocalShading shadeHit(const Ray & ray, const Hit &hitInfo, const std::vector<vertex> &model_vts,
+                              ShadingModel model) const {
+            LocalShading shading;
+            // the attributes of an instance hit are in the object space of its mesh
+            const Instance *instance = hitInfo.instance_ID >= 0 ? &instances->instance(hitInfo.instance_ID) : nullptr;
+            const vertex *vts = instance ? instance->mesh->vertices().data()
+                                         : mapped_mesh ? mapped_mesh->vertices() : model_vts.data();
+
+            // TODO ex 11.2 replace the current i_normal and i_col computation with their interpolated versions
+            vec3 i_normal = vts[hitInfo.hit_ID].norm * hitInfo.barycentric.x + vts[hitInfo.hit_ID+1].norm * hitInfo.barycentric.y + vts[hitInfo.hit_ID+2].norm * hitInfo.barycentric.z;
+            if (instance) i_normal = instance->normal_matrix * i_normal;
+            i_normal = normalize(i_normal);
+            color i_col = vts[hitInfo.hit_ID].col * hitInfo.barycentric.x + vts[hitInfo.hit_ID+1].col * hitInfo.barycentric.y + vts[hitInfo.hit_ID+2].col * hitInfo.barycentric.z;
+
+            vec3 i_pos = ray.origin + ray.direction * hitInfo.dist;
+
+            // TODO ex 11.3 implement the phong reflection model for the point light below
+            float ambient = 0.1f, diffuse = 0.5f, specular = 0.5f, shininess = 10;
+            vec3 light_pos(0,1.9f,0); // light position in model space
+            vec3 light_dir = normalize(light_pos - i_pos);
+
+            shading.ambient = ambient * i_col;
+            shading.direct = diffuse * i_col * max(dot(light_dir, i_normal), .0f);
+            if (model == ShadingModel::Phong)
+                shading.direct = shading.direct + specular * pow(max(dot(light_dir, i_normal), .0f), shininess);
+            else if (model == ShadingModel::Flat) {
+                shading.ambient = i_col;
+                shading.direct = black;
+            }
+
+            // TODO ex 11.4 check if the light source is visible from i_pos, we only use the diffuse and specular components if that is the case
+            shading.shadow_ray = Ray(i_pos + i_normal * .001f, light_dir); // i_normal * .001f is handling numerical precision issues, it prevents self-intersection
+            shading.light_dist = length(light_pos - i_pos);
+            shading.position = i_pos;
+            shading.normal = i_normal;
+            shading.albedo = i_col;
+            return shading;
+        }
+
+        // bins the rays by the octant of their direction, and orders each bin along a Morton curve through the bounds of
+        // the origins, 9 bits per axis
+        static void sortRays(WavefrontQueues &q){
+            AABB bounds;
+            for (const WavefrontRay &r : q.rays) bounds.grow(r.ray.origin);
+            vec3 extent = bounds.max - bounds.min;
+            vec3 scale(0);
+            for (int a = 0; a < 3; a++) if (extent[a] > 0) scale[a] = 511.0f / extent[a];
+
+            q.sort_keys.resize(q.rays.size());
+            for (unsigned int i = 0; i < q.rays.size(); i++){
+                const Ray &ray = q.rays[i].ray;
+                uint32_t cell[3];
+                for (int a = 0; a < 3; a++)
+                    cell[a] = (uint32_t) glm::clamp((ray.origin[a] - bounds.min[a]) * scale[a], 0.0f, 511.0f);
+                uint32_t key = octant(ray.direction) << 27 |
+                               spreadBits(cell[0]) << 2 | spreadBits(cell[1]) << 1 | spreadBits(cell[2]);
+                q.sort_keys[i] = uint64_t(key) << 32 | i;
+            }
+            std::sort(q.sort_keys.begin(), q.sort_keys.end());
+
+            q.next.resize(q.rays.size());
+            for (unsigned int i = 0; i < q.rays.size(); i++) q.next[i] = q.rays[uint32_t(q.sort_keys[i])];
+            std::swap(q.rays, q.next);
+        }
+
+        static uint32_t octant(const vec3 &direction){
+            return uint32_t(direction.x < 0) | uint32_t(direction.y < 0) << 1 | uint32_t(direction.z < 0) << 2;
+        }
+
+        // the 9 low bits of v, 3 bits apart
+        static uint32_t spreadBits(uint32_t v){
+            v &= 0x1ff;
+            v = (v | v << 16) & 0x030000ff;
+            v = (v | v << 8) & 0x0300f00f;
+            v = (v | v << 4) & 0x030c30c3;
+            v = (v | v << 2) & 0x09249249;
+            return v;
+        }
+
+        static void measureCoherence(const std::vector<WavefrontRay> &rays, RayCoherence &coherence){
+            if (rays.size() < 2) return;
+            AABB bounds;
+            for (const WavefrontRay &r : rays) bounds.grow(r.ray.origin);
+            float diagonal = length(bounds.max - bounds.min);
+            if (diagonal <= 0) diagonal = 1;
+            for (size_t i = 1; i < rays.size(); i++){
+                const Ray &a = rays[i - 1].ray, &b = rays[i].ray;
+                coherence.same_octant += octant(a.direction) == octant(b.direction);
+                coherence.cosine += dot(normalize(a.direction), normalize(b.direction));
+                coherence.distance += length(b.origin - a.origin) / diagonal;
+            }
+            coherence.pairs += rays.size() - 1;
+        }
+
+        // picks the trace function of a frame traced to depth, see TraceSettings
+        void beginTrace(unsigned int depth){
+            frame_depth = depth;
+            frame_kernel = trace_settings.specialized ? selectKernel(std::max(1u, std::min(depth, max_recursion)))
+                                                      : &Renderer::traceGeneric;
+        }
+
+        color trace(const Ray & ray, const std::vector<vertex> &vts, RayCounters &rays, Hit &hitInfo,
+                    AuxSample *aux = nullptr){
+            return (this->*frame_kernel)(ray, vts, rays, hitInfo, aux);
+        }
+
+        color traceGeneric(const Ray & ray, const std::vector<vertex> &vts, RayCounters &rays, Hit &hitInfo,
+                           AuxSample *aux){
+            return traceRay(ray, frame_depth, vts, rays, hitInfo, aux);
+        }
+
+        // the kernels cover the depths up to max_recursion (5)
+        TraceKernel selectKernel(unsigned int depth) const {
+            switch (depth){
+                case 1: return selectKernel<1>();
+                case 2: return selectKernel<2>();
+                case 3: return selectKernel<3>();
+                case 4: return selectKernel<4>();
+                default: return selectKernel<5>();
+            }
+        }
+        template <unsigned int Depth>
+        TraceKernel selectKernel() const {
+            return trace_settings.shadows ? selectKernel<Depth, true>() : selectKernel<Depth, false>();
+        }
+        template <unsigned int Depth, bool Shadows>
+        TraceKernel selectKernel() const {
+            switch (trace_settings.shading){
+                case ShadingModel::Diffuse: return &Renderer::traceKernel<Depth, Shadows, ShadingModel::Diffuse>;
+                case ShadingModel::Flat: return &Renderer::traceKernel<Depth, Shadows, ShadingModel::Flat>;
+                default: return &Renderer::traceKernel<Depth, Shadows, ShadingModel::Phong>;
+            }
+        }
+
+        static AuxSample auxSample(const Hit &hitInfo, const LocalShading &shading){
+            AuxSample sample;
+            sample.normal = shading.normal;
+            sample.depth = hitInfo.dist;
+            sample.albedo = shading.albedo;
+            return sample;
+        }
+
+        bool lightVisible(const Ray &shadow_ray, float light_dist, const std::vector<vertex> &vts, RayCounters &rays) const {
+            // the light is visible if there is no geometry in the direction of the light closer than the light source
+            return !occluded(shadow_ray, light_dist, vts, rays);
+        }
+
+        static Ray objectSpaceRay(const Ray &ray, const Instance &instance){
+            return Ray(vec3(instance.inverse * vec4(ray.origin, 1)), vec3(instance.inverse * vec4(ray.direction, 0)));
+        }
+
+        static Ray reflectedRay(const Ray &ray, const LocalShading &shading){
+            Ray reflected_ray(shading.position, reflect(ray.direction, shading.normal));
+            reflected_ray.origin -= ray.direction * .001f; // this is a small offset to address numerical precision issues
+            return reflected_ray;
+        }
+
+        // calls trace_tile(x0, y0, x1, y1, rays) for every tile of a w x h frame, in parallel, and collects the
+        // timing and ray counts of the tiles in tile_stats and frame_rays
+        template <typename TileFunction>
+        void renderTiles(unsigned int w, unsigned int h, TileFunction &&trace_tile){
+            // tiles are traced row by row, so that each thread writes to a compact region of the frame buffer
+            unsigned int tiles_x = (w + tile_size - 1) / tile_size;
+            unsigned int tiles_y = (h + tile_size - 1) / tile_size;
+            tile_stats.resize(tiles_x * tiles_y);
+
+            pool->parallelFor(tiles_x * tiles_y, [&](unsigned int tile, unsigned int worker){
+                auto tile_start = std::chrono::high_resolution_clock::now();
+                RayCounters rays;
+                unsigned int x0 = (tile % tiles_x) * tile_size, y0 = (tile / tiles_x) * tile_size;
+                unsigned int x1 = std::min(x0 + tile_size, w), y1 = std::min(y0 + tile_size, h);
+
+                trace_tile(x0, y0, x1, y1, rays);
+
+                std::chrono::duration<float, std::milli> tile_time = std::chrono::high_resolution_clock::now() - tile_start;
+                tile_stats[tile] = TileStats{x0, y0, x1 - x0, y1 - y0, worker, tile_time.count(), rays};
+            });
+
+            frame_rays = RayCounters();
+            for (const TileStats &tile : tile_stats) frame_rays += tile.rays;
+        }
+
+        // projects the hits of the cached frame into the view of camera, keeping the closest one landing on each
+        // pixel, and makes it the cached frame. cache.holes gets the pixels that must be traced again. Returns false,
+        // leaving the cache as it was, if there are too many of them
+        bool reproject(const PrimaryRays &camera){
+            ReprojectionCache &cache = reprojection;
+            unsigned int W = camera.width, H = camera.height, pixel_count = W * H;
+            vec3 cam_pos(camera.cam_pos);
+            cache.next_dist.assign(pixel_count, FLT_MAX);
+            cache.next_age.assign(pixel_count, ReprojectionCache::no_hit);
+            cache.next_positions.resize(pixel_count);
+            cache.next_colors.resize(pixel_count);
 
+            for (unsigned int p = 0; p < pixel_count; p++){
+                // each pixel expires after max_age / 2 to max_age frames, so that they don't all expire in the same frame
+                unsigned int max_age = max_reprojection_age - hashPCG(p) % (max_reprojection_age / 2 + 1);
+                if (cache.age[p] == ReprojectionCache::no_hit || cache.age[p] + 1u >= max_age) continue;
+                vec2 pixel;
+                if (!camera.project(cache.positions[p], pixel)) continue;
+                // primary rays go through the pixel corners, the closest one is at the rounded position
+                float c = floor(pixel.x + .5f), r = floor(pixel.y + .5f);
+                if (!(c >= 0 && r >= 0 && c < float(W) && r < float(H))) continue;
+                unsigned int q = unsigned(c) + unsigned(r) * W;
+                float dist = length(cache.positions[p] - cam_pos);
+                if (dist < cache.next_dist[q]) {
+                    cache.next_dist[q] = dist;
+                    cache.next_positions[q] = cache.positions[p];
+                    cache.next_colors[q] = cache.colors[p];
+                    cache.next_age[q] = (unsigned char) (cache.age[p] + 1);
+                }
+            }
+
+            // pixels without a hit, and pixels next to a hit that is much closer: when a surface is magnified its hits
+            // spread apart, and the gaps between them get filled with hits from surfaces that should be hidden
+            const float discontinuity = 0.9f;
+            cache.holes.clear();
+            for (unsigned int r = 0; r < H; r++){
+                for (unsigned int c = 0; c < W; c++){
+                    unsigned int q = c + r * W;
+                    float limit = cache.next_dist[q] * discontinuity;
+                    bool hole = cache.next_age[q] == ReprojectionCache::no_hit ||
+                                (c > 0 && cache.next_dist[q - 1] < limit) || (c + 1 < W && cache.next_dist[q + 1] < limit) ||
+                                (r > 0 && cache.next_dist[q - W] < limit) || (r + 1 < H && cache.next_dist[q + W] < limit);
+                    if (hole) cache.holes.push_back(q);
+                }
+            }
+            if (cache.holes.size() > max_hole_fraction * pixel_count) return false;
+
+            std::swap(cache.positions, cache.next_positions);
+            std::swap(cache.colors, cache.next_colors);
+            std::swap(cache.age, cache.next_age);
             return true;
         }
+
+        // traces pixel (c, r) into the reprojection cache
+        void tracePixel(unsigned int c, unsigned int r, const PrimaryRays &camera,
+                        const std::vector<vertex> &vts, RayCounters &rays){
+            ReprojectionCache &cache = reprojection;
+            unsigned int p = c + r * camera.width;
+            uint64_t work = rays.work();
+            Hit hit;
+            Ray ray = camera.generate(float(c), float(r));
+            cache.colors[p] = trace(ray, vts, rays, hit);
+            cache.age[p] = hit.hit_ID < 0 ? ReprojectionCache::no_hit : 0;
+            if (hit.hit_ID >= 0) cache.positions[p] = ray.origin + ray.direction * hit.dist;
+            addPixelCost(p, rays, work);
+        }
+
+        // calls job(i, rays) for every i in [0, count), in parallel, in batches of consecutive indices. What the jobs
+        // count in rays is added to frame_rays
+        template <typename Job>
+        void parallelRange(unsigned int count, Job &&job){
+            const unsigned int batch = 256;
+            std::vector<RayCounters> worker_rays(pool->size());
+            pool->parallelFor((count + batch - 1) / batch, [&](unsigned int b, unsigned int worker){
+                // counted locally, the counters of the workers share cache lines
+                RayCounters rays;
+                unsigned int end = std::min(count, (b + 1) * batch);
+                for (unsigned int i = b * batch; i < end; i++) job(i, rays);
+                worker_rays[worker] += rays;
+            });
+            for (const RayCounters &rays : worker_rays) frame_rays += rays;
+        }
+
+        // the hdr frame, reallocated when the size of the frame changes
+        FrameBuffer<color> &hdrTarget(unsigned int w, unsigned int h){
+            if (!hdr_frame || hdr_frame->W != w || hdr_frame->H != h) hdr_frame.reset(new FrameBuffer<color>(w, h));
+            return *hdr_frame;
+        }
+
+        // the aux samples of a frame of pixel_count pixels, null when denoising is disabled
+        AuxSample *auxTarget(unsigned int pixel_count){
+            if (!denoise_settings.enabled) return nullptr;
+            aux.resize(pixel_count);
+            return aux.data();
+        }
+
+        // denoises hdr_frame into denoised_frame if denoise is true, with the settings of denoise_settings. Each pass
+        // filters the rows in parallel, from the previous pass into a scratch frame
+        void denoiseFrame(bool denoise){
+            frame_denoised = denoise && denoise_settings.iterations > 0;
+            denoise_ms = 0;
+            if (!frame_denoised) return;
+
+            auto start = std::chrono::high_resolution_clock::now();
+            const FrameBuffer<color> &hdr = *hdr_frame;
+            unsigned int W = hdr.W, H = hdr.H;
+            if (!denoised_frame || denoised_frame->W != W || denoised_frame->H != H)
+                denoised_frame.reset(new FrameBuffer<color>(W, H));
+            denoise_scratch.resize(W * H);
+
+            const color *src = hdr.buffer;
+            float sigma_color = denoise_settings.sigma_color;
+            for (unsigned int i = 0; i < denoise_settings.iterations; i++){
+                // the passes alternate between the two buffers, so that the last one ends in denoised_frame
+                color *dst = (denoise_settings.iterations - 1 - i) % 2 == 0 ? denoised_frame->buffer : denoise_scratch.data();
+                pool->parallelFor(H, [&](unsigned int row, unsigned int){
+                    denoise::filterRow(src, dst, aux.data(), W, H, row, 1u << i, sigma_color, denoise_settings);
+                });
+                src = dst;
+                sigma_color *= 0.5f;
+            }
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            denoise_ms = elapsed.count();
+        }
+
+        // clears the pixel cost map for a frame of pixel_count pixels, when it is recorded
+        void beginPixelCost(unsigned int pixel_count){
+            if (record_pixel_cost) pixel_cost.assign(pixel_count, 0);
+            else pixel_cost.clear();
+        }
+
+        // the wide bvh can be missing in the wide format, when bvh has a leaf too large for its nodes
+        bool useWideBVH() const { return bvh_format == BVHFormat::Wide && !wide_bvh.empty(); }
+
+        void buildWideBVH(){
+            if (bvh_format == BVHFormat::Wide && !bvh.empty()) wide_bvh.build(bvh);
+            else wide_bvh = WideBVH();
+        }
+
+        // adds the work counted in rays since it was work_before to the cost of pixel p, when it is recorded
+        void addPixelCost(unsigned int p, const RayCounters &rays, uint64_t work_before){
+            if (record_pixel_cost) pixel_cost[p] += uint32_t(rays.work() - work_before);
+        }
+
+        // traces the instances or the mapped mesh when set, otherwise uses the bvh when it was built for this vertex list,
+        // and falls back to testing every triangle. The work done is added to rays
+        bool intersect(const Ray & ray, const std::vector<vertex> &vts, Hit &hit, RayCounters &rays) const {
+            bool found;
+            if (instances)
+                found = rayInstancesIntersection(ray, *instances, hit, kernel, &rays);
+            else if (mapped_mesh)
+                found = rayMappedIntersection(ray, *mapped_mesh, hit, kernel, &rays);
+            else if (bvh_vts == &vts && bvh.triangleCount() * 3 == vts.size())
+                found = useWideBVH() ? rayModelIntersection(ray, wide_bvh, triangles, hit, kernel, &rays)
+                                     : rayModelIntersection(ray, bvh, triangles, hit, kernel, &rays);
+            else
+                found = rayModelIntersection(ray, vts, hit, &rays);
+            rays.hits += found;
+            return found;
+        }
+
+        // same as intersect, for an any-hit query closer than max_dist
+        bool occluded(const Ray & ray, float max_dist, const std::vector<vertex> &vts, RayCounters &rays) const {
+            bool blocked;
+            if (instances)
+                blocked = rayInstancesOccluded(ray, *instances, max_dist, kernel, &rays);
+            else if (mapped_mesh)
+                blocked = rayMappedOccluded(ray, *mapped_mesh, max_dist, kernel, &rays);
+            else if (bvh_vts == &vts && bvh.triangleCount() * 3 == vts.size())
+                blocked = useWideBVH() ? rayModelOccluded(ray, wide_bvh, triangles, max_dist, kernel, &rays)
+                                       : rayModelOccluded(ray, bvh, triangles, max_dist, kernel, &rays);
+            else
+                blocked = rayModelOccluded(ray, vts, max_dist, &rays);
+            rays.occluded += blocked;
+            return blocked;
+        }
     };
 }
 
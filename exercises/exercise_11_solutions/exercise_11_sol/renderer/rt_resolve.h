@@ -0,0 +1,137 @@
+//
+// Resolve pass: converts the linear (HDR) colors of a traced frame to packed 8 bit RGBA, with exposure, tone mapping
+// and sRGB encoding.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_RESOLVE_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_RESOLVE_H
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_simd.h"
+
+namespace rt{
+
+    enum class ToneMapping{
+        Clamp,    // colors above 1 are clipped, same as Colors::toRGBA32
+        Reinhard, // c / (1 + c), never clips but desaturates the bright colors
+        ACES      // filmic curve (Narkowicz's fit of the ACES reference transform)
+    };
+
+    struct ResolveSettings{
+        float exposure = 1.0f; // scale applied to the linear colors before tone mapping
+        ToneMapping tone_mapping = ToneMapping::Clamp;
+        bool srgb = false;     // encode with the sRGB transfer curve, the traced colors are linear
+
+        bool operator==(const ResolveSettings &other) const {
+            return exposure == other.exposure && tone_mapping == other.tone_mapping && srgb == other.srgb;
+        }
+    };
+
+    namespace resolve{
+
+        // linear [0, 1] to 8 bit sRGB, sampled at lut_size points. The curve is steep near 0, but a step of the table
+        // there is still less than one 8 bit step of the output
+        const unsigned int lut_size = 4096;
+
+        struct SRGBTable{
+            unsigned char values[lut_size];
+            SRGBTable(){
+                for (unsigned int i = 0; i < lut_size; i++){
+                    float v = float(i) / (lut_size - 1);
+                    float s = v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+                    values[i] = (unsigned char) std::min(255.0f, s * 255.0f + 0.5f);
+                }
+            }
+        };
+
+        inline const SRGBTable &srgbTable(){
+            static const SRGBTable table;
+            return table;
+        }
+
+        inline float toneMap(float c, ToneMapping tone_mapping){
+            switch (tone_mapping){
+                case ToneMapping::Reinhard: return c / (1.0f + c);
+                case ToneMapping::ACES: return (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f);
+                default: return c;
+            }
+        }
+
+        // one pixel, alpha is only clamped
+        inline uint32_t resolvePixel(const Colors::color &c, const ResolveSettings &settings){
+            if (settings.tone_mapping == ToneMapping::Clamp && settings.exposure == 1.0f && !settings.srgb)
+                return Colors::toRGBA32(c);
+
+            uint32_t packed = 0;
+            for (int k = 0; k < 3; k++){
+                float v = glm::clamp(toneMap(c[k] * settings.exposure, settings.tone_mapping), 0.0f, 1.0f);
+                uint32_t byte = settings.srgb ? srgbTable().values[(unsigned int) (v * (lut_size - 1) + 0.5f)]
+                                              : uint32_t(255 * v);
+                packed |= byte << (8 * k);
+            }
+            return packed | (uint32_t(255 * glm::clamp(c.a, 0.0f, 1.0f)) << 24);
+        }
+
+#ifdef RT_SIMD_X86
+        // tone maps and clamps one pixel (r, g, b, a) held in a register, alpha is only clamped
+        inline __m128 toneMap4(__m128 c, const ResolveSettings &settings, __m128 exposure, __m128 rgb_mask){
+            c = _mm_mul_ps(c, exposure);
+            const __m128 one = _mm_set1_ps(1.0f);
+            __m128 mapped = c;
+            if (settings.tone_mapping == ToneMapping::Reinhard)
+                mapped = _mm_div_ps(c, _mm_add_ps(one, c));
+            else if (settings.tone_mapping == ToneMapping::ACES) {
+                __m128 num = _mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), c), _mm_set1_ps(0.03f)));
+                __m128 den = _mm_add_ps(_mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), c), _mm_set1_ps(0.59f))),
+                                        _mm_set1_ps(0.14f));
+                mapped = _mm_div_ps(num, den);
+            }
+            c = _mm_or_ps(_mm_and_ps(rgb_mask, mapped), _mm_andnot_ps(rgb_mask, c));
+            return _mm_min_ps(_mm_max_ps(c, _mm_setzero_ps()), one);
+        }
+#endif
+
+        // converts count linear colors to packed RGBA (as Colors::toRGBA32), 4 pixels at a time with SSE: each pixel
+        // fills a register, and 4 of them are narrowed to 16 bytes with two saturating packs
+        inline void resolveRow(const Colors::color *src, uint32_t *dst, unsigned int count,
+                               const ResolveSettings &settings){
+            unsigned int i = 0;
+#ifdef RT_SIMD_X86
+            const __m128 exposure = _mm_setr_ps(settings.exposure, settings.exposure, settings.exposure, 1.0f);
+            const __m128 rgb_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+            const __m128 scale = _mm_set1_ps(255.0f);
+            if (!settings.srgb) {
+                for (; i + 4 <= count; i += 4){
+                    __m128i p[4];
+                    for (int k = 0; k < 4; k++){
+                        __m128 c = toneMap4(_mm_loadu_ps((const float *) &src[i + k]), settings, exposure, rgb_mask);
+                        p[k] = _mm_cvttps_epi32(_mm_mul_ps(c, scale)); // truncates, as toRGBA32
+                    }
+                    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(p[0], p[1]), _mm_packs_epi32(p[2], p[3]));
+                    _mm_storeu_si128((__m128i *) &dst[i], packed);
+                }
+            }
+            else {
+                // the table lookups are scalar, the rest is SIMD
+                const unsigned char *lut = srgbTable().values;
+                const __m128 lut_scale = _mm_setr_ps(lut_size - 1, lut_size - 1, lut_size - 1, 255.0f);
+                const __m128 half = _mm_setr_ps(0.5f, 0.5f, 0.5f, 0.0f);
+                alignas(16) int32_t index[4];
+                for (; i < count; i++){
+                    __m128 c = toneMap4(_mm_loadu_ps((const float *) &src[i]), settings, exposure, rgb_mask);
+                    _mm_store_si128((__m128i *) index, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, lut_scale), half)));
+                    dst[i] = uint32_t(lut[index[0]]) | (uint32_t(lut[index[1]]) << 8) | (uint32_t(lut[index[2]]) << 16) |
+                             (uint32_t(index[3]) << 24);
+                }
+            }
+#endif
+            for (; i < count; i++) dst[i] = resolvePixel(src[i], settings);
+        }
+    }
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_RESOLVE_H
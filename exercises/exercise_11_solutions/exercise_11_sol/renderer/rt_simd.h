@@ -0,0 +1,242 @@
+//
+// SIMD versions of the ray/triangle intersection test, one ray against 4 (SSE) or 8 (AVX2) triangles at once.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_SIMD_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_SIMD_H
+
+#include <cfloat>
+#include "rt_types.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define RT_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// the AVX2 kernel is compiled for AVX2 regardless of the compiler flags, and only called when the cpu supports it
+#if defined(RT_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RT_TARGET_AVX2
+#endif
+
+namespace rt{
+
+    enum class IntersectionKernel{
+        Scalar, // one triangle at a time, Renderer::rayTriangleIntersection
+        SSE,    // 4 triangles at a time
+        AVX2,   // 8 triangles at a time
+        Auto    // the widest kernel supported by the cpu
+    };
+
+    namespace simd{
+
+        // a group of consecutive triangles, stored as one array per component of the first vertex and the two edges
+        struct TrianglePacket{
+            const float *v0[3];
+            const float *e1[3];
+            const float *e2[3];
+        };
+
+        inline bool cpuSupportsSSE(){
+#ifdef RT_SIMD_X86
+            return true; // part of the x86-64 baseline
+#else
+            return false;
+#endif
+        }
+
+        inline bool cpuSupportsAVX2(){
+#if defined(RT_SIMD_X86) && defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7) return false;
+            __cpuid(info, 1);
+            bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6; // osxsave, and xmm/ymm state enabled
+            __cpuidex(info, 7, 0);
+            return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+#elif defined(RT_SIMD_X86)
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        }
+
+        // resolves Auto, and replaces kernels the cpu can't run with the next narrower one
+        inline IntersectionKernel resolve(IntersectionKernel kernel){
+            if (kernel == IntersectionKernel::Auto)
+                kernel = IntersectionKernel::AVX2;
+            if (kernel == IntersectionKernel::AVX2 && !cpuSupportsAVX2())
+                kernel = IntersectionKernel::SSE;
+            if (kernel == IntersectionKernel::SSE && !cpuSupportsSSE())
+                kernel = IntersectionKernel::Scalar;
+            return kernel;
+        }
+
+        // number of triangles tested at once
+        inline unsigned int width(IntersectionKernel kernel){
+            switch (kernel){
+                case IntersectionKernel::SSE: return 4;
+                case IntersectionKernel::AVX2: return 8;
+                default: return 1;
+            }
+        }
+
+        inline const char *name(IntersectionKernel kernel){
+            switch (kernel){
+                case IntersectionKernel::SSE: return "SSE (4-wide)";
+                case IntersectionKernel::AVX2: return "AVX2 (8-wide)";
+                case IntersectionKernel::Auto: return "auto";
+                default: return "scalar";
+            }
+        }
+
+#ifdef RT_SIMD_X86
+        // Moller-Trumbore against the 4 triangles of the packet, the arrays must be readable for 4 floats.
+        // the operations are the same, and in the same order, as in Renderer::rayTriangleIntersection, so that both
+        // paths produce the same image. Returns the mask of the lanes hit in front of the ray, and their t, u and v
+        inline __m128 hitMask4(const Ray &ray, const TrianglePacket &tris, __m128 &tt, __m128 &uu, __m128 &vv){
+            const __m128 tolerance = _mm_set1_ps(10e-7f);
+            const __m128 sign_mask = _mm_set1_ps(-0.0f);
+
+            __m128 e1x = _mm_loadu_ps(tris.e1[0]), e1y = _mm_loadu_ps(tris.e1[1]), e1z = _mm_loadu_ps(tris.e1[2]);
+            __m128 e2x = _mm_loadu_ps(tris.e2[0]), e2y = _mm_loadu_ps(tris.e2[1]), e2z = _mm_loadu_ps(tris.e2[2]);
+            __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+
+            // q = cross(direction, e2), a = dot(e1, q)
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+            __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, qx), _mm_mul_ps(e1y, qy)), _mm_mul_ps(e1z, qz));
+            __m128 valid = _mm_cmpnlt_ps(_mm_andnot_ps(sign_mask, a), tolerance);
+
+            __m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+            // s = origin - v0, u = f * dot(s, q)
+            __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_loadu_ps(tris.v0[0]));
+            __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_loadu_ps(tris.v0[1]));
+            __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_loadu_ps(tris.v0[2]));
+            uu = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, qx), _mm_mul_ps(sy, qy)), _mm_mul_ps(sz, qz)));
+            valid = _mm_and_ps(valid, _mm_cmpnlt_ps(uu, _mm_sub_ps(_mm_setzero_ps(), tolerance)));
+
+            // r = cross(s, e1), v = f * dot(direction, r)
+            __m128 rx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+            __m128 ry = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+            __m128 rz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+            vv = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, rx), _mm_mul_ps(dy, ry)), _mm_mul_ps(dz, rz)));
+            valid = _mm_and_ps(valid, _mm_cmpnlt_ps(vv, _mm_sub_ps(_mm_setzero_ps(), tolerance)));
+            valid = _mm_and_ps(valid, _mm_cmpngt_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1.0f)));
+
+            // t = f * dot(e2, r)
+            tt = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, rx), _mm_mul_ps(e2y, ry)), _mm_mul_ps(e2z, rz)));
+            return _mm_and_ps(valid, _mm_cmpnlt_ps(tt, _mm_setzero_ps()));
+        }
+
+        // hits among the first count (<= 4) triangles of the packet, up to t_max included so that the caller can break
+        // ties with the current hit. Returns the mask of the lanes hit, their t, u and v are written to the arrays
+        inline int intersect4(const Ray &ray, const TrianglePacket &tris, unsigned int count, float t_max,
+                              float *t, float *u, float *v){
+            __m128 tt, uu, vv;
+            __m128 hit = hitMask4(ray, tris, tt, uu, vv);
+            hit = _mm_and_ps(hit, _mm_cmple_ps(tt, _mm_set1_ps(t_max)));
+            int mask = _mm_movemask_ps(hit) & ((1 << count) - 1);
+            if (mask == 0) return 0;
+            _mm_storeu_ps(t, tt);
+            _mm_storeu_ps(u, uu);
+            _mm_storeu_ps(v, vv);
+            return mask;
+        }
+
+        // true if any of the first count (<= 4) triangles of the packet is hit closer than t_max
+        inline bool occluded4(const Ray &ray, const TrianglePacket &tris, unsigned int count, float t_max){
+            __m128 tt, uu, vv;
+            __m128 hit = hitMask4(ray, tris, tt, uu, vv);
+            hit = _mm_and_ps(hit, _mm_cmplt_ps(tt, _mm_set1_ps(t_max)));
+            return (_mm_movemask_ps(hit) & ((1 << count) - 1)) != 0;
+        }
+
+        // same as hitMask4, for 8 triangles, the arrays must be readable for 8 floats
+        RT_TARGET_AVX2
+        inline __m256 hitMask8(const Ray &ray, const TrianglePacket &tris, __m256 &tt, __m256 &uu, __m256 &vv){
+            const __m256 tolerance = _mm256_set1_ps(10e-7f);
+            const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+
+            __m256 e1x = _mm256_loadu_ps(tris.e1[0]), e1y = _mm256_loadu_ps(tris.e1[1]), e1z = _mm256_loadu_ps(tris.e1[2]);
+            __m256 e2x = _mm256_loadu_ps(tris.e2[0]), e2y = _mm256_loadu_ps(tris.e2[1]), e2z = _mm256_loadu_ps(tris.e2[2]);
+            __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+
+            __m256 qx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+            __m256 qy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+            __m256 qz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+            __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, qx), _mm256_mul_ps(e1y, qy)), _mm256_mul_ps(e1z, qz));
+            __m256 valid = _mm256_cmp_ps(_mm256_andnot_ps(sign_mask, a), tolerance, _CMP_NLT_UQ);
+
+            __m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+            __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_loadu_ps(tris.v0[0]));
+            __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_loadu_ps(tris.v0[1]));
+            __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_loadu_ps(tris.v0[2]));
+            uu = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, qx), _mm256_mul_ps(sy, qy)), _mm256_mul_ps(sz, qz)));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(uu, _mm256_sub_ps(_mm256_setzero_ps(), tolerance), _CMP_NLT_UQ));
+
+            __m256 rx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+            __m256 ry = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+            __m256 rz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+            vv = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, rx), _mm256_mul_ps(dy, ry)), _mm256_mul_ps(dz, rz)));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(vv, _mm256_sub_ps(_mm256_setzero_ps(), tolerance), _CMP_NLT_UQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(uu, vv), _mm256_set1_ps(1.0f), _CMP_NGT_UQ));
+
+            tt = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, rx), _mm256_mul_ps(e2y, ry)), _mm256_mul_ps(e2z, rz)));
+            return _mm256_and_ps(valid, _mm256_cmp_ps(tt, _mm256_setzero_ps(), _CMP_NLT_UQ));
+        }
+
+        // same as intersect4, for up to 8 triangles
+        RT_TARGET_AVX2
+        inline int intersect8(const Ray &ray, const TrianglePacket &tris, unsigned int count, float t_max,
+                              float *t, float *u, float *v){
+            __m256 tt, uu, vv;
+            __m256 hit = hitMask8(ray, tris, tt, uu, vv);
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(tt, _mm256_set1_ps(t_max), _CMP_LE_OQ));
+            int mask = _mm256_movemask_ps(hit) & ((1 << count) - 1);
+            if (mask == 0) return 0;
+            _mm256_storeu_ps(t, tt);
+            _mm256_storeu_ps(u, uu);
+            _mm256_storeu_ps(v, vv);
+            return mask;
+        }
+
+        // same as occluded4, for up to 8 triangles
+        RT_TARGET_AVX2
+        inline bool occluded8(const Ray &ray, const TrianglePacket &tris, unsigned int count, float t_max){
+            __m256 tt, uu, vv;
+            __m256 hit = hitMask8(ray, tris, tt, uu, vv);
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(tt, _mm256_set1_ps(t_max), _CMP_LT_OQ));
+            return (_mm256_movemask_ps(hit) & ((1 << count) - 1)) != 0;
+        }
+#endif
+
+        // dispatches to the kernel of the given width, which must be supported by the cpu (see resolve).
+        // t, u and v must hold width(kernel) floats
+        inline int intersect(IntersectionKernel kernel, const Ray &ray, const TrianglePacket &tris, unsigned int count,
+                             float t_max, float *t, float *u, float *v){
+#ifdef RT_SIMD_X86
+            if (kernel == IntersectionKernel::AVX2) return intersect8(ray, tris, count, t_max, t, u, v);
+            if (kernel == IntersectionKernel::SSE) return intersect4(ray, tris, count, t_max, t, u, v);
+#endif
+            return 0;
+        }
+
+        // true if any of the first count triangles of the packet is hit closer than t_max
+        inline bool occluded(IntersectionKernel kernel, const Ray &ray, const TrianglePacket &tris, unsigned int count,
+                             float t_max){
+#ifdef RT_SIMD_X86
+            if (kernel == IntersectionKernel::AVX2) return occluded8(ray, tris, count, t_max);
+            if (kernel == IntersectionKernel::SSE) return occluded4(ray, tris, count, t_max);
+#endif
+            return false;
+        }
+    }
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_SIMD_H
@@ -0,0 +1,142 @@
+//
+// Small work-stealing thread pool used to spread the rendering work over the available cores.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_THREAD_POOL_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+namespace rt{
+
+    // each worker owns a contiguous range of job indices, it takes jobs from the front of its own range and, once it
+    // runs out, steals from the back of the other workers' ranges. This keeps neighbouring jobs (e.g. tiles) on the
+    // same thread while still balancing the load when some jobs are much more expensive than others.
+    // the thread calling parallelFor takes part in the work as worker 0.
+    class ThreadPool{
+    public:
+        // 0 means one thread per hardware core
+        explicit ThreadPool(unsigned int thread_count = 0){
+            if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+            if (thread_count == 0) thread_count = 1;
+
+            queues.reset(new WorkQueue[thread_count]);
+            worker_count = thread_count;
+            for (unsigned int i = 1; i < thread_count; i++)
+                threads.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+
+        ~ThreadPool(){
+            {
+                std::lock_guard<std::mutex> lock(batch_mutex);
+                stop = true;
+            }
+            batch_start.notify_all();
+            for (std::thread &t : threads) t.join();
+        }
+
+        ThreadPool(ThreadPool const&) = delete;
+        void operator=(ThreadPool const&) = delete;
+
+        unsigned int size() const { return worker_count; }
+
+        // calls job(index, worker) for every index in [0, count), and returns once all of them are done.
+        // worker is in [0, size()), it can be used to index per thread data
+        void parallelFor(unsigned int count, const std::function<void(unsigned int, unsigned int)> &job){
+            if (count == 0) return;
+            if (worker_count == 1) {
+                for (unsigned int i = 0; i < count; i++) job(i, 0);
+                return;
+            }
+
+            // split the indices in one contiguous range per worker
+            for (unsigned int w = 0; w < worker_count; w++){
+                std::lock_guard<std::mutex> lock(queues[w].mutex);
+                queues[w].begin = (unsigned int) ((unsigned long long) count * w / worker_count);
+                queues[w].end = (unsigned int) ((unsigned long long) count * (w + 1) / worker_count);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(batch_mutex);
+                current_job = &job;
+                busy_workers = worker_count - 1;
+                generation++;
+            }
+            batch_start.notify_all();
+
+            runJobs(0);
+
+            std::unique_lock<std::mutex> lock(batch_mutex);
+            batch_done.wait(lock, [this]{ return busy_workers == 0; });
+            current_job = nullptr;
+        }
+
+    private:
+        struct WorkQueue{
+            std::mutex mutex;
+            unsigned int begin = 0, end = 0;
+            // keeps neighbouring queues on different cache lines, so workers don't invalidate each other's queues
+            char padding[64];
+        };
+
+        std::unique_ptr<WorkQueue[]> queues;
+        std::vector<std::thread> threads;
+        unsigned int worker_count = 1;
+
+        std::mutex batch_mutex;
+        std::condition_variable batch_start, batch_done;
+        const std::function<void(unsigned int, unsigned int)> *current_job = nullptr;
+        unsigned int busy_workers = 0;
+        unsigned long long generation = 0;
+        bool stop = false;
+
+        void workerLoop(unsigned int worker){
+            unsigned long long seen_generation = 0;
+            while (true){
+                {
+                    std::unique_lock<std::mutex> lock(batch_mutex);
+                    batch_start.wait(lock, [&]{ return stop || generation != seen_generation; });
+                    if (stop) return;
+                    seen_generation = generation;
+                }
+
+                runJobs(worker);
+
+                std::lock_guard<std::mutex> lock(batch_mutex);
+                if (--busy_workers == 0) batch_done.notify_one();
+            }
+        }
+
+        void runJobs(unsigned int worker){
+            unsigned int index;
+            while (popLocal(worker, index) || steal(worker, index))
+                (*current_job)(index, worker);
+        }
+
+        bool popLocal(unsigned int worker, unsigned int &index){
+            WorkQueue &q = queues[worker];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.begin == q.end) return false;
+            index = q.begin++;
+            return true;
+        }
+
+        bool steal(unsigned int worker, unsigned int &index){
+            for (unsigned int i = 1; i < worker_count; i++){
+                WorkQueue &q = queues[(worker + i) % worker_count];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (q.begin == q.end) continue;
+                index = --q.end;
+                return true;
+            }
+            return false;
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_THREAD_POOL_H
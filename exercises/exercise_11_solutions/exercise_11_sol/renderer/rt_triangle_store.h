@@ -0,0 +1,79 @@
+//
+// Compact, intersection-only copy of the triangles of a vertex list, stored as a structure of arrays (SoA).
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_TRIANGLE_STORE_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_TRIANGLE_STORE_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_simd.h"
+
+namespace rt{
+
+    // an rt::vertex is 56 bytes, so a triangle drags 168 bytes of positions, normals, colors and uvs through the cache
+    // every time it is tested. The store keeps only what the intersection test needs, the first vertex and the two
+    // edges (36 bytes per triangle), precomputed and laid out one array per component so that consecutive triangles
+    // can be loaded straight into SIMD registers.
+    // shading attributes are not copied: on a hit, triangleID() gives the triangle in the original vertex list, which
+    // is only read at that point
+    class TriangleStore{
+    public:
+        // arrays are padded so that a SIMD load starting at any triangle stays in bounds
+        static const unsigned int padding = 8;
+
+        // stores the triangles of vts in the given order, triangle i of the store is triangle order[i] of vts
+        // (the triangle made of the vertices 3 * order[i], 3 * order[i] + 1 and 3 * order[i] + 2)
+        void build(const std::vector<vertex> &vts, const std::vector<unsigned int> &order){
+            unsigned int count = (unsigned int) order.size();
+            ids = order;
+            for (std::vector<float> &component : components)
+                component.assign(count + padding, 0.0f); // zero edges, padding triangles can never be hit
+
+            for (unsigned int i = 0; i < count; i++){
+                const vertex *p = &vts[order[i] * 3];
+                for (int k = 0; k < 3; k++){
+                    components[k][i] = p[0].pos[k];
+                    components[3 + k][i] = p[1].pos[k] - p[0].pos[k];
+                    components[6 + k][i] = p[2].pos[k] - p[0].pos[k];
+                }
+            }
+        }
+
+        // stores the triangles of vts in their original order
+        void build(const std::vector<vertex> &vts){
+            std::vector<unsigned int> order(vts.size() / 3);
+            for (unsigned int i = 0; i < order.size(); i++) order[i] = i;
+            build(vts, order);
+        }
+
+        unsigned int size() const { return (unsigned int) ids.size(); }
+        // index of the triangle in the original vertex list (first vertex / 3)
+        unsigned int triangleID(unsigned int i) const { return ids[i]; }
+
+        glm::vec3 v0(unsigned int i) const { return glm::vec3(components[0][i], components[1][i], components[2][i]); }
+        glm::vec3 e1(unsigned int i) const { return glm::vec3(components[3][i], components[4][i], components[5][i]); }
+        glm::vec3 e2(unsigned int i) const { return glm::vec3(components[6][i], components[7][i], components[8][i]); }
+
+        // the triangles starting at first, for the SIMD kernels
+        simd::TrianglePacket packet(unsigned int first) const {
+            return simd::TrianglePacket{
+                {&components[0][first], &components[1][first], &components[2][first]},
+                {&components[3][first], &components[4][first], &components[5][first]},
+                {&components[6][first], &components[7][first], &components[8][first]}};
+        }
+
+        // memory used by the store
+        size_t bytes() const {
+            return components[0].size() * sizeof(float) * 9 + ids.size() * sizeof(unsigned int);
+        }
+
+    private:
+        // v0.x, v0.y, v0.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z
+        std::vector<float> components[9];
+        std::vector<unsigned int> ids;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_TRIANGLE_STORE_H
@@ -5,6 +5,8 @@
 #ifndef ITU_GRAPHICS_PROGRAMMING_RT_TYPES_H
 #define ITU_GRAPHICS_PROGRAMMING_RT_TYPES_H
 
+#include <cstdint>
+#include <cfloat>
 #include "glm/glm.hpp"
 
 namespace rt{
@@ -31,6 +33,7 @@ namespace rt{
     }
 
     struct Ray{
+        Ray() = default; // uninitialized, for ray queues
         Ray(glm::vec3 orig, glm::vec3 dir): origin(orig), direction(dir){};
         glm::vec3 origin;
         glm::vec3 direction;
@@ -40,6 +43,7 @@ namespace rt{
         int hit_ID = -1; // negative values for no hit, other values for the index of the first vertex in a triangle
         glm::vec3 barycentric; // the barycentric coordinates of the triangle that was hit (if any)
         float dist = FLT_MAX;  // used to store the intersection distance
+        int instance_ID = -1;  // the instance that was hit, when tracing an InstancedScene (hit_ID is in its mesh)
     };
 
     struct vertex {
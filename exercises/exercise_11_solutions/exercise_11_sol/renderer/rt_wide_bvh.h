@@ -0,0 +1,255 @@
+//
+// Compressed 4-wide BVH: the binary BVH collapsed to nodes of up to 4 children, whose bounds are quantized to 8 bits
+// relative to the bounds of their parent, so that a node is one 64 byte cache line.
+//
+
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_WIDE_BVH_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_WIDE_BVH_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_bvh.h"
+#include "rt_simd.h"
+
+namespace rt{
+
+    // the bounds of child i along axis a are origin[a] + lo[a][i] * 2^exponent[a] to origin[a] + hi[a][i] * 2^exponent[a].
+    // a power of two scale makes q * scale exact, and the quantized bounds are rounded outwards, so they always
+    // contain the exact ones
+    struct alignas(64) WideBVHNode{
+        float origin[3];      // min corner of the node bounds
+        int8_t exponent[3];
+        uint8_t child_count;  // children are packed at the front
+        uint8_t lo[3][4];     // per axis, then per child, as the SIMD test loads them
+        uint8_t hi[3][4];
+        uint32_t child[4];    // index of an inner child node, or first triangle of a leaf child
+        uint16_t count[4];    // triangles of a leaf child, 0 for inner children
+    };
+
+    class WideBVH{
+    public:
+        static const unsigned int width = 4;
+        // every node visited pushes at most width - 1 entries, and the tree is no deeper than the binary one
+        static const unsigned int stack_size = (width - 1) * BVH::stack_size + 1;
+
+        // collapses bvh: each node takes the children of a binary node, and keeps opening its inner child with the
+        // largest surface area until it has 4 children. Leaves are the leaves of bvh, so the triangles stay in the
+        // order of bvh.triangleIndices() (the same TriangleStore serves both). Returns false, and stays empty, if bvh
+        // is empty or has a leaf too large for a node
+        bool build(const BVH &bvh){
+            nodes.clear();
+            const std::vector<BVHNode> &src = bvh.getNodes();
+            if (src.empty()) return false;
+
+            nodes.reserve(src.size() / 3 + 1);
+            nodes.push_back(WideBVHNode());
+            // binary node each wide node is made from
+            std::vector<unsigned int> pending{0};
+            for (unsigned int n = 0; n < nodes.size(); n++){
+                const BVHNode &parent = src[pending[n]];
+                unsigned int children[width], child_count = 0;
+                if (parent.isLeaf()) children[child_count++] = pending[n]; // a single leaf root
+                else {
+                    children[child_count++] = parent.left_first;
+                    children[child_count++] = parent.left_first + 1;
+                }
+                while (child_count < width){
+                    int largest = -1;
+                    for (unsigned int i = 0; i < child_count; i++)
+                        if (!src[children[i]].isLeaf() &&
+                            (largest < 0 || src[children[i]].bounds.area() > src[children[largest]].bounds.area()))
+                            largest = (int) i;
+                    if (largest < 0) break;
+                    unsigned int opened = children[largest];
+                    children[largest] = src[opened].left_first;
+                    children[child_count++] = src[opened].left_first + 1;
+                }
+
+                WideBVHNode node{};
+                AABB bounds;
+                for (unsigned int i = 0; i < child_count; i++) bounds.grow(src[children[i]].bounds);
+                for (int a = 0; a < 3; a++){
+                    node.origin[a] = bounds.min[a];
+                    node.exponent[a] = (int8_t) exponentFor(bounds.min[a], bounds.max[a]);
+                }
+                node.child_count = (uint8_t) child_count;
+                for (unsigned int i = 0; i < child_count; i++){
+                    const BVHNode &child = src[children[i]];
+                    for (int a = 0; a < 3; a++){
+                        double scale = std::ldexp(1.0, node.exponent[a]);
+                        node.lo[a][i] = quantize(node.origin[a], scale, child.bounds.min[a], false);
+                        node.hi[a][i] = quantize(node.origin[a], scale, child.bounds.max[a], true);
+                    }
+                    if (child.isLeaf()) {
+                        if (child.count > UINT16_MAX) { nodes.clear(); return false; }
+                        node.child[i] = child.left_first;
+                        node.count[i] = (uint16_t) child.count;
+                    }
+                    else {
+                        node.child[i] = (unsigned int) nodes.size();
+                        nodes.push_back(WideBVHNode());
+                        pending.push_back(children[i]);
+                    }
+                }
+                nodes[n] = node;
+            }
+            return true;
+        }
+
+        bool empty() const { return nodes.empty(); }
+        size_t nodeCount() const { return nodes.size(); }
+        size_t bytes() const { return nodes.size() * sizeof(WideBVHNode); }
+
+        // same contract as BVH::traverse. nodes_visited counts the wide nodes entered, each one tests the bounds of
+        // all its children at once
+        template <typename LeafTest>
+        bool traverse(const Ray &ray, float t_max, LeafTest &&leaf_test, uint64_t *nodes_visited = nullptr) const {
+            if (nodes.empty()) return false;
+            const glm::vec3 inv_dir = 1.0f / ray.direction;
+
+            // postponed children with their entry distance: a node index, or a leaf as its node and slot
+            uint32_t stack[stack_size];
+            float stack_dist[stack_size];
+            unsigned int stack_top = 0;
+            uint32_t current = 0;
+            uint64_t visited = 0;
+
+            while (true){
+                const WideBVHNode &node = nodes[current];
+                visited++;
+                float dist[width];
+                unsigned int mask = childDistances(node, ray.origin, inv_dir, t_max, dist);
+
+                // the children that were hit, closest first
+                uint32_t order[width];
+                float order_dist[width];
+                unsigned int hits = 0;
+                for (unsigned int i = 0; i < width; i++){
+                    if (!(mask & (1u << i))) continue;
+                    uint32_t entry = node.count[i] ? leaf_flag | (current << 2) | i : node.child[i];
+                    unsigned int j = hits++;
+                    for (; j > 0 && order_dist[j - 1] > dist[i]; j--){
+                        order[j] = order[j - 1];
+                        order_dist[j] = order_dist[j - 1];
+                    }
+                    order[j] = entry;
+                    order_dist[j] = dist[i];
+                }
+                // the farthest children go deeper in the stack
+                for (unsigned int j = hits; j-- > 1;){
+                    stack[stack_top] = order[j];
+                    stack_dist[stack_top++] = order_dist[j];
+                }
+
+                uint32_t next = hits > 0 ? order[0] : 0;
+                while (true){
+                    if (hits > 0 && !(next & leaf_flag)) break;
+                    if (hits > 0 && leafTest(next, t_max, leaf_test)) {
+                        if (nodes_visited) *nodes_visited += visited;
+                        return true;
+                    }
+                    // pop the next child that can still contain a closer hit
+                    do {
+                        if (stack_top == 0) {
+                            if (nodes_visited) *nodes_visited += visited;
+                            return false;
+                        }
+                        stack_top--;
+                    } while (stack_dist[stack_top] > t_max);
+                    next = stack[stack_top];
+                    hits = 1;
+                }
+                current = next;
+            }
+        }
+
+    private:
+        static const uint32_t leaf_flag = 0x80000000u;
+        std::vector<WideBVHNode> nodes;
+
+        template <typename LeafTest>
+        bool leafTest(uint32_t entry, float &t_max, LeafTest &leaf_test) const {
+            const WideBVHNode &node = nodes[(entry & ~leaf_flag) >> 2];
+            unsigned int slot = entry & 3;
+            return leaf_test(node.child[slot], node.count[slot], t_max);
+        }
+
+        // smallest exponent whose 255 steps from min reach max
+        static int exponentFor(float min, float max){
+            int e = -126;
+            if (max > min) {
+                std::frexp(double(max - min) / 255.0, &e);
+                e = std::max(e, -126);
+            }
+            while (e < 127 && double(min) + 255.0 * std::ldexp(1.0, e) < double(max)) e++;
+            return e;
+        }
+
+        // the quantized bound of value, rounded down (lower bounds) or up (upper bounds). Checked in double, where
+        // origin + q * scale is exact: the float result of the same sum is a rounding of it, and rounding never
+        // crosses value, which is a float itself
+        static uint8_t quantize(float origin, double scale, float value, bool upper){
+            double q = (double(value) - origin) / scale;
+            int i = (int) glm::clamp(upper ? std::ceil(q) : std::floor(q), 0.0, 255.0);
+            if (upper) while (i < 255 && origin + i * scale < value) i++;
+            else while (i > 0 && origin + i * scale > value) i--;
+            return (uint8_t) i;
+        }
+
+        static float scaleOf(int8_t exponent){
+            uint32_t bits = uint32_t(exponent + 127) << 23;
+            float scale;
+            memcpy(&scale, &bits, sizeof(scale));
+            return scale;
+        }
+
+        // slab test of the children of node, returns a bit per child hit closer than t_max, with its entry distance
+        // in dist (same as AABB::intersect)
+        static unsigned int childDistances(const WideBVHNode &node, const glm::vec3 &origin, const glm::vec3 &inv_dir,
+                                           float t_max, float *dist){
+#ifdef RT_SIMD_X86
+            __m128 t_enter = _mm_setzero_ps();
+            __m128 t_exit = _mm_set1_ps(t_max);
+            const __m128i zero = _mm_setzero_si128();
+            for (int a = 0; a < 3; a++){
+                int32_t lo_bytes, hi_bytes;
+                memcpy(&lo_bytes, node.lo[a], 4);
+                memcpy(&hi_bytes, node.hi[a], 4);
+                __m128 q_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(lo_bytes), zero), zero));
+                __m128 q_hi = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(hi_bytes), zero), zero));
+                const __m128 base = _mm_set1_ps(node.origin[a]), scale = _mm_set1_ps(scaleOf(node.exponent[a]));
+                const __m128 o = _mm_set1_ps(origin[a]), inv = _mm_set1_ps(inv_dir[a]);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(base, _mm_mul_ps(q_lo, scale)), o), inv);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(base, _mm_mul_ps(q_hi, scale)), o), inv);
+                t_enter = _mm_max_ps(t_enter, _mm_min_ps(t0, t1));
+                t_exit = _mm_min_ps(t_exit, _mm_max_ps(t0, t1));
+            }
+            _mm_storeu_ps(dist, t_enter);
+            unsigned int mask = (unsigned int) _mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit));
+#else
+            unsigned int mask = 0;
+            for (unsigned int i = 0; i < width; i++){
+                float t_enter = 0, t_exit = t_max;
+                for (int a = 0; a < 3; a++){
+                    float scale = scaleOf(node.exponent[a]);
+                    float t0 = (node.origin[a] + node.lo[a][i] * scale - origin[a]) * inv_dir[a];
+                    float t1 = (node.origin[a] + node.hi[a][i] * scale - origin[a]) * inv_dir[a];
+                    t_enter = std::max(t_enter, std::min(t0, t1));
+                    t_exit = std::min(t_exit, std::max(t0, t1));
+                }
+                dist[i] = t_enter;
+                mask |= unsigned(t_enter <= t_exit) << i;
+            }
+#endif
+            return mask & ((1u << node.child_count) - 1);
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_WIDE_BVH_H
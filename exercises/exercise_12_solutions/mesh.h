@@ -54,6 +54,17 @@ public:
         setupMesh();
     }
 
+    // constructor for a mesh read from a cache: vertexData has all the positions, then all the normals, texture coords,
+    // tangents and bitangents, each from its offset in streamOffsets (-1 if missing), and goes straight to the vertex
+    // buffer, so vertices stays empty
+    Mesh(const char *vertexData, size_t vertexBytes, const long long streamOffsets[5], const unsigned int *indexData, unsigned int indexCount, vector<Texture> textures)
+    {
+        this->indices.assign(indexData, indexData + indexCount);
+        this->textures = textures;
+
+        setupMesh(vertexData, vertexBytes, streamOffsets, indexData);
+    }
+
     // render the mesh
     void Draw(Shader shader, GLsizei instanceCount = 1, unsigned int indirectBuffer = 0)
     {
@@ -155,5 +166,32 @@ private:
 
         glBindVertexArray(0);
     }
+
+    // same for a cached mesh, whose attributes are one after the other in the buffer instead of interleaved
+    void setupMesh(const char *vertexData, size_t vertexBytes, const long long streamOffsets[5], const unsigned int *indexData)
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertexData, GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
+
+        // the attributes keep the locations above: positions, normals, texture coords, tangents and bitangents
+        const GLint components[5] = {3, 3, 2, 3, 3};
+        for(unsigned int i = 0; i < 5; i++)
+        {
+            if(streamOffsets[i] < 0)
+                continue;
+            glEnableVertexAttribArray(i);
+            glVertexAttribPointer(i, components[i], GL_FLOAT, GL_FALSE, 0, (void*)(size_t)streamOffsets[i]);
+        }
+
+        glBindVertexArray(0);
+    }
 };
 #endif
\ No newline at end of file
@@ -10,9 +10,11 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <assimp/DefaultIOSystem.h>
 
 #include <mesh.h>
 #include <shader.h>
+#include <meshcache.h>
 
 #include <string>
 #include <fstream>
@@ -20,10 +22,29 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <algorithm>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
+// Assimp's file system, noting the files the importer opens: the model, then its material library or any other file
+// the model refers to. The mesh cache is checked against all of them
+class RecordingIOSystem : public Assimp::DefaultIOSystem
+{
+public:
+    vector<string> opened;
+
+    explicit RecordingIOSystem(const string &path) : opened(1, path) {}
+
+    Assimp::IOStream* Open(const char* file, const char* mode = "rb") override
+    {
+        Assimp::IOStream* stream = Assimp::DefaultIOSystem::Open(file, mode);
+        if(stream && find(opened.begin(), opened.end(), string(file)) == opened.end())
+            opened.push_back(file);
+        return stream;
+    }
+};
+
 class Model
 {
 public:
@@ -52,8 +73,18 @@ private:
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
     {
-        // read file via ASSIMP
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // with meshcache::enabled(), the meshes of an earlier run are read from their cache, straight into the vertex buffers
+        string cachePath = meshcache::cachePath(path, "assimp");
+        if(meshcache::enabled() && loadCache(cachePath))
+            return;
+
+        // read file via ASSIMP, noting the files it reads for the cache
         Assimp::Importer importer;
+        RecordingIOSystem *files = new RecordingIOSystem(path);
+        importer.SetIOHandler(files); // the importer deletes it
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
@@ -61,11 +92,62 @@ private:
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
             return;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+
+        // and cache them for the next run. Texture images are read again on every run, only their paths are cached
+        if(meshcache::enabled())
+            writeCache(cachePath, files->opened);
+    }
+
+    // creates the meshes from the cache at cachePath, if it's up to date with the files they were made from
+    bool loadCache(string const &cachePath)
+    {
+        meshcache::MeshCache cache;
+        if(!cache.open(cachePath.c_str()))
+            return false;
+        for(unsigned int i = 0; i < cache.meshCount(); i++)
+        {
+            long long streamOffsets[meshcache::attributeCount];
+            for(unsigned int a = 0; a < meshcache::attributeCount; a++)
+                streamOffsets[a] = cache.streamOffset(i, (meshcache::Attribute) a);
+            vector<Texture> textures;
+            for(const pair<string, string> &texture : cache.textures(i))
+                textures.push_back(loadTexture(texture.second.c_str(), texture.first, texture.first == "texture_diffuse"));
+            const meshcache::Entry &entry = cache.mesh(i);
+            meshes.push_back(Mesh(cache.vertexData(i), (size_t)entry.vertex_bytes, streamOffsets, cache.indices(i), entry.index_count, textures));
+        }
+        return true;
+    }
+
+    // writes the meshes just read from the files at dependencies (the model first) to the cache at cachePath, with a
+    // stream per vertex attribute
+    void writeCache(string const &cachePath, const vector<string> &dependencies)
+    {
+        vector<meshcache::MeshInput> inputs(meshes.size());
+        for(unsigned int i = 0; i < meshes.size(); i++)
+        {
+            const Mesh &mesh = meshes[i];
+            meshcache::MeshInput &input = inputs[i];
+            input.vertex_count = (uint32_t)mesh.vertices.size();
+            if(!mesh.vertices.empty())
+            {
+                // the streams are read from the interleaved vertices, in the order of the attribute locations
+                const Vertex &first = mesh.vertices[0];
+                const float *streams[] = {&first.Position.x, &first.Normal.x, &first.TexCoords.x, &first.Tangent.x, &first.Bitangent.x};
+                for(unsigned int a = 0; a < meshcache::attributeCount; a++)
+                {
+                    input.streams[a] = streams[a];
+                    input.strides[a] = sizeof(Vertex);
+                }
+            }
+            input.indices = mesh.indices.data();
+            input.index_count = (uint32_t)mesh.indices.size();
+            for(const Texture &texture : mesh.textures)
+                input.textures.push_back(make_pair(texture.type, texture.path));
+        }
+        meshcache::write(cachePath.c_str(), dependencies, inputs);
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -176,29 +258,28 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory, type == aiTextureType_DIFFUSE);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back(loadTexture(str.C_Str(), typeName, type == aiTextureType_DIFFUSE));
         }
         return textures;
     }
+
+    // the texture at path, relative to the model, loaded unless it was loaded before
+    Texture loadTexture(const char *path, const string &typeName, bool gamma)
+    {
+        // check if texture was loaded before and if so, return it: skip loading a new texture
+        for(unsigned int j = 0; j < textures_loaded.size(); j++)
+        {
+            if(std::strcmp(textures_loaded[j].path.data(), path) == 0)
+                return textures_loaded[j]; // a texture with the same filepath has already been loaded. (optimization)
+        }
+        // if texture hasn't been loaded already, load it
+        Texture texture;
+        texture.id = TextureFromFile(path, this->directory, gamma);
+        texture.type = typeName;
+        texture.path = path;
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+        return texture;
+    }
 };
 
 
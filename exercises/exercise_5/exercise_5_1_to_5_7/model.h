@@ -56,20 +56,22 @@ private:
         std::vector<glm::vec3> vertices;
         std::vector<glm::vec2> uvs;
         std::vector<glm::vec3> normals;
+        std::vector<unsigned int> indices;
 
-        loadOBJ(path.c_str(), vertices, uvs, normals);
-        meshes.push_back(processMesh(vertices, uvs, normals));
+        // the corners that share position, uv and normal are a single vertex
+        loadOBJ(path.c_str(), vertices, uvs, normals, indices);
+        meshes.push_back(processMesh(vertices, uvs, normals, indices));
 
     }
 
 
     Mesh processMesh(const std::vector<glm::vec3> & inVertices,
                      const std::vector<glm::vec2> & inUvs,
-                     const std::vector<glm::vec3> & inNormals)
+                     const std::vector<glm::vec3> & inNormals,
+                     const std::vector<unsigned int> & indices)
     {
         // data to fill
         std::vector<Vertex> vertices;
-        std::vector<unsigned int> indices;
 
         // Walk through each of the mesh's vertices
         for(unsigned int i = 0; i < inVertices.size(); i++)
@@ -84,7 +86,6 @@ private:
             vertex.TexCoords = i < inUvs.size() ? inUvs[i] : glm::vec2(0.0f, 0.0f);
 
             vertices.push_back(vertex);
-            indices.push_back(i);
         }
 
         // return a mesh object created from the extracted mesh data
@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include <vector>
+#include <string>
 
 // NEW! as our scene gets more complex, we start using more helper classes
 //  I recommend that you read through the camera.h and model.h files to see if you can map the the previous
@@ -149,8 +150,12 @@ void drawObjects();
 void drawGui();
 
 
-int main()
+int main(int argc, char *argv[])
 {
+    // --mesh-cache: keep the loaded meshes in cache files next to the models, the next runs start much faster
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--mesh-cache") meshcache::enabled() = true;
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
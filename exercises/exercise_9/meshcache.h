@@ -0,0 +1,417 @@
+// Binary mesh cache: the meshes a loader made of a model, in the layout they are drawn with, so that later runs read
+// the cache instead of importing the model again. Used by loadOBJ (objloader.h) and by the Assimp Model of the
+// exercises that draw with it.
+
+#ifndef GRAPHICSPROGRAMMINGEXERCISES_MESHCACHE_H
+#define GRAPHICSPROGRAMMINGEXERCISES_MESHCACHE_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <stdio.h>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cfloat>
+
+#include <glm/glm.hpp>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// The file is a Header, a Dependency per file the meshes were made from and then the payload:
+// - an Entry per mesh
+// - for each mesh, 16 byte aligned: its attribute streams one after the other in Attribute order (all the positions,
+//   then all the normals...), its indices (three per triangle) and the type and path of its textures, each a uint32_t
+//   length and its characters
+// - the path of each dependency
+// The checksum covers the payload. Numbers are stored as the machine has them, another version or byte order makes a
+// cache invalid, as does a change of size, modification time and contents of any of the dependencies.
+namespace meshcache {
+
+    // loaders read and write caches only when this is set. It's off by default, so that running an exercise doesn't
+    // leave files next to its models; the solutions and the headless renderer turn it on with --mesh-cache
+    inline bool &enabled(){
+        static bool enabled = false;
+        return enabled;
+    }
+
+    // the cache a loader keeps next to the model file at path
+    inline std::string cachePath(const std::string &path, const char *loader){
+        return path + "." + loader + ".meshcache";
+    }
+
+    // 64 bit hash of bytes, read 8 at a time. Tells a changed file or a damaged cache apart, it's not cryptographic
+    inline uint64_t hashBytes(const char *data, size_t bytes){
+        uint64_t hash = 14695981039346656037ull ^ bytes;
+        size_t i = 0;
+        for (; i + 8 <= bytes; i += 8){
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * 1099511628211ull;
+            hash ^= hash >> 32;
+        }
+        for (; i < bytes; i++) hash = (hash ^ (unsigned char) data[i]) * 1099511628211ull;
+        return hash ^ (hash >> 29);
+    }
+
+    // size and last modification time of the file at path, in nanoseconds (in seconds on Windows, where a change that
+    // keeps the size within the second the cache was written goes unnoticed)
+    inline bool fileStamp(const char *path, uint64_t &bytes, int64_t &time){
+#ifdef _WIN32
+        struct _stat64 st;
+        if (_stat64(path, &st) != 0) return false;
+        bytes = (uint64_t) st.st_size;
+        time = (int64_t) st.st_mtime;
+#else
+        struct stat st;
+        if (stat(path, &st) != 0) return false;
+        bytes = (uint64_t) st.st_size;
+#ifdef __APPLE__
+        time = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        time = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+        return true;
+    }
+
+    // a whole file, read only. Memory mapped on POSIX systems, read on Windows (mapping it there needs windows.h)
+    class File{
+    public:
+        File() = default;
+        File(const File &) = delete;
+        File &operator=(const File &) = delete;
+        ~File() { close(); }
+
+        bool open(const char *path){
+            close();
+#ifndef _WIN32
+            int fd = ::open(path, O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void *address = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (address != MAP_FAILED) {
+                    data = (const char *) address;
+                    bytes = (size_t) st.st_size;
+                    mapped = true;
+                }
+            }
+            ::close(fd);
+            if (mapped) return true;
+#endif
+            FILE *stream = fopen(path, "rb");
+            if (!stream) return false;
+            bool read = fseek(stream, 0, SEEK_END) == 0;
+            long size = read ? ftell(stream) : -1;
+            read = size >= 0 && fseek(stream, 0, SEEK_SET) == 0;
+            if (read) {
+                copy.resize((size_t) size);
+                read = size == 0 || fread(&copy[0], 1, copy.size(), stream) == copy.size();
+            }
+            fclose(stream);
+            if (!read) { close(); return false; }
+            data = copy.data();
+            bytes = copy.size();
+            return true;
+        }
+
+        void close(){
+#ifndef _WIN32
+            if (mapped) munmap((void *) data, bytes);
+#endif
+            mapped = false;
+            data = nullptr;
+            bytes = 0;
+            copy.clear();
+        }
+
+        const char *begin() const { return data; }
+        const char *end() const { return data + bytes; }
+        size_t size() const { return bytes; }
+
+    private:
+        const char *data = nullptr;
+        size_t bytes = 0;
+        bool mapped = false;
+        std::string copy;
+    };
+
+    enum class Attribute{ Position, Normal, TexCoord, Tangent, Bitangent };
+    const unsigned int attributeCount = 5;
+    const uint32_t version = 2;
+
+    inline unsigned int attributeComponents(unsigned int attribute){
+        return attribute == (unsigned int) Attribute::TexCoord ? 2 : 3;
+    }
+
+    struct Header{
+        char magic[8];          // "GPMESH" and two zeros
+        uint32_t version;       // meshcache::version
+        uint32_t mesh_count;
+        uint32_t dependency_count;
+        uint32_t reserved;
+        uint64_t file_bytes;
+        uint64_t checksum;
+        float bounds_min[3], bounds_max[3]; // of all the meshes
+    };
+
+    // a file the meshes were made from, as it was when the cache was written
+    struct Dependency{
+        uint64_t bytes;
+        int64_t time;
+        uint64_t hash;
+        uint64_t path_offset;   // from the start of the file
+        uint32_t path_length;
+        uint32_t reserved;
+    };
+
+    struct Entry{
+        uint32_t attributes;    // a bit per Attribute the mesh has
+        uint32_t vertex_count;
+        uint32_t index_count;
+        uint32_t texture_count;
+        uint64_t vertex_offset; // of the first stream, from the start of the file
+        uint64_t vertex_bytes;  // of all the streams
+        uint64_t index_offset;
+        uint64_t texture_offset;
+        float bounds_min[3], bounds_max[3];
+    };
+
+    // a cache file, read and checked against the files it was made from
+    class MeshCache{
+    public:
+        // reads the cache at path if it's intact and up to date with all its dependencies. A dependency whose time
+        // changed but not its contents keeps the cache, which is stamped with the new time
+        bool open(const char *path){
+            close();
+            if (!file.open(path) || file.size() < sizeof(Header)) return fail();
+            memcpy(&header, file.begin(), sizeof(header));
+            uint64_t payload = sizeof(Header) + uint64_t(header.dependency_count) * sizeof(Dependency);
+            if (memcmp(header.magic, "GPMESH\0\0", 8) != 0 || header.version != version ||
+                header.file_bytes != file.size() || header.dependency_count == 0 ||
+                file.size() < payload + uint64_t(header.mesh_count) * sizeof(Entry))
+                return fail();
+            if (hashBytes(file.begin() + payload, file.size() - payload) != header.checksum) return fail();
+
+            for (uint32_t i = 0; i < header.dependency_count; i++){
+                Dependency dependency;
+                memcpy(&dependency, file.begin() + sizeof(Header) + i * sizeof(Dependency), sizeof(dependency));
+                if (dependency.path_offset < payload || dependency.path_offset + dependency.path_length > file.size())
+                    return fail();
+                std::string source(file.begin() + dependency.path_offset, dependency.path_length);
+                if (!upToDate(path, i, dependency, source.c_str())) return fail();
+            }
+
+            entries.resize(header.mesh_count);
+            if (!entries.empty())
+                memcpy(&entries[0], file.begin() + payload, entries.size() * sizeof(Entry));
+            for (const Entry &entry : entries)
+                if (entry.vertex_offset + entry.vertex_bytes > file.size() || entry.index_offset % 4 != 0 ||
+                    entry.index_offset + uint64_t(entry.index_count) * 4 > file.size() || entry.texture_offset > file.size())
+                    return fail();
+            for (size_t i = 0; i < entries.size(); i++)
+                for (uint32_t k = 0; k < entries[i].index_count; k++)
+                    if (indices(i)[k] >= entries[i].vertex_count) return fail();
+            return true;
+        }
+
+        void close(){
+            file.close();
+            entries.clear();
+        }
+
+        size_t meshCount() const { return entries.size(); }
+        const Entry &mesh(size_t i) const { return entries[i]; }
+        glm::vec3 boundsMin() const { return glm::vec3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]); }
+        glm::vec3 boundsMax() const { return glm::vec3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]); }
+
+        // all the streams of mesh i, for a single glBufferData
+        const char *vertexData(size_t i) const { return file.begin() + entries[i].vertex_offset; }
+
+        // where the stream of attribute starts in vertexData(i), or -1 if the mesh doesn't have it
+        long long streamOffset(size_t i, Attribute attribute) const {
+            const Entry &entry = entries[i];
+            if (!(entry.attributes & (1u << unsigned(attribute)))) return -1;
+            long long offset = 0;
+            for (unsigned int a = 0; a < unsigned(attribute); a++)
+                if (entry.attributes & (1u << a)) offset += 4ll * attributeComponents(a) * entry.vertex_count;
+            return offset;
+        }
+        const float *stream(size_t i, Attribute attribute) const {
+            long long offset = streamOffset(i, attribute);
+            return offset < 0 ? nullptr : (const float *) (vertexData(i) + offset);
+        }
+
+        const unsigned int *indices(size_t i) const { return (const unsigned int *) (file.begin() + entries[i].index_offset); }
+
+        // the type and path of each texture of mesh i
+        std::vector<std::pair<std::string, std::string>> textures(size_t i) const {
+            std::vector<std::pair<std::string, std::string>> textures;
+            const char *p = file.begin() + entries[i].texture_offset;
+            std::string strings[2];
+            for (uint32_t t = 0; t < entries[i].texture_count; t++){
+                for (std::string &s : strings){
+                    uint32_t length;
+                    if (p + 4 > file.end()) return textures;
+                    memcpy(&length, p, 4);
+                    p += 4;
+                    if (length > size_t(file.end() - p)) return textures;
+                    s.assign(p, length);
+                    p += length;
+                }
+                textures.emplace_back(strings[0], strings[1]);
+            }
+            return textures;
+        }
+
+    private:
+        File file;
+        Header header;
+        std::vector<Entry> entries;
+
+        bool fail(){
+            close();
+            return false;
+        }
+
+        // true if the file at source still is dependency i of the cache at path
+        static bool upToDate(const char *path, uint32_t i, const Dependency &dependency, const char *source){
+            uint64_t bytes;
+            int64_t time;
+            if (!fileStamp(source, bytes, time) || bytes != dependency.bytes) return false;
+            if (time == dependency.time) return true;
+            File contents;
+            if (!contents.open(source) || hashBytes(contents.begin(), contents.size()) != dependency.hash) return false;
+
+            // the cache is open read only, so the new time is written through another handle
+            FILE *stream = fopen(path, "r+b");
+            if (!stream) return true;
+            if (fseek(stream, long(sizeof(Header) + i * sizeof(Dependency) + offsetof(Dependency, time)), SEEK_SET) == 0)
+                fwrite(&time, sizeof(time), 1, stream);
+            fclose(stream);
+            return true;
+        }
+    };
+
+    // a mesh to write to a cache. streams[a] points to the first vertex of attribute a (null if the mesh doesn't have
+    // it), and the next vertex is strides[a] bytes further (0 if they are packed)
+    struct MeshInput{
+        uint32_t vertex_count = 0;
+        const float *streams[attributeCount] = {};
+        size_t strides[attributeCount] = {};
+        const unsigned int *indices = nullptr;
+        uint32_t index_count = 0;
+        std::vector<std::pair<std::string, std::string>> textures; // type and path
+    };
+
+    // writes the cache of meshes, made from the files at dependencies (the model first), to path. It's written to a
+    // temporary file that replaces the cache once complete, so a failed write leaves no broken cache behind
+    inline bool write(const char *path, const std::vector<std::string> &dependencies, const std::vector<MeshInput> &meshes){
+        if (dependencies.empty()) return false;
+        Header header{};
+        memcpy(header.magic, "GPMESH\0\0", 8);
+        header.version = version;
+        header.mesh_count = (uint32_t) meshes.size();
+        header.dependency_count = (uint32_t) dependencies.size();
+        const uint64_t payload_offset = sizeof(Header) + dependencies.size() * sizeof(Dependency);
+
+        std::vector<Dependency> stamps(dependencies.size());
+        for (size_t i = 0; i < dependencies.size(); i++){
+            Dependency &stamp = stamps[i];
+            stamp = Dependency();
+            File contents;
+            if (!fileStamp(dependencies[i].c_str(), stamp.bytes, stamp.time) || !contents.open(dependencies[i].c_str()))
+                return false;
+            stamp.hash = hashBytes(contents.begin(), contents.size());
+        }
+
+        std::vector<Entry> entries(meshes.size());
+        std::string payload(meshes.size() * sizeof(Entry), '\0');
+        auto align = [&](){ payload.resize((payload_offset + payload.size() + 15) / 16 * 16 - payload_offset); };
+        glm::vec3 all_min(FLT_MAX), all_max(-FLT_MAX);
+        for (size_t m = 0; m < meshes.size(); m++){
+            const MeshInput &mesh = meshes[m];
+            Entry &entry = entries[m];
+            entry.vertex_count = mesh.vertex_count;
+            entry.index_count = mesh.index_count;
+            entry.texture_count = (uint32_t) mesh.textures.size();
+
+            align();
+            entry.vertex_offset = payload_offset + payload.size();
+            for (unsigned int a = 0; a < attributeCount; a++){
+                if (!mesh.streams[a]) continue;
+                entry.attributes |= 1u << a;
+                size_t element = attributeComponents(a) * sizeof(float);
+                size_t stride = mesh.strides[a] ? mesh.strides[a] : element;
+                const char *source = (const char *) mesh.streams[a];
+                for (uint32_t v = 0; v < mesh.vertex_count; v++) payload.append(source + v * stride, element);
+            }
+            entry.vertex_bytes = payload_offset + payload.size() - entry.vertex_offset;
+
+            glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+            if (mesh.streams[0]) {
+                const char *positions = (const char *) mesh.streams[0];
+                size_t stride = mesh.strides[0] ? mesh.strides[0] : sizeof(glm::vec3);
+                for (uint32_t v = 0; v < mesh.vertex_count; v++){
+                    glm::vec3 position;
+                    memcpy(&position, positions + v * stride, sizeof(position));
+                    min = glm::min(min, position);
+                    max = glm::max(max, position);
+                }
+            }
+            all_min = glm::min(all_min, min);
+            all_max = glm::max(all_max, max);
+            for (int i = 0; i < 3; i++){
+                entry.bounds_min[i] = min[i];
+                entry.bounds_max[i] = max[i];
+            }
+
+            align();
+            entry.index_offset = payload_offset + payload.size();
+            if (mesh.index_count) payload.append((const char *) mesh.indices, mesh.index_count * sizeof(unsigned int));
+
+            entry.texture_offset = payload_offset + payload.size();
+            for (const std::pair<std::string, std::string> &texture : mesh.textures)
+                for (const std::string *s : {&texture.first, &texture.second}){
+                    uint32_t length = (uint32_t) s->size();
+                    payload.append((const char *) &length, 4);
+                    payload.append(*s);
+                }
+        }
+        for (size_t i = 0; i < dependencies.size(); i++){
+            stamps[i].path_offset = payload_offset + payload.size();
+            stamps[i].path_length = (uint32_t) dependencies[i].size();
+            payload.append(dependencies[i]);
+        }
+        if (!entries.empty()) memcpy(&payload[0], &entries[0], entries.size() * sizeof(Entry));
+        for (int i = 0; i < 3; i++){
+            header.bounds_min[i] = all_min[i];
+            header.bounds_max[i] = all_max[i];
+        }
+        header.file_bytes = payload_offset + payload.size();
+        header.checksum = hashBytes(payload.data(), payload.size());
+
+        std::string temporary = std::string(path) + ".tmp";
+        FILE *stream = fopen(temporary.c_str(), "wb");
+        if (!stream) return false;
+        bool written = fwrite(&header, sizeof(header), 1, stream) == 1 &&
+                       fwrite(stamps.data(), sizeof(Dependency), stamps.size(), stream) == stamps.size() &&
+                       fwrite(payload.data(), 1, payload.size(), stream) == payload.size();
+        written = fclose(stream) == 0 && written;
+        if (written) {
+            remove(path); // rename doesn't replace files on Windows
+            written = rename(temporary.c_str(), path) == 0;
+        }
+        if (!written) remove(temporary.c_str());
+        return written;
+    }
+}
+
+#endif //GRAPHICSPROGRAMMINGEXERCISES_MESHCACHE_H
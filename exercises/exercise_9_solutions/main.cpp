@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include <vector>
+#include <string>
 
 #include "shader.h"
 #include "camera.h"
@@ -182,8 +183,12 @@ void prepareDeferredPass();
 void restoreDeferredPass();
 
 
-int main()
+int main(int argc, char *argv[])
 {
+    // --mesh-cache: keep the loaded meshes in cache files next to the models, the next runs start much faster
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--mesh-cache") meshcache::enabled() = true;
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();